@@ -0,0 +1,374 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <SFML/Network.hpp>
+
+#include "BaseThread.h"
+#include "Log.h"
+#include "Packet.h"
+#include "ServerAPI.h"
+
+
+namespace demonorium
+{
+	/*
+	 * Канал управления: TCP только на 127.0.0.1, команда - байт кода и фиксированная полезная нагрузка.
+	 * Ответ на каждую команду: [код команды][AdminStatus][uint32 длина данных][данные].
+	 * Числа передаются в порядке байт машины, как и в игровом протоколе, адреса - байтами 1 2 3 4.
+	 *
+	 * GET_STATE:	[uint64 версия снимка][byte игра идёт][byte опрос готовности][uint16 порт][uint32 игроков]
+	 * GET_ROSTER:	[uint64 версия снимка][uint32 игроков], далее для каждого игрока
+	 *				[ip][ip убийцы][uint16 порт][byte готов][byte жив][uint32 убийств][int32 время смерти][byte длина имени][имя]
+	 * GET_LEADERBOARD: [uint32 записей], далее для каждой записи
+	 *				[ip][uint32 матчей][uint32 побед][uint32 убийств][uint32 смертей][byte длина имени][имя]
+	 */
+	enum class AdminCodes: byte {
+		START_GAME	 = 0,
+		FORCE_START	 = 1,
+		CLEAR		 = 2,
+		FORCE_ESTART = 3,
+		END_GAME	 = 4,
+		SET_PORT	 = 16,	//uint16 новый порт
+		SET_ALIAS	 = 17,	//4 байта адреса, подменяющего 127.0.0.1
+		GET_STATE	 = 32,
+		GET_ROSTER	 = 33,
+		GET_LEADERBOARD = 34	//uint16 число записей
+	};
+
+	enum class AdminStatus: byte {
+		OK		= 0,
+		UNKNOWN	= 1,	//Неизвестная команда, соединение закрывается
+		BUSY	= 2,	//Очередь запросов сервера переполнена, команду нужно повторить
+		FAILED	= 3
+	};
+
+	/**
+	 * \brief Поток канала управления сервером, заменяет кнопки интерфейса для автоматизации.
+	 * Сокеты клиентов неблокирующие: ответ копится в очереди клиента и уходит по мере того, как сокет его принимает.
+	 * Клиент, который не читает ответы, отключается, когда его очередь превышает предел, и не держит поток.
+	 */
+	class AdminThread: public BaseThread {
+		struct Client {
+			sf::TcpSocket		socket;
+			std::vector<byte>	input;
+			//Неотправленные ответы, первые sent байт уже ушли
+			std::vector<byte>	output;
+			size_t				sent = 0;
+			//Очередь превысила предел или сокет закрыт: клиента нужно отключить
+			bool				broken = false;
+		};
+
+		//Заголовок ответа: код, статус и длина данных
+		static constexpr size_t HEADER_SIZE = 2 + sizeof(sf::Uint32);
+		//Размер буфера одного чтения из сокета
+		static constexpr size_t RECEIVE_SIZE = 1024;
+		//Ожидание без неотправленных ответов и с ними: селектор не ждёт готовности к записи
+		static constexpr std::chrono::milliseconds IDLE_WAIT  = std::chrono::milliseconds(100);
+		static constexpr std::chrono::milliseconds FLUSH_WAIT = std::chrono::milliseconds(5);
+
+		sf::TcpListener		m_listener;
+		sf::SocketSelector	m_selector;
+		std::vector<std::unique_ptr<Client>> m_clients;
+		unsigned short		m_port;
+		//Самая длинная очередь ответов клиента
+		size_t				m_output_limit;
+		Log					m_log;
+
+		//Размер полезной нагрузки команды, -1 для неизвестного кода
+		static int payloadSize(byte code);
+
+		void accept();
+		//Выполнить все полностью принятые команды клиента, false если клиента нужно отключить
+		bool process(Client& client);
+		void reply(Client& client, AdminCodes code, AdminStatus status);
+		void replyState(Client& client);
+		void replyRoster(Client& client);
+		void replyLeaderboard(Client& client, sf::Uint16 limit);
+		//Поставить ответ в очередь клиента и отправить, сколько примет сокет
+		void send(Client& client, Packet& packet);
+		//Отправить очередь клиента, сколько примет сокет
+		void flush(Client& client);
+	protected:
+		void onInit() override;
+		void onFrame() override;
+		void onDestruction() override;
+	public:
+		//outputLimit - байт неотправленных ответов одному клиенту, больше - клиент отключается
+		explicit AdminThread(unsigned short port, size_t outputLimit = 64 * 1024 * 1024);
+		~AdminThread() override;
+	};
+
+
+	inline int AdminThread::payloadSize(byte code) {
+		switch (static_cast<AdminCodes>(code)) {
+		case AdminCodes::START_GAME:
+		case AdminCodes::FORCE_START:
+		case AdminCodes::CLEAR:
+		case AdminCodes::FORCE_ESTART:
+		case AdminCodes::END_GAME:
+		case AdminCodes::GET_STATE:
+		case AdminCodes::GET_ROSTER:
+			return 0;
+		case AdminCodes::SET_PORT:
+		case AdminCodes::GET_LEADERBOARD:
+			return sizeof(sf::Uint16);
+		case AdminCodes::SET_ALIAS:
+			return 4;
+		default:
+			return -1;
+		}
+	}
+
+	inline void AdminThread::accept() {
+		auto client = std::make_unique<Client>();
+		if (m_listener.accept(client->socket) == sf::Socket::Done) {
+			client->socket.setBlocking(false);
+			m_log.write("Подключение к каналу управления: ", client->socket.getRemoteAddress().toString());
+			m_selector.add(client->socket);
+			m_clients.push_back(std::move(client));
+		}
+	}
+
+	inline bool AdminThread::process(Client& client) {
+		size_t offset = 0;
+		while (offset < client.input.size()) {
+			const byte code = client.input[offset];
+			const int size = payloadSize(code);
+			if (size < 0) {
+				m_log.write("Неизвестная команда управления: ", static_cast<int>(code));
+				reply(client, static_cast<AdminCodes>(code), AdminStatus::UNKNOWN);
+				return false;
+			}
+			//Команда пришла не целиком, ждём остаток
+			if (offset + 1 + size > client.input.size())
+				break;
+
+			const byte* payload = client.input.data() + offset + 1;
+			switch (static_cast<AdminCodes>(code)) {
+			case AdminCodes::SET_PORT: {
+				sf::Uint16 port;
+				std::memcpy(&port, payload, sizeof(port));
+				m_log.write("Канал управления: смена порта на ", port);
+				ServerAPI::update_port(port);
+				reply(client, AdminCodes::SET_PORT, AdminStatus::OK);
+				break;
+			}
+			case AdminCodes::SET_ALIAS:
+				m_log.write("Канал управления: смена псевдонима 127.0.0.1");
+				ServerAPI::set_ip_alias(payload[0], payload[1], payload[2], payload[3]);
+				reply(client, AdminCodes::SET_ALIAS, AdminStatus::OK);
+				break;
+			case AdminCodes::GET_STATE:
+				replyState(client);
+				break;
+			case AdminCodes::GET_ROSTER:
+				replyRoster(client);
+				break;
+			case AdminCodes::GET_LEADERBOARD: {
+				sf::Uint16 limit;
+				std::memcpy(&limit, payload, sizeof(limit));
+				replyLeaderboard(client, limit);
+				break;
+			}
+			default:
+				//Остальные коды совпадают с UserRequest
+				m_log.write("Канал управления: запрос ", static_cast<int>(code));
+				reply(client, static_cast<AdminCodes>(code),
+					ServerAPI::request(static_cast<UserRequest>(code)) ? AdminStatus::OK : AdminStatus::BUSY);
+				break;
+			}
+			offset += 1 + size;
+		}
+
+		client.input.erase(client.input.begin(), client.input.begin() + offset);
+		return true;
+	}
+
+	inline void AdminThread::reply(Client& client, AdminCodes code, AdminStatus status) {
+		Packet packet(HEADER_SIZE);
+		packet.write(static_cast<byte>(code));
+		packet.write(static_cast<byte>(status));
+		packet.write(sf::Uint32(0));
+		send(client, packet);
+	}
+
+	inline void AdminThread::replyState(Client& client) {
+		const auto snapshot = ServerAPI::get_snapshot();
+
+		Packet packet(HEADER_SIZE + sizeof(sf::Uint64) + 2 + sizeof(sf::Uint16) + sizeof(sf::Uint32));
+		packet.write(static_cast<byte>(AdminCodes::GET_STATE));
+		packet.write(static_cast<byte>(AdminStatus::OK));
+		packet.write(static_cast<sf::Uint32>(packet.rawSize() - HEADER_SIZE));
+		packet.write(static_cast<sf::Uint64>(snapshot->version));
+		packet.write(static_cast<byte>(snapshot->game_started));
+		packet.write(static_cast<byte>(snapshot->ready_testing));
+		packet.write(static_cast<sf::Uint16>(ServerAPI::get_port()));
+		packet.write(static_cast<sf::Uint32>(snapshot->players.size()));
+		send(client, packet);
+	}
+
+	inline void AdminThread::replyRoster(Client& client) {
+		constexpr size_t RECORD_SIZE = 4 + 4 + sizeof(sf::Uint16) + 2 + sizeof(sf::Uint32) + sizeof(sf::Int32) + 1;
+		const auto snapshot = ServerAPI::get_snapshot();
+
+		size_t size = HEADER_SIZE + sizeof(sf::Uint64) + sizeof(sf::Uint32);
+		for (const auto& player : snapshot->players)
+			size += RECORD_SIZE + std::min<size_t>(player.name.size(), 255);
+
+		Packet packet(size);
+		packet.write(static_cast<byte>(AdminCodes::GET_ROSTER));
+		packet.write(static_cast<byte>(AdminStatus::OK));
+		packet.write(static_cast<sf::Uint32>(size - HEADER_SIZE));
+		packet.write(static_cast<sf::Uint64>(snapshot->version));
+		packet.write(static_cast<sf::Uint32>(snapshot->players.size()));
+
+		for (const auto& player : snapshot->players) {
+			const auto name = player.name.view();
+			const byte name_size = static_cast<byte>(std::min<size_t>(name.size(), 255));
+			packet.write(player.ip);
+			packet.write(player.killer);
+			packet.write(player.port);
+			packet.write(static_cast<byte>(player.ready));
+			packet.write(static_cast<byte>(player.alive));
+			packet.write(static_cast<sf::Uint32>(player.kills));
+			packet.write(static_cast<sf::Int32>(player.die_time));
+			packet.write(name_size);
+			packet.write(name.data(), name_size);
+		}
+		send(client, packet);
+	}
+
+	inline void AdminThread::replyLeaderboard(Client& client, sf::Uint16 limit) {
+		constexpr size_t RECORD_SIZE = 4 + 4 * sizeof(sf::Uint32) + 1;
+		const auto leaderboard = ServerAPI::get_leaderboard(limit);
+
+		size_t size = HEADER_SIZE + sizeof(sf::Uint32);
+		for (const auto& entry : leaderboard)
+			size += RECORD_SIZE + std::min<size_t>(entry.name.size(), 255);
+
+		Packet packet(size);
+		packet.write(static_cast<byte>(AdminCodes::GET_LEADERBOARD));
+		packet.write(static_cast<byte>(AdminStatus::OK));
+		packet.write(static_cast<sf::Uint32>(size - HEADER_SIZE));
+		packet.write(static_cast<sf::Uint32>(leaderboard.size()));
+
+		for (const auto& entry : leaderboard) {
+			const byte name_size = static_cast<byte>(std::min<size_t>(entry.name.size(), 255));
+			packet.write(entry.ip);
+			packet.write(static_cast<sf::Uint32>(entry.matches));
+			packet.write(static_cast<sf::Uint32>(entry.wins));
+			packet.write(static_cast<sf::Uint32>(entry.kills));
+			packet.write(static_cast<sf::Uint32>(entry.deaths));
+			packet.write(name_size);
+			packet.write(entry.name.data(), name_size);
+		}
+		send(client, packet);
+	}
+
+	inline void AdminThread::send(Client& client, Packet& packet) {
+		if (client.broken)
+			return;
+		if (client.output.size() - client.sent + packet.size() > m_output_limit) {
+			m_log.write("Клиент канала управления не читает ответы: очередь больше ", m_output_limit, " байт");
+			client.broken = true;
+			return;
+		}
+		const auto* data = static_cast<const byte*>(packet.data());
+		client.output.insert(client.output.end(), data, data + packet.size());
+		flush(client);
+	}
+
+	inline void AdminThread::flush(Client& client) {
+		while (!client.broken && (client.sent < client.output.size())) {
+			size_t sent = 0;
+			const auto status = client.socket.send(client.output.data() + client.sent, client.output.size() - client.sent, sent);
+			client.sent += sent;
+			if ((status == sf::Socket::Disconnected) || (status == sf::Socket::Error)) {
+				m_log.write("Не удалось отправить ответ канала управления");
+				client.broken = true;
+			} else if (status != sf::Socket::Done) {
+				break;
+			}
+		}
+
+		if (client.sent == client.output.size()) {
+			client.output.clear();
+			client.sent = 0;
+		} else if (client.sent > client.output.size() / 2) {
+			//Отправленная половина освобождается, чтобы очередь не росла от частых маленьких ответов
+			client.output.erase(client.output.begin(), client.output.begin() + static_cast<std::ptrdiff_t>(client.sent));
+			client.sent = 0;
+		}
+	}
+
+	inline void AdminThread::onInit() {
+		m_log.open("Admin.log");
+		if (m_listener.listen(m_port, sf::IpAddress::LocalHost) == sf::Socket::Done) {
+			m_selector.add(m_listener);
+			m_log.write_important("Канал управления открыт на порту ", m_port);
+		} else {
+			m_log.write_important("Не удалось открыть канал управления на порту ", m_port);
+		}
+	}
+
+	inline void AdminThread::onFrame() {
+		//Ожидание ограничено, чтобы pause и destroyThread не ждали клиента.
+		//Пока есть неотправленные ответы, очереди досылаются каждые FLUSH_WAIT
+		const bool pending = std::any_of(m_clients.begin(), m_clients.end(), [](const std::unique_ptr<Client>& client) {
+			return !client->output.empty();
+		});
+		const bool ready = m_selector.wait(sf::milliseconds(static_cast<sf::Int32>((pending ? FLUSH_WAIT : IDLE_WAIT).count())));
+		if (!ready && !pending)
+			return;
+
+		if (ready && m_selector.isReady(m_listener))
+			accept();
+
+		for (size_t i = 0; i < m_clients.size();) {
+			Client& client = *m_clients[i];
+			bool alive = true;
+
+			flush(client);
+			if (ready && m_selector.isReady(client.socket)) {
+				byte buffer[RECEIVE_SIZE];
+				size_t received = 0;
+				const auto status = client.socket.receive(buffer, RECEIVE_SIZE, received);
+
+				if (status == sf::Socket::Done) {
+					client.input.insert(client.input.end(), buffer, buffer + received);
+					alive = process(client);
+				} else if (status != sf::Socket::NotReady) {
+					alive = false;
+				}
+			}
+			alive = alive && !client.broken;
+
+			if (alive) {
+				++i;
+			} else {
+				m_log.write("Отключение от канала управления");
+				m_selector.remove(client.socket);
+				m_clients.erase(m_clients.begin() + i);
+			}
+		}
+	}
+
+	inline void AdminThread::onDestruction() {
+		m_selector.clear();
+		m_clients.clear();
+		m_listener.close();
+	}
+
+	inline AdminThread::AdminThread(unsigned short port, size_t outputLimit):
+		m_port(port), m_output_limit(outputLimit) {
+	}
+
+	inline AdminThread::~AdminThread() {
+		if (containsThread())
+			destroyThread();
+	}
+}
@@ -1,44 +1,59 @@
 #pragma once
+#include <atomic>
 #include <iostream>
-#include<mutex>
 #include<thread>
 
+#include "Futex.h"
+
 namespace demonorium
 {
 	/**
-	 * \brief   std::thread
+	 * \brief Надстройка над std::thread
+	 * Состояние потока хранится в одном слове Futex, поток и управляющие потоки засыпают на нём без опроса.
+	 * Переходы: RUNNING -> PAUSING -> PAUSED -> RESUMING -> RUNNING, из любого состояния -> STOPPING.
+	 * PAUSING и RESUMING выставляет управляющий поток, остальные переходы делает сам поток.
 	 */
 	class BaseThread {
+	public:
+		enum State: uint32 {
+			STOPPED	 = 0,	//Поток не создан
+			RUNNING	 = 1,
+			PAUSING	 = 2,	//Запрошена пауза, поток доделывает кадр
+			PAUSED	 = 3,
+			RESUMING = 4,	//Запрошено продолжение, поток выполняет onUnPause
+			STOPPING = 5
+		};
+	private:
 		static void runThread(BaseThread* thread);
-		std::atomic<bool> m_deconstruction;
-		std::atomic<bool> m_condition;
-		std::atomic<bool> m_awaiting;
+		Futex m_state;
+
+		//Вызов из самого потока: ждать его же перехода нельзя
+		bool isSelf() const;
 	protected:
 		std::thread* m_thread;
-		std::mutex m_thread_mutex;
-		std::condition_variable m_cv;
-		
-		virtual void onInit() = 0;	//   
-		virtual void onFrame() = 0;	//   
-		virtual void onPause();		//  pause(),    destroyThread()
-		virtual void onUnPause();	//  run(),    destroyThread()
-		virtual void onDestruction(); //   
-		
+
+		virtual void onInit() = 0;	//вызывается до цикла потока
+		virtual void onFrame() = 0;	//вызывается в цикле потока
+		virtual void onPause();		//Вызывается после pause(), если не вызвана destroyThread()
+		virtual void onUnPause();	//Вызывается после run(), если не вызвана destroyThread()
+		virtual void onDestruction(); //Вызывается перед остановкой потока
+		virtual void onInterrupt(); //Вызывается управляющим потоком после запроса паузы или остановки: поток, спящий внутри onFrame, должен проснуться
+
 		bool isRealyPaused() const;
 	public:
 		BaseThread();
 		virtual ~BaseThread();
 
-		void loop();	// 
-		void start();	// 
-		void destroyThread(); //     ,   
-		
-		void pause(); //  ,    
-		void run(); //  ,    notify   
+		void loop();	//Цикл потока
+		void start();	//Запуск потока
+		void destroyThread(); //Полная остановка и уничтожение объекта потока, если он создан
+
+		void pause(); //Приостановить поток, возвращается после onPause, не дольше одного кадра
+		void run(); //Продолжить выполнение потока, возвращается после onUnPause
 
-		bool isRunning() const;	//  ?
-		bool containsThread() const; //    ?
-		
+		bool isRunning() const;	//Поток сейчас выполняется?
+		bool containsThread() const; //Содержит в себе созданный поток?
+		State getState() const;
 	};
 
 
@@ -46,13 +61,16 @@ namespace demonorium
 		thread->loop();
 	}
 
+	inline bool BaseThread::isSelf() const {
+		return (m_thread != nullptr) && (m_thread->get_id() == std::this_thread::get_id());
+	}
+
 	inline bool BaseThread::isRealyPaused() const {
-		return m_awaiting;
+		return m_state.load() == PAUSED;
 	}
 
 	inline BaseThread::BaseThread():
-		m_condition(false), m_deconstruction(false),
-		m_thread(nullptr), m_awaiting(false) {
+		m_state(STOPPED), m_thread(nullptr) {
 	}
 
 	inline BaseThread::~BaseThread() {
@@ -63,41 +81,65 @@ namespace demonorium
 
 	inline void BaseThread::loop() {
 		onInit();
-		m_awaiting = false;
-		while (!m_deconstruction) {
-			while (m_condition)
+		uint32 state;
+		while ((state = m_state.load()) != STOPPING) {
+			if (state == RUNNING) {
 				onFrame();
+				continue;
+			}
 
-			if (m_deconstruction)
-				break;
-
-			
-			std::unique_lock<std::mutex> lk(m_thread_mutex);
-			m_awaiting = true;
+			//PAUSING: переход в PAUSED может перебить только destroyThread
 			onPause();
-			m_cv.wait(lk);
+			if (!m_state.compareExchange(state, PAUSED))
+				continue;
+			m_state.wakeAll();
 
-			if (m_deconstruction)
+			while ((state = m_state.load()) == PAUSED)
+				m_state.wait(PAUSED);
+			if (state == STOPPING)
 				break;
-			
+
 			onUnPause();
-			m_awaiting = false;
+			if (m_state.compareExchange(state, RUNNING))
+				m_state.wakeAll();
 		}
 		onDestruction();
 	}
 
 	inline void BaseThread::start() {
 		if (m_thread) {
-			run(); 
+			run();
 		} else {
-			m_condition.store(true);
-			m_deconstruction.store(false);
+			m_state.store(RUNNING);
 			m_thread = new std::thread(runThread, this);
 		}
 	}
 
 	inline void BaseThread::pause() {
-		m_condition.store(false);
+		uint32 state = m_state.load();
+		if (isSelf()) {
+			//Поток встанет на паузу, когда вернётся из onFrame
+			m_state.compareExchange(state, PAUSING);
+			return;
+		}
+
+		while (true) {
+			switch (state) {
+			case RUNNING:
+				if (m_state.compareExchange(state, PAUSING)) {
+					state = PAUSING;
+					onInterrupt();
+				}
+				break;
+			case PAUSING:
+			case RESUMING:
+				m_state.wait(state);
+				state = m_state.load();
+				break;
+			default:
+				return;
+			}
+		}
 	}
 
 	inline void BaseThread::onPause() {
@@ -109,38 +151,57 @@ namespace demonorium
 	inline void BaseThread::onDestruction() {
 	}
 
+	inline void BaseThread::onInterrupt() {
+	}
+
 	inline void BaseThread::run() {
-		m_condition.store(true);
-		while (m_awaiting)
-			m_cv.notify_one();
+		uint32 state = m_state.load();
+		while (true) {
+			switch (state) {
+			case PAUSED:
+				if (m_state.compareExchange(state, RESUMING)) {
+					m_state.wakeAll();
+					state = RESUMING;
+				}
+				break;
+			case PAUSING:
+			case RESUMING:
+				if (isSelf())
+					return;
+				m_state.wait(state);
+				state = m_state.load();
+				break;
+			default:
+				return;
+			}
+		}
 	}
 
 	inline bool BaseThread::isRunning() const {
-		return !m_awaiting && m_condition;
+		return m_state.load() == RUNNING;
 	}
 
 	inline bool BaseThread::containsThread() const {
-		return (m_thread != nullptr) && !m_deconstruction;
+		return (m_thread != nullptr) && (m_state.load() != STOPPING);
 	}
 
-	inline void BaseThread::destroyThread() {
-		m_deconstruction.store(true);
-		
-		if (m_awaiting)
-			m_cv.notify_one();
-		else if (m_condition)
-			pause();
-
-		if (m_thread) {
-			if (m_thread->joinable())
-				m_thread->join();
+	inline BaseThread::State BaseThread::getState() const {
+		return static_cast<State>(m_state.load());
+	}
 
-			m_deconstruction.store(false);
-			
-			delete m_thread;
-			m_thread = nullptr;
-		} else {
-			m_deconstruction.store(false);
-		}
+	inline void BaseThread::destroyThread() {
+		if (!m_thread)
+			return;
+
+		m_state.store(STOPPING);
+		m_state.wakeAll();
+		onInterrupt();
+
+		if (m_thread->joinable())
+			m_thread->join();
+		delete m_thread;
+		m_thread = nullptr;
+		m_state.store(STOPPED);
+		m_state.wakeAll();
 	}
 }
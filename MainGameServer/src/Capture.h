@@ -0,0 +1,315 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <SFML/Network.hpp>
+
+#include "BaseThread.h"
+#include "Clock.h"
+#include "Log.h"
+#include "MappedFile.h"
+#include "PacketRing.h"
+#include "Wakeup.h"
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+DEMONORIUM_LOCAL_USE(demonorium::memory::memory_declarations);
+
+
+namespace demonorium
+{
+	/*
+	 * Захват входящего трафика - файл, в который только дописывают:
+	 * CaptureHeader, затем записи подряд: [uint32 время][uint32 IP][uint16 порт][uint16 размер][данные].
+	 * Время - миллисекунды от первой записи. Записи не выровнены, недописанный хвост читатель пропускает.
+	 */
+	struct CaptureHeader {
+		char	magic[8];
+		uint32	format;
+		uint32	reserved;
+	};
+
+	static_assert(sizeof(CaptureHeader) == 16, "CaptureHeader layout is part of the file format");
+
+	constexpr size_t	CAPTURE_RECORD	= sizeof(uint32) + sizeof(uint32) + sizeof(uint16) + sizeof(uint16);
+	constexpr char		CAPTURE_MAGIC[8] = {'M', 'G', 'S', 'C', 'A', 'P', 'T', '1'};
+	constexpr uint32	CAPTURE_FORMAT	= 2;
+
+	//Датаграмма из захвата, данные указывают в отображённый файл
+	struct CapturedDatagram {
+		//Миллисекунды от первой записи
+		uint32			time;
+		sf::IpAddress	address;
+		//Порт отправителя
+		sf::Uint16		port;
+		const byte*		data;
+		size_t			size;
+	};
+
+	struct CaptureStats {
+		//Датаграмм, записанных в файл
+		uint64 recorded = 0;
+		//Датаграмм, не попавших в захват: кольцо записи было заполнено
+		uint64 dropped	= 0;
+	};
+
+
+	/**
+	 * \brief Фоновая запись захвата: поток приёма кладёт принятые датаграммы в кольцо, диск трогает только этот поток.
+	 * Поток приёма никогда не ждёт записи: если кольцо заполнено, датаграмма не попадает в захват и считается в dropped.
+	 */
+	class CaptureWriter: public BaseThread {
+		//Самый долгий сон с пустым кольцом: столько в худшем случае лежат данные до записи в файл
+		static constexpr std::chrono::milliseconds IDLE_LIMIT = std::chrono::milliseconds(50);
+		//Байт, копящихся перед одной записью в файл
+		static constexpr size_t WRITE_CHUNK = 64 * 1024;
+
+		std::string		m_path;
+		PacketRing		m_ring;
+		std::ofstream	m_file;
+		std::vector<byte> m_buffer;
+		//Момент первой записи, от него отсчитывается время в файле
+		tick			m_origin;
+		bool			m_started;
+
+		std::atomic<uint64> m_recorded;
+		std::atomic<uint64> m_dropped;
+		Log				m_log;
+		//Будит поток, когда кольцо заполнилось
+		Wakeup			m_wakeup;
+
+		//Перенести записи из кольца в m_buffer, false если кольцо было пусто
+		bool drain();
+		void write();
+	protected:
+		void onInit() override;
+		void onFrame() override;
+		void onDestruction() override;
+		void onInterrupt() override;
+	public:
+		/**
+		 * \param capacity - байт памяти кольца между потоком приёма и записью
+		 * \param maxPacket - самый большой записываемый пакет
+		 */
+		CaptureWriter(size_t capacity, size_t maxPacket);
+		~CaptureWriter() override;
+
+		//Файл захвата, задаётся до start; пустой путь - захват выключен
+		void setPath(std::string path);
+		bool enabled() const;
+
+		//Положить датаграмму в захват, вызывается только потоком приёма. false - кольцо заполнено
+		bool record(tick time, const sf::IpAddress& address, sf::Uint16 port, const void* data, size_t size);
+		CaptureStats stats() const;
+	};
+
+
+	/**
+	 * \brief Последовательное чтение захвата через отображение файла в память.
+	 */
+	class CaptureReader {
+		MappedFile	m_file;
+		size_t		m_position;
+	public:
+		CaptureReader();
+
+		//Открыть захват, false если файла нет или это не захват
+		bool open(const std::string& path);
+		void close();
+
+		//Следующая датаграмма, false в конце файла или на недописанной записи
+		bool next(CapturedDatagram& datagram);
+		//Вернуться к первой записи
+		void rewind();
+	};
+
+
+	inline CaptureWriter::CaptureWriter(size_t capacity, size_t maxPacket):
+		m_ring(capacity, maxPacket + sizeof(tick)),
+		m_origin(0), m_started(false),
+		m_recorded(0), m_dropped(0) {
+	}
+
+	inline CaptureWriter::~CaptureWriter() {
+		if (containsThread())
+			destroyThread();
+	}
+
+	inline void CaptureWriter::setPath(std::string path) {
+		m_path = std::move(path);
+	}
+
+	inline bool CaptureWriter::enabled() const {
+		return !m_path.empty();
+	}
+
+	inline bool CaptureWriter::record(tick time, const sf::IpAddress& address, sf::Uint16 port, const void* data, size_t size) {
+		void* memory = m_ring.write(size + sizeof(tick));
+		if (memory == nullptr) {
+			m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			m_wakeup.notify();
+			return false;
+		}
+		byte* payload = static_cast<byte*>(shift(memory, sizeof(PacketPrefix)));
+		std::memcpy(payload, &time, sizeof(tick));
+		std::memcpy(payload + sizeof(tick), data, size);
+		new (memory) PacketPrefix(size + sizeof(tick), address, port);
+		m_ring.validWrite();
+
+		//Пока в кольце есть место, поток записи просыпается сам: датаграмма не стоит барьера notify
+		if (m_ring.full())
+			m_wakeup.notify();
+		return true;
+	}
+
+	inline CaptureStats CaptureWriter::stats() const {
+		CaptureStats stats;
+		stats.recorded = m_recorded.load(std::memory_order_relaxed);
+		stats.dropped  = m_dropped.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	inline bool CaptureWriter::drain() {
+		bool any = false;
+		while (void* memory = m_ring.read()) {
+			any = true;
+			const PacketPrefix& prefix = as_reference<PacketPrefix>(memory);
+			const byte* payload = static_cast<const byte*>(shift(memory, sizeof(PacketPrefix)));
+
+			tick time;
+			std::memcpy(&time, payload, sizeof(tick));
+			if (!m_started) {
+				m_origin  = time;
+				m_started = true;
+			}
+			const auto offset	= static_cast<uint32>(std::max<int32>(Clock::between(m_origin, time).count(), 0));
+			const uint32 ip		= prefix.ip.toInteger();
+			const uint16 port	= prefix.port;
+			const auto size		= static_cast<uint16>(prefix.size - sizeof(tick));
+
+			const size_t at = m_buffer.size();
+			m_buffer.resize(at + CAPTURE_RECORD + size);
+			byte* record = m_buffer.data() + at;
+			std::memcpy(record, &offset, sizeof(offset));
+			std::memcpy(record + sizeof(uint32), &ip, sizeof(ip));
+			std::memcpy(record + 2 * sizeof(uint32), &port, sizeof(port));
+			std::memcpy(record + 2 * sizeof(uint32) + sizeof(uint16), &size, sizeof(size));
+			std::memcpy(record + CAPTURE_RECORD, payload + sizeof(tick), size);
+			m_recorded.store(m_recorded.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+			if (m_buffer.size() >= WRITE_CHUNK)
+				write();
+		}
+		return any;
+	}
+
+	inline void CaptureWriter::write() {
+		if (m_buffer.empty())
+			return;
+		if (m_file.is_open() && !m_file.write(reinterpret_cast<const char*>(m_buffer.data()), static_cast<std::streamsize>(m_buffer.size())).flush()) {
+			m_log.write_important("Не удалось дописать захват ", m_path, ", захват остановлен");
+			m_file.close();
+		}
+		m_buffer.clear();
+	}
+
+	inline void CaptureWriter::onInit() {
+		m_log.open("Capture.log");
+		m_started = false;
+		m_buffer.clear();
+		m_file.open(m_path, std::ios_base::binary | std::ios_base::trunc);
+
+		CaptureHeader header{};
+		std::memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+		header.format = CAPTURE_FORMAT;
+		if (!m_file.write(reinterpret_cast<const char*>(&header), sizeof(header)).flush()) {
+			//Кольцо всё равно разбирается: поток приёма не должен упираться в заполненное кольцо
+			m_log.write_important("Не удалось открыть файл захвата ", m_path);
+			m_file.close();
+			return;
+		}
+		m_log.write("Захват входящего трафика: ", m_path);
+	}
+
+	inline void CaptureWriter::onFrame() {
+		if (drain())
+			return;
+		write();
+
+		const uint32 key = m_wakeup.prepare();
+		if (m_ring.empty())
+			m_wakeup.wait(key, IDLE_LIMIT);
+		else
+			m_wakeup.cancel();
+	}
+
+	inline void CaptureWriter::onDestruction() {
+		drain();
+		write();
+		m_file.close();
+		m_log.write("Захват закрыт: записано ", m_recorded.load(), "; потеряно ", m_dropped.load());
+	}
+
+	inline void CaptureWriter::onInterrupt() {
+		m_wakeup.notify();
+	}
+
+	inline CaptureReader::CaptureReader():
+		m_position(0) {
+	}
+
+	inline bool CaptureReader::open(const std::string& path) {
+		close();
+		if (!m_file.open(path) || (m_file.size() < sizeof(CaptureHeader)))
+			return false;
+
+		const auto* header = static_cast<const CaptureHeader*>(m_file.data());
+		if ((std::memcmp(header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) || (header->format != CAPTURE_FORMAT)) {
+			close();
+			return false;
+		}
+		m_position = sizeof(CaptureHeader);
+		return true;
+	}
+
+	inline void CaptureReader::close() {
+		m_file.close();
+		m_position = 0;
+	}
+
+	inline bool CaptureReader::next(CapturedDatagram& datagram) {
+		if (!m_file.isOpen() || (m_file.size() - m_position < CAPTURE_RECORD))
+			return false;
+
+		const byte* record = static_cast<const byte*>(m_file.data()) + m_position;
+		uint32 ip;
+		uint16 port;
+		uint16 size;
+		std::memcpy(&datagram.time, record, sizeof(uint32));
+		std::memcpy(&ip, record + sizeof(uint32), sizeof(ip));
+		std::memcpy(&port, record + 2 * sizeof(uint32), sizeof(port));
+		std::memcpy(&size, record + 2 * sizeof(uint32) + sizeof(uint16), sizeof(size));
+		if (m_file.size() - m_position - CAPTURE_RECORD < size)
+			return false;
+
+		datagram.address = sf::IpAddress(ip);
+		datagram.port	 = port;
+		datagram.data	 = record + CAPTURE_RECORD;
+		datagram.size	 = size;
+		m_position += CAPTURE_RECORD + size;
+		return true;
+	}
+
+	inline void CaptureReader::rewind() {
+		if (m_file.isOpen())
+			m_position = sizeof(CaptureHeader);
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	//Момент монотонного времени сервера: миллисекунды от первого обращения к Clock, 32 бита
+	using tick = uint32;
+
+	/**
+	 * \brief Источник времени сервера: монотонные часы с кэшированным грубым "сейчас".
+	 * Часы читает только update - раз в кадр сервера и раз на пачку принятых пакетов,
+	 * остальной код берёт now() из кэша. Разности считаются по модулю 2^32
+	 * и верны для интервалов до 24 дней, в том числе через переполнение.
+	 * В ручном режиме часы не читаются: время двигает только set, так воспроизведение захвата
+	 * ведёт сервер по времени записи, а не по настенным часам.
+	 */
+	class Clock {
+		static inline std::atomic<tick> s_now{0};
+		static inline std::atomic<bool> s_manual{false};
+
+		static std::chrono::steady_clock::time_point origin();
+	public:
+		using delay = std::chrono::milliseconds;
+
+		//Прочитать монотонные часы и обновить кэш. Кэш никогда не идёт назад
+		static tick update();
+		//Последнее значение update
+		static tick now();
+
+		//Включить или выключить ручное время. После выключения время не идёт назад, а ждёт, пока часы его догонят
+		static void manual(bool enabled);
+		static bool isManual();
+		//Выставить время в ручном режиме, назад оно не идёт
+		static void set(tick value);
+
+		//Сколько прошло от from до to, отрицательно если to раньше from
+		static delay between(tick from, tick to);
+		//Момент через duration после from
+		static tick after(tick from, delay duration);
+	};
+
+
+	inline std::chrono::steady_clock::time_point Clock::origin() {
+		static const auto start = std::chrono::steady_clock::now();
+		return start;
+	}
+
+	inline tick Clock::update() {
+		if (s_manual.load(std::memory_order_relaxed))
+			return s_now.load(std::memory_order_relaxed);
+		const auto elapsed = std::chrono::duration_cast<delay>(std::chrono::steady_clock::now() - origin()).count();
+		const tick value = static_cast<tick>(elapsed);
+
+		//Кэш обновляют поток сервера и поток приёма, побеждает более позднее значение
+		tick current = s_now.load(std::memory_order_relaxed);
+		while ((static_cast<int32>(value - current) > 0) &&
+			!s_now.compare_exchange_weak(current, value, std::memory_order_relaxed));
+		return s_now.load(std::memory_order_relaxed);
+	}
+
+	inline tick Clock::now() {
+		return s_now.load(std::memory_order_relaxed);
+	}
+
+	inline void Clock::manual(bool enabled) {
+		s_manual.store(enabled);
+	}
+
+	inline bool Clock::isManual() {
+		return s_manual.load();
+	}
+
+	inline void Clock::set(tick value) {
+		tick current = s_now.load(std::memory_order_relaxed);
+		while ((static_cast<int32>(value - current) > 0) &&
+			!s_now.compare_exchange_weak(current, value, std::memory_order_relaxed));
+	}
+
+	inline Clock::delay Clock::between(tick from, tick to) {
+		return delay(static_cast<int32>(to - from));
+	}
+
+	inline tick Clock::after(tick from, delay duration) {
+		return from + static_cast<tick>(duration.count());
+	}
+}
@@ -0,0 +1,242 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <unordered_map>
+#include <vector>
+
+#include "Clock.h"
+#include "SessionTable.h"
+#include "TimerWheel.h"
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Корутина многошагового сценария сервера (подтверждение убийства и т.п.).
+	 * Запускается сразу при вызове и живёт, пока не завершится или пока FlowScheduler не уничтожит её при clear.
+	 * Все ожидания внутри - только через awaitable-объекты FlowScheduler.
+	 */
+	struct Flow {
+		struct promise_type {
+			Flow get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	/**
+	 * \brief Планировщик корутин Flow: будит их по таймеру или по пакету игрока.
+	 * Приостановленные корутины не опрашиваются, таймеры лежат в колесе, ожидания пакетов - в хеш-таблице,
+	 * поэтому кадр сервера стоит O(число сработавших событий), а не O(числа сценариев).
+	 */
+	class FlowScheduler {
+	public:
+		using delay = Clock::delay;
+
+		//Точность таймеров
+		static constexpr delay TICK = delay(10);
+	private:
+		struct Pending {
+			std::coroutine_handle<> handle;
+			//Куда записать, пришёл ли пакет до таймаута
+			bool*	result;
+			//Ключ ожидаемого пакета, если ждём пакет
+			uint64	key;
+			bool	keyed;
+		};
+
+		TimerWheel<uint64> m_timers;
+		std::unordered_map<uint64, Pending> m_pending;
+		std::unordered_multimap<uint64, uint64> m_waiters;
+		uint64	m_next_id;
+		//Последний момент advance и миллисекунды от создания: 32-битные моменты копятся в 64 бита
+		tick	m_last;
+		uint64	m_elapsed;
+
+		static uint64 makeKey(SessionId session, byte code);
+		uint64 toTicks(delay duration) const;
+		void suspend(std::coroutine_handle<> handle, bool* result, delay timeout, const uint64* key);
+		void timeout(uint64 id);
+	public:
+		class SleepAwaiter {
+			FlowScheduler&	m_owner;
+			delay			m_delay;
+		public:
+			SleepAwaiter(FlowScheduler& owner, delay duration);
+			bool await_ready() const noexcept;
+			void await_suspend(std::coroutine_handle<> handle);
+			void await_resume() const noexcept;
+		};
+
+		class PacketAwaiter {
+			FlowScheduler&	m_owner;
+			uint64			m_key;
+			delay			m_timeout;
+			bool			m_result;
+		public:
+			PacketAwaiter(FlowScheduler& owner, uint64 key, delay timeout);
+			bool await_ready() const noexcept;
+			void await_suspend(std::coroutine_handle<> handle);
+			//true - пакет пришёл, false - истёк таймаут
+			bool await_resume() const noexcept;
+		};
+
+		explicit FlowScheduler(tick now, size_t slots = 512);
+		~FlowScheduler();
+		FlowScheduler(const FlowScheduler&) = delete;
+		FlowScheduler& operator =(const FlowScheduler&) = delete;
+
+		//co_await sleep(d) - продолжить через d
+		SleepAwaiter sleep(delay duration);
+		//co_await packet(session, code, t) - дождаться пакета code от игрока сессии session, но не дольше t
+		PacketAwaiter packet(SessionId session, byte code, delay timeout);
+
+		//Сообщить о пакете code от игрока сессии session, будит ждущие его корутины
+		void signal(SessionId session, byte code);
+		//Продвинуть время, будит корутины с истёкшими таймерами
+		void advance(tick now);
+		//Уничтожить все приостановленные корутины
+		void clear();
+
+		//Количество приостановленных корутин
+		size_t size() const;
+	};
+
+
+	inline uint64 FlowScheduler::makeKey(SessionId session, byte code) {
+		return (static_cast<uint64>(session) << 8) | code;
+	}
+
+	inline uint64 FlowScheduler::toTicks(delay duration) const {
+		//Округление вверх: корутина не должна проснуться раньше срока
+		return (duration.count() + TICK.count() - 1) / TICK.count();
+	}
+
+	inline void FlowScheduler::suspend(std::coroutine_handle<> handle, bool* result, delay timeout, const uint64* key) {
+		const uint64 id = m_next_id++;
+		m_pending.emplace(id, Pending{handle, result, key ? *key : 0, key != nullptr});
+		//Между кадрами поток сервера мог спать: срок считается от текущего момента, а не от последнего advance
+		const uint64 elapsed = m_elapsed + static_cast<uint64>(std::max<int32>(Clock::between(m_last, Clock::now()).count(), 0));
+		m_timers.schedule(elapsed / TICK.count() + toTicks(timeout), id);
+		if (key)
+			m_waiters.emplace(*key, id);
+	}
+
+	inline void FlowScheduler::timeout(uint64 id) {
+		//Корутину могли уже разбудить пакетом, тогда таймер просто устарел
+		const auto found = m_pending.find(id);
+		if (found == m_pending.end())
+			return;
+
+		const Pending pending = found->second;
+		m_pending.erase(found);
+		if (pending.keyed) {
+			auto range = m_waiters.equal_range(pending.key);
+			for (auto it = range.first; it != range.second; ++it) {
+				if (it->second == id) {
+					m_waiters.erase(it);
+					break;
+				}
+			}
+		}
+		if (pending.result)
+			*pending.result = false;
+		pending.handle.resume();
+	}
+
+	inline FlowScheduler::SleepAwaiter::SleepAwaiter(FlowScheduler& owner, delay duration):
+		m_owner(owner), m_delay(duration) {
+	}
+
+	inline bool FlowScheduler::SleepAwaiter::await_ready() const noexcept {
+		return m_delay.count() <= 0;
+	}
+
+	inline void FlowScheduler::SleepAwaiter::await_suspend(std::coroutine_handle<> handle) {
+		m_owner.suspend(handle, nullptr, m_delay, nullptr);
+	}
+
+	inline void FlowScheduler::SleepAwaiter::await_resume() const noexcept {
+	}
+
+	inline FlowScheduler::PacketAwaiter::PacketAwaiter(FlowScheduler& owner, uint64 key, delay timeout):
+		m_owner(owner), m_key(key), m_timeout(timeout), m_result(false) {
+	}
+
+	inline bool FlowScheduler::PacketAwaiter::await_ready() const noexcept {
+		return false;
+	}
+
+	inline void FlowScheduler::PacketAwaiter::await_suspend(std::coroutine_handle<> handle) {
+		m_owner.suspend(handle, &m_result, m_timeout, &m_key);
+	}
+
+	inline bool FlowScheduler::PacketAwaiter::await_resume() const noexcept {
+		return m_result;
+	}
+
+	inline FlowScheduler::FlowScheduler(tick now, size_t slots):
+		m_timers(slots), m_next_id(0), m_last(now), m_elapsed(0) {
+	}
+
+	inline FlowScheduler::~FlowScheduler() {
+		clear();
+	}
+
+	inline FlowScheduler::SleepAwaiter FlowScheduler::sleep(delay duration) {
+		return SleepAwaiter(*this, duration);
+	}
+
+	inline FlowScheduler::PacketAwaiter FlowScheduler::packet(SessionId session, byte code, delay timeout) {
+		return PacketAwaiter(*this, makeKey(session, code), timeout);
+	}
+
+	inline void FlowScheduler::signal(SessionId session, byte code) {
+		auto range = m_waiters.equal_range(makeKey(session, code));
+		if (range.first == range.second)
+			return;
+
+		//Сначала снимаем все ожидания, корутины при пробуждении могут ждать тот же пакет снова
+		std::vector<std::coroutine_handle<>> ready;
+		for (auto it = range.first; it != range.second; ++it) {
+			const auto found = m_pending.find(it->second);
+			*found->second.result = true;
+			ready.push_back(found->second.handle);
+			m_pending.erase(found);
+		}
+		m_waiters.erase(range.first, range.second);
+
+		for (auto handle : ready)
+			handle.resume();
+	}
+
+	inline void FlowScheduler::advance(tick now) {
+		const delay passed = Clock::between(m_last, now);
+		if (passed.count() <= 0)
+			return;
+		m_last = now;
+		m_elapsed += passed.count();
+
+		m_timers.advance(m_elapsed / TICK.count(), [this](uint64 id) {
+			timeout(id);
+		});
+	}
+
+	inline void FlowScheduler::clear() {
+		//Уничтожение кадра может запустить деструкторы, которые снова обратятся к планировщику
+		auto pending = std::move(m_pending);
+		m_pending.clear();
+		m_waiters.clear();
+		m_timers.clear();
+		for (auto& bundle : pending)
+			bundle.second.handle.destroy();
+	}
+
+	inline size_t FlowScheduler::size() const {
+		return m_pending.size();
+	}
+}
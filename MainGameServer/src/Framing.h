@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Датаграмма с кадрами: байт FRAMED, затем сообщения подряд, каждое - длина uint16 и данные.
+	 * Сообщение внутри - обычный пакет протокола с кодом в первом байте. Код FRAMED не совпадает
+	 * ни с одним кодом клиента или сервера, поэтому датаграммы обоих видов различаются по первому байту.
+	 */
+	static constexpr byte	FRAMED			= 0x7F;
+	static constexpr size_t	FRAME_HEADER	= sizeof(uint16);
+	//Самая большая датаграмма с кадрами: без фрагментации при MTU 1500
+	static constexpr size_t	FRAMED_DATAGRAM	= 1472;
+
+	//Датаграмма начинается с FRAMED
+	bool isFramed(const void* data, size_t size);
+
+	//Обход сообщений датаграммы с кадрами без копирования
+	class FrameReader {
+		const byte* m_position;
+		const byte* m_end;
+	public:
+		//data и size - вся датаграмма вместе с байтом FRAMED
+		FrameReader(const void* data, size_t size);
+
+		/**
+		 * \brief Следующее сообщение.
+		 * \return false, если сообщений больше нет или длина сообщения выходит за датаграмму
+		 */
+		bool next(const byte*& message, size_t& size);
+	};
+
+
+	inline bool isFramed(const void* data, size_t size) {
+		return (size != 0) && (*static_cast<const byte*>(data) == FRAMED);
+	}
+
+	inline FrameReader::FrameReader(const void* data, size_t size):
+		m_position(static_cast<const byte*>(data) + 1),
+		m_end(static_cast<const byte*>(data) + size) {
+	}
+
+	inline bool FrameReader::next(const byte*& message, size_t& size) {
+		if (static_cast<size_t>(m_end - m_position) < FRAME_HEADER)
+			return false;
+
+		uint16 length;
+		std::memcpy(&length, m_position, sizeof(length));
+		if (static_cast<size_t>(m_end - m_position) - FRAME_HEADER < length) {
+			m_position = m_end;
+			return false;
+		}
+
+		message	   = m_position + FRAME_HEADER;
+		size	   = length;
+		m_position = message + length;
+		return true;
+	}
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <climits>
+
+//DEMONORIUM_PORTABLE_FUTEX - mutex и condition_variable на любой системе, так проверяется запасной путь
+#if !defined(DEMONORIUM_PORTABLE_FUTEX) && defined(__linux__)
+#define DEMONORIUM_FUTEX_LINUX
+#elif !defined(DEMONORIUM_PORTABLE_FUTEX) && defined(_WIN32)
+#define DEMONORIUM_FUTEX_WINDOWS
+#endif
+
+#if defined(DEMONORIUM_FUTEX_LINUX)
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(DEMONORIUM_FUTEX_WINDOWS)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#pragma comment(lib, "Synchronization.lib")
+//winnt.h определяет макрос DELETE, а это имя команды ClientCodes::DELETE
+#undef DELETE
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Атомарное слово, на изменении которого можно уснуть без опроса.
+	 * Linux - futex, Windows - WaitOnAddress, иначе или с DEMONORIUM_PORTABLE_FUTEX - mutex и condition_variable.
+	 * Пробуждение не теряется: wait засыпает, только если слово всё ещё равно ожидаемому значению.
+	 */
+	class Futex {
+		std::atomic<uint32> m_value;
+#if !defined(DEMONORIUM_FUTEX_LINUX) && !defined(DEMONORIUM_FUTEX_WINDOWS)
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+#endif
+	public:
+		explicit Futex(uint32 value = 0);
+
+		uint32 load() const;
+		//Записать значение, ожидающих нужно разбудить отдельно
+		void store(uint32 value);
+		bool compareExchange(uint32& expected, uint32 desired);
+		//Прибавить delta, возвращает прежнее значение
+		uint32 fetchAdd(uint32 delta);
+
+		//Уснуть, пока значение равно expected. Возможны ложные пробуждения
+		void wait(uint32 expected);
+		//То же, но не дольше timeout
+		void waitFor(uint32 expected, std::chrono::milliseconds timeout);
+		//Разбудить одного ожидающего
+		void wakeOne();
+		//Разбудить всех ожидающих
+		void wakeAll();
+	};
+
+
+	inline Futex::Futex(uint32 value):
+		m_value(value) {
+	}
+
+	inline uint32 Futex::load() const {
+		return m_value.load(std::memory_order_acquire);
+	}
+
+	inline void Futex::store(uint32 value) {
+#if !defined(DEMONORIUM_FUTEX_LINUX) && !defined(DEMONORIUM_FUTEX_WINDOWS)
+		std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+		m_value.store(value, std::memory_order_release);
+	}
+
+	inline bool Futex::compareExchange(uint32& expected, uint32 desired) {
+#if !defined(DEMONORIUM_FUTEX_LINUX) && !defined(DEMONORIUM_FUTEX_WINDOWS)
+		std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+		return m_value.compare_exchange_strong(expected, desired, std::memory_order_acq_rel);
+	}
+
+	inline uint32 Futex::fetchAdd(uint32 delta) {
+#if !defined(DEMONORIUM_FUTEX_LINUX) && !defined(DEMONORIUM_FUTEX_WINDOWS)
+		std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+		return m_value.fetch_add(delta, std::memory_order_acq_rel);
+	}
+
+	inline void Futex::wait(uint32 expected) {
+#if defined(DEMONORIUM_FUTEX_LINUX)
+		static_assert(sizeof(std::atomic<uint32>) == sizeof(uint32), "futex requires a plain 32-bit word");
+		syscall(SYS_futex, reinterpret_cast<uint32*>(&m_value), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#elif defined(DEMONORIUM_FUTEX_WINDOWS)
+		WaitOnAddress(&m_value, &expected, sizeof(expected), INFINITE);
+#else
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [this, expected] {
+			return m_value.load(std::memory_order_relaxed) != expected;
+		});
+#endif
+	}
+
+	inline void Futex::waitFor(uint32 expected, std::chrono::milliseconds timeout) {
+#if defined(DEMONORIUM_FUTEX_LINUX)
+		//FUTEX_WAIT принимает относительное время
+		timespec relative;
+		relative.tv_sec	 = static_cast<time_t>(timeout.count() / 1000);
+		relative.tv_nsec = static_cast<long>(timeout.count() % 1000 * 1000000);
+		syscall(SYS_futex, reinterpret_cast<uint32*>(&m_value), FUTEX_WAIT_PRIVATE, expected, &relative, nullptr, 0);
+#elif defined(DEMONORIUM_FUTEX_WINDOWS)
+		WaitOnAddress(&m_value, &expected, sizeof(expected), static_cast<DWORD>(timeout.count()));
+#else
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait_for(lock, timeout, [this, expected] {
+			return m_value.load(std::memory_order_relaxed) != expected;
+		});
+#endif
+	}
+
+	inline void Futex::wakeOne() {
+#if defined(DEMONORIUM_FUTEX_LINUX)
+		syscall(SYS_futex, reinterpret_cast<uint32*>(&m_value), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#elif defined(DEMONORIUM_FUTEX_WINDOWS)
+		WakeByAddressSingle(&m_value);
+#else
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cv.notify_one();
+#endif
+	}
+
+	inline void Futex::wakeAll() {
+#if defined(DEMONORIUM_FUTEX_LINUX)
+		syscall(SYS_futex, reinterpret_cast<uint32*>(&m_value), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#elif defined(DEMONORIUM_FUTEX_WINDOWS)
+		WakeByAddressAll(&m_value);
+#else
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cv.notify_all();
+#endif
+	}
+}
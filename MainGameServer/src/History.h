@@ -0,0 +1,515 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <SFML/Network.hpp>
+
+#include "BaseThread.h"
+#include "Log.h"
+#include "MappedFile.h"
+#include "MPSCQueue.h"
+#include "Name.h"
+#include "Wakeup.h"
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/*
+	 * История матчей - папка с файлами, в которые только дописывают:
+	 * matches.idx	- индекс: HistoryHeader и по MatchEntry на матч;
+	 * *.col		- колонки по 4 байта на строку, строка - игрок в матче, строки матча идут подряд;
+	 * names.dat	- имена в виде [byte длина][имя], колонка name хранит смещение имени.
+	 * Колонки дописываются раньше индекса: строки, на которые индекс ещё не ссылается, читатель не видит,
+	 * а писатель при запуске обрезает их как недописанные.
+	 */
+	struct HistoryHeader {
+		char	magic[8];
+		uint32	format;
+		uint32	reserved;
+	};
+
+	struct MatchEntry {
+		uint64	first_row;
+		//Размер names.dat после записи матча
+		uint64	names_end;
+		//Момент окончания матча, секунды UNIX
+		int64	finished;
+		uint32	rows;
+		//Длительность матча в миллисекундах
+		uint32	duration;
+	};
+
+	static_assert(sizeof(HistoryHeader) == 16, "HistoryHeader layout is part of the file format");
+	static_assert(sizeof(MatchEntry) == 32, "MatchEntry layout is part of the file format");
+
+	enum class HistoryColumn: byte {
+		IP		= 0,
+		NAME	= 1,
+		KILLS	= 2,
+		//Момент смерти в миллисекундах от начала матча, -1 - игрок дожил до конца
+		DIED	= 3,
+		KILLER	= 4
+	};
+
+	constexpr size_t		HISTORY_COLUMNS		 = 5;
+	constexpr size_t		HISTORY_COLUMN_WIDTH = sizeof(uint32);
+	constexpr const char*	HISTORY_COLUMN_FILES[HISTORY_COLUMNS] = {"ip.col", "name.col", "kills.col", "died.col", "killer.col"};
+	constexpr const char*	HISTORY_INDEX		 = "matches.idx";
+	constexpr const char*	HISTORY_NAMES		 = "names.dat";
+	constexpr char			HISTORY_MAGIC[8]	 = {'M', 'G', 'S', 'H', 'I', 'S', 'T', '1'};
+	constexpr uint32		HISTORY_FORMAT		 = 1;
+
+
+	//Итог игрока в матче
+	struct MatchRow {
+		sf::IpAddress	ip;
+		sf::IpAddress	killer;
+		Name			name;
+		uint32			kills;
+		//Момент смерти в миллисекундах от начала матча, -1 - дожил до конца
+		int32			died;
+	};
+
+	//Матч, поставленный в очередь записи
+	struct MatchResult {
+		int64					finished = 0;
+		uint32					duration = 0;
+		std::vector<MatchRow>	rows;
+	};
+
+	//Итоги одного игрока (по IP) за все матчи
+	struct LeaderboardEntry {
+		sf::IpAddress	ip;
+		//Имя в последнем матче
+		std::string		name;
+		uint32			matches = 0;
+		//Матчей, которые игрок закончил живым
+		uint32			wins	= 0;
+		uint32			kills	= 0;
+		uint32			deaths	= 0;
+	};
+
+	//Участие игрока в одном матче
+	struct PlayerMatch {
+		uint32			match;
+		int64			finished;
+		uint32			duration;
+		uint32			kills;
+		int32			died;
+		sf::IpAddress	killer;
+	};
+
+
+	/**
+	 * \brief Чтение истории матчей через отображение файлов в память.
+	 * Видит матчи, записанные к моменту open, для новых данных open вызывается заново.
+	 */
+	class HistoryReader {
+		MappedFile	m_index;
+		MappedFile	m_columns[HISTORY_COLUMNS];
+		MappedFile	m_names;
+
+		const MatchEntry* m_matches;
+		size_t	m_match_count;
+		uint64	m_rows;
+
+		uint32 value(HistoryColumn column, uint64 row) const;
+	public:
+		HistoryReader();
+
+		//Открыть папку истории, false если истории нет
+		bool open(const std::string& directory);
+		void close();
+
+		//Число матчей
+		size_t size() const;
+		const MatchEntry& match(size_t index) const;
+		//Число строк во всех матчах
+		uint64 rows() const;
+
+		sf::IpAddress		ip(uint64 row) const;
+		std::string_view	name(uint64 row) const;
+		uint32				kills(uint64 row) const;
+		int32				died(uint64 row) const;
+		sf::IpAddress		killer(uint64 row) const;
+
+		//Лучшие игроки по убийствам, затем по победам
+		std::vector<LeaderboardEntry> leaderboard(size_t limit) const;
+		//Все матчи игрока в порядке их окончания
+		std::vector<PlayerMatch> history(sf::IpAddress player) const;
+	};
+
+
+	/**
+	 * \brief Фоновая запись истории матчей: поток сервера ставит итоги в очередь, диск трогает только этот поток.
+	 */
+	class HistoryWriter: public BaseThread {
+		//Сон при пустой очереди, ограничивает задержку pause и destroyThread
+		//Самый долгий сон с пустой очередью
+		static constexpr std::chrono::milliseconds IDLE_LIMIT = std::chrono::milliseconds(1000);
+
+		const std::string		m_directory;
+		MPSCQueue<MatchResult>	m_queue;
+		//Строк и байт имён, на которые ссылается индекс
+		uint64	m_rows;
+		uint64	m_names_end;
+		bool	m_ready;
+
+		std::vector<uint32>	m_column;
+		std::string			m_names;
+		Log					m_log;
+		//Будит поток при постановке матча в очередь
+		Wakeup				m_wakeup;
+
+		std::string path(const char* file) const;
+		//Создать недостающие файлы и обрезать всё, на что не ссылается индекс
+		bool repair();
+		bool append(const MatchResult& match);
+		bool appendColumn(HistoryColumn column);
+	protected:
+		void onInit() override;
+		void onFrame() override;
+		void onDestruction() override;
+		void onInterrupt() override;
+	public:
+		explicit HistoryWriter(std::string directory);
+		~HistoryWriter() override;
+
+		//Поставить матч в очередь записи, false если очередь переполнена
+		bool push(const MatchResult& match);
+	};
+
+
+	inline uint32 HistoryReader::value(HistoryColumn column, uint64 row) const {
+		uint32 result;
+		std::memcpy(&result, static_cast<const byte*>(m_columns[static_cast<byte>(column)].data()) + row * HISTORY_COLUMN_WIDTH, sizeof(result));
+		return result;
+	}
+
+	inline HistoryReader::HistoryReader():
+		m_matches(nullptr), m_match_count(0), m_rows(0) {
+	}
+
+	inline bool HistoryReader::open(const std::string& directory) {
+		close();
+		const std::filesystem::path root(directory);
+		if (!m_index.open((root / HISTORY_INDEX).string()) || (m_index.size() < sizeof(HistoryHeader)))
+			return false;
+
+		const auto* header = static_cast<const HistoryHeader*>(m_index.data());
+		if ((std::memcmp(header->magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) != 0) || (header->format != HISTORY_FORMAT)) {
+			close();
+			return false;
+		}
+
+		m_matches = reinterpret_cast<const MatchEntry*>(header + 1);
+		m_match_count = (m_index.size() - sizeof(HistoryHeader)) / sizeof(MatchEntry);
+		if (m_match_count == 0)
+			return true;
+
+		for (size_t i = 0; i < HISTORY_COLUMNS; ++i)
+			m_columns[i].open((root / HISTORY_COLUMN_FILES[i]).string());
+		m_names.open((root / HISTORY_NAMES).string());
+
+		//Писатель мог дописать колонки дальше индекса, но не наоборот, если файлы не повреждены
+		while (m_match_count > 0) {
+			const MatchEntry& last = m_matches[m_match_count - 1];
+			const uint64 rows = last.first_row + last.rows;
+			bool complete = last.names_end <= m_names.size();
+			for (const auto& column : m_columns)
+				complete = complete && (rows * HISTORY_COLUMN_WIDTH <= column.size());
+			if (complete) {
+				m_rows = rows;
+				break;
+			}
+			--m_match_count;
+		}
+		return true;
+	}
+
+	inline void HistoryReader::close() {
+		m_index.close();
+		for (auto& column : m_columns)
+			column.close();
+		m_names.close();
+		m_matches = nullptr;
+		m_match_count = 0;
+		m_rows = 0;
+	}
+
+	inline size_t HistoryReader::size() const {
+		return m_match_count;
+	}
+
+	inline const MatchEntry& HistoryReader::match(size_t index) const {
+		return m_matches[index];
+	}
+
+	inline uint64 HistoryReader::rows() const {
+		return m_rows;
+	}
+
+	inline sf::IpAddress HistoryReader::ip(uint64 row) const {
+		return sf::IpAddress(value(HistoryColumn::IP, row));
+	}
+
+	inline std::string_view HistoryReader::name(uint64 row) const {
+		const uint32 offset = value(HistoryColumn::NAME, row);
+		if (offset >= m_names.size())
+			return std::string_view();
+		const char* names = static_cast<const char*>(m_names.data());
+		const size_t size = static_cast<byte>(names[offset]);
+		return std::string_view(names + offset + 1, std::min<size_t>(size, m_names.size() - offset - 1));
+	}
+
+	inline uint32 HistoryReader::kills(uint64 row) const {
+		return value(HistoryColumn::KILLS, row);
+	}
+
+	inline int32 HistoryReader::died(uint64 row) const {
+		return static_cast<int32>(value(HistoryColumn::DIED, row));
+	}
+
+	inline sf::IpAddress HistoryReader::killer(uint64 row) const {
+		return sf::IpAddress(value(HistoryColumn::KILLER, row));
+	}
+
+	inline std::vector<LeaderboardEntry> HistoryReader::leaderboard(size_t limit) const {
+		//Нужны только четыре колонки, остальные страницы файлов не читаются
+		std::unordered_map<uint32, LeaderboardEntry> players;
+		for (uint64 row = 0; row < m_rows; ++row) {
+			const uint32 address = value(HistoryColumn::IP, row);
+			auto& entry = players[address];
+			entry.ip = sf::IpAddress(address);
+			entry.name.assign(name(row));
+			++entry.matches;
+			entry.kills += kills(row);
+			if (died(row) < 0)
+				++entry.wins;
+			else
+				++entry.deaths;
+		}
+
+		std::vector<LeaderboardEntry> result;
+		result.reserve(players.size());
+		for (auto& player : players)
+			result.push_back(std::move(player.second));
+
+		const auto better = [](const LeaderboardEntry& left, const LeaderboardEntry& right) {
+			if (left.kills != right.kills)
+				return left.kills > right.kills;
+			if (left.wins != right.wins)
+				return left.wins > right.wins;
+			return left.ip < right.ip;
+		};
+		limit = std::min(limit, result.size());
+		std::partial_sort(result.begin(), result.begin() + limit, result.end(), better);
+		result.resize(limit);
+		return result;
+	}
+
+	inline std::vector<PlayerMatch> HistoryReader::history(sf::IpAddress player) const {
+		const uint32 address = player.toInteger();
+		std::vector<PlayerMatch> result;
+		for (size_t match = 0; match < m_match_count; ++match) {
+			const MatchEntry& entry = m_matches[match];
+			for (uint64 row = entry.first_row; row < entry.first_row + entry.rows; ++row) {
+				if (value(HistoryColumn::IP, row) == address) {
+					result.push_back(PlayerMatch{static_cast<uint32>(match), entry.finished, entry.duration,
+						kills(row), died(row), killer(row)});
+					break;
+				}
+			}
+		}
+		return result;
+	}
+
+	inline std::string HistoryWriter::path(const char* file) const {
+		return (std::filesystem::path(m_directory) / file).string();
+	}
+
+	inline bool HistoryWriter::repair() {
+		namespace fs = std::filesystem;
+		std::error_code error;
+		fs::create_directories(m_directory, error);
+
+		for (const char* file : HISTORY_COLUMN_FILES)
+			std::ofstream(path(file), std::ios_base::binary | std::ios_base::app);
+		std::ofstream(path(HISTORY_NAMES), std::ios_base::binary | std::ios_base::app);
+
+		const std::string index = path(HISTORY_INDEX);
+		std::ifstream input(index, std::ios_base::binary);
+		HistoryHeader header{};
+		if (!input.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+			(std::memcmp(header.magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) != 0) || (header.format != HISTORY_FORMAT)) {
+			input.close();
+			if (fs::exists(index, error) && (fs::file_size(index, error) != 0))
+				m_log.write_important("Индекс истории повреждён, история начинается заново");
+
+			header = HistoryHeader{};
+			std::memcpy(header.magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC));
+			header.format = HISTORY_FORMAT;
+			std::ofstream output(index, std::ios_base::binary | std::ios_base::trunc);
+			if (!output.write(reinterpret_cast<const char*>(&header), sizeof(header)))
+				return false;
+		}
+
+		//Индекс верен, пока его матчи идут подряд и помещаются в файлы колонок
+		uint64 column_rows = UINT64_MAX;
+		for (const char* file : HISTORY_COLUMN_FILES)
+			column_rows = std::min<uint64>(column_rows, fs::file_size(path(file), error) / HISTORY_COLUMN_WIDTH);
+		const uint64 names_size = fs::file_size(path(HISTORY_NAMES), error);
+
+		m_rows = 0;
+		m_names_end = 0;
+		size_t count = 0;
+		MatchEntry entry;
+		while (input.is_open() && input.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+			if ((entry.first_row != m_rows) || (entry.first_row + entry.rows > column_rows) ||
+				(entry.names_end < m_names_end) || (entry.names_end > names_size))
+				break;
+			m_rows += entry.rows;
+			m_names_end = entry.names_end;
+			++count;
+		}
+		input.close();
+
+		error.clear();
+		fs::resize_file(index, sizeof(HistoryHeader) + count * sizeof(MatchEntry), error);
+		for (const char* file : HISTORY_COLUMN_FILES)
+			if (!error)
+				fs::resize_file(path(file), m_rows * HISTORY_COLUMN_WIDTH, error);
+		if (!error)
+			fs::resize_file(path(HISTORY_NAMES), m_names_end, error);
+		if (error) {
+			m_log.write_important("Не удалось восстановить файлы истории: ", error.message());
+			return false;
+		}
+		m_log.write("История матчей: матчей ", count, "; строк ", m_rows);
+		return true;
+	}
+
+	inline bool HistoryWriter::appendColumn(HistoryColumn column) {
+		std::ofstream output(path(HISTORY_COLUMN_FILES[static_cast<byte>(column)]), std::ios_base::binary | std::ios_base::app);
+		output.write(reinterpret_cast<const char*>(m_column.data()), static_cast<std::streamsize>(m_column.size() * HISTORY_COLUMN_WIDTH));
+		return static_cast<bool>(output.flush());
+	}
+
+	inline bool HistoryWriter::append(const MatchResult& match) {
+		//Имена и колонки, затем индекс: прерванная запись оставляет только хвосты без ссылок из индекса
+		m_names.clear();
+		m_column.clear();
+		for (const auto& row : match.rows) {
+			const auto name = row.name.view();
+			const size_t size = std::min<size_t>(name.size(), 255);
+			m_column.push_back(static_cast<uint32>(m_names_end + m_names.size()));
+			m_names.push_back(static_cast<char>(size));
+			m_names.append(name.data(), size);
+		}
+		{
+			std::ofstream output(path(HISTORY_NAMES), std::ios_base::binary | std::ios_base::app);
+			if (!output.write(m_names.data(), static_cast<std::streamsize>(m_names.size())).flush())
+				return false;
+		}
+		if (!appendColumn(HistoryColumn::NAME))
+			return false;
+
+		const auto fill = [this, &match](auto get) {
+			m_column.clear();
+			for (const auto& row : match.rows)
+				m_column.push_back(get(row));
+		};
+		fill([](const MatchRow& row) { return row.ip.toInteger(); });
+		if (!appendColumn(HistoryColumn::IP))
+			return false;
+		fill([](const MatchRow& row) { return row.kills; });
+		if (!appendColumn(HistoryColumn::KILLS))
+			return false;
+		fill([](const MatchRow& row) { return static_cast<uint32>(row.died); });
+		if (!appendColumn(HistoryColumn::DIED))
+			return false;
+		fill([](const MatchRow& row) { return row.killer.toInteger(); });
+		if (!appendColumn(HistoryColumn::KILLER))
+			return false;
+
+		MatchEntry entry{};
+		entry.first_row	= m_rows;
+		entry.names_end	= m_names_end + m_names.size();
+		entry.finished	= match.finished;
+		entry.rows		= static_cast<uint32>(match.rows.size());
+		entry.duration	= match.duration;
+
+		std::ofstream index(path(HISTORY_INDEX), std::ios_base::binary | std::ios_base::app);
+		if (!index.write(reinterpret_cast<const char*>(&entry), sizeof(entry)).flush())
+			return false;
+
+		m_rows		+= entry.rows;
+		m_names_end	 = entry.names_end;
+		return true;
+	}
+
+	inline void HistoryWriter::onInit() {
+		m_log.open("History.log");
+		m_ready = repair();
+	}
+
+	inline void HistoryWriter::onFrame() {
+		MatchResult match;
+		if (!m_queue.pop(match)) {
+			const uint32 key = m_wakeup.prepare();
+			if (m_queue.empty())
+				m_wakeup.wait(key, IDLE_LIMIT);
+			else
+				m_wakeup.cancel();
+			return;
+		}
+		if (!m_ready)
+			return;
+
+		if (append(match)) {
+			m_log.write("Матч записан в историю: игроков ", match.rows.size(), "; длительность ", match.duration, " мс");
+		} else {
+			m_log.write_important("Не удалось записать матч в историю");
+			m_ready = repair();
+		}
+	}
+
+	inline void HistoryWriter::onDestruction() {
+		while (!m_queue.empty())
+			onFrame();
+	}
+
+	inline void HistoryWriter::onInterrupt() {
+		m_wakeup.notify();
+	}
+
+	inline HistoryWriter::HistoryWriter(std::string directory):
+		m_directory(std::move(directory)), m_queue(64),
+		m_rows(0), m_names_end(0), m_ready(false) {
+	}
+
+	inline HistoryWriter::~HistoryWriter() {
+		if (containsThread())
+			destroyThread();
+	}
+
+	inline bool HistoryWriter::push(const MatchResult& match) {
+		if (!m_queue.push(match))
+			return false;
+		m_wakeup.notify();
+		return true;
+	}
+}
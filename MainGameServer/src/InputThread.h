@@ -1,9 +1,18 @@
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <iostream>
+#include <map>
 
 
 #include "BaseThread.h"
+#include "Capture.h"
+#include "Clock.h"
+#include "OutputBatch.h"
+#include "PacketRing.h"
+#include "Uring.h"
+#include "Wakeup.h"
 #include <SFML/Network.hpp>
 #include <utility>
 
@@ -17,51 +26,9 @@ DEMONORIUM_LOCAL_USE(demonorium::memory::memory_declarations);
 
 namespace demonorium
 {
-	/**
-	 * \brief     ,     
-	 * " ", , ..   "" 
-	 *    .
-	 */
-	class TwoPageInput {
-		void* m_page1;
-		void* m_page2;
-
-		const size_t m_block_size;
-		const byte m_block_count;
-		byte m_output_position;
-		std::atomic<byte> m_input_position;
-		std::atomic<bool> m_page_free;
-		bool m_page_fill;
-		bool m_read;
-
-		inline void* _read();
-	public:
-		TwoPageInput(size_t blockSize, byte blockCount);
-		~TwoPageInput();
-		
-		/**
-		 * \brief    .
-		 * \return       
-		 */
-		void* read();
-		
-		/**
-		 * \brief    ,          validWrite
-		 * \return        
-		 */
-		void* write();
-
-
-		/**
-		 * \brief      
-		 */
-		void validWrite();
-		size_t getBlockSize() const;
-	};
-
 	using namespace std::chrono_literals;
 	class DDOSDefence {
-		std::map<sf::IpAddress, std::pair<std::chrono::system_clock::time_point, size_t>> m_chrono_defence;
+		std::map<sf::IpAddress, std::pair<tick, size_t>> m_chrono_defence;
 		std::chrono::milliseconds m_defence_time;
 		size_t m_encounter_limit;
 		
@@ -71,180 +38,738 @@ namespace demonorium
 		bool packet(sf::IpAddress address);
 	};
 
-	
-	struct PacketPrefix {
-		size_t size;
-		sf::IpAddress ip;
 
-		PacketPrefix(size_t size, const sf::IpAddress& ip)
-			: size(size),
-			  ip(ip) {
-		}
+
+	//Полосы приёма в порядке убывания приоритета
+	enum class Lane: byte {
+		GAME	= 0,	//Пакеты, от которых зависит жизнь игроков: сервер разбирает их первыми
+		CONTROL	= 1,	//Управление игроком
+		BULK	= 2		//Регистрации, опрос таблиц и всё неизвестное
+	};
+	constexpr size_t LANE_COUNT = 3;
+
+	//Полоса пакета по его данным, вызывается потоком приёма
+	using LaneClassifier = Lane (*)(const byte* data, size_t size);
+
+	struct LaneStats {
+		//Пакетов, положенных в полосу
+		uint64 accepted = 0;
+		//Пакетов, потерянных из-за заполненной полосы или больше самого большого пакета
+		uint64 dropped	= 0;
+		//Пакетов, отброшенных защитой от DDOS
+		uint64 refused	= 0;
 	};
 
 
+	/**
+	 * \brief Поток приёма UDP пакетов. Ждёт пакеты на SocketSelector, а не опрашивает сокет в цикле.
+	 * С транспортом URING сокеты читает ядро: многократная заявка recvmsg кладёт датаграммы в кольцо буферов,
+	 * поток разбирает готовые завершения без системных вызовов и засыпает одним io_uring_enter, когда их нет.
+	 * Смена порта идёт без потерь: новый сокет открывается рядом со старым,
+	 * оба слушаются в течение льготного периода, после чего старый дочитывается и закрывается.
+	 * С GRO ядро склеивает датаграммы одного отправителя в одну пачку, поток режет её обратно на отдельные пакеты.
+	 * Пакеты раскладываются по полосам Lane с отдельными буферами: поток флуда заполняет и теряет только свою полосу.
+	 * Если заполнена полоса GAME, сокеты не читаются, пока сервер её не разберёт, младшие полосы теряют пакеты сразу.
+	 * Поток при этом спит, пока читатель не сообщит через drained, что освободил место.
+	 * Сервер забирает пакеты взвешенным обходом: за круг полоса отдаёт не больше LANE_WEIGHTS пакетов.
+	 * Принятые датаграммы можно записывать в захват CaptureWriter, воспроизведение кладёт их обратно через inject.
+	 */
 	class InputThread: public BaseThread {
-		TwoPageInput	m_buffer;
-		sf::UdpSocket	m_socket;
+		//Сколько ждать пакета, прежде чем вернуться в цикл потока (pause, смена порта)
+		static constexpr std::chrono::milliseconds WAIT_TIMEOUT = 20ms;
+		//Предел ядра на число датаграмм в одной склеенной пачке GRO
+		static constexpr size_t GRO_SEGMENTS = 64;
+
+		//Пакетов полосы за круг обхода в get
+		static constexpr uint32 LANE_WEIGHTS[LANE_COUNT] = {8, 4, 1};
+
+		PacketRing		m_lanes[LANE_COUNT];
+		LaneClassifier	m_classifier;
+		std::atomic<uint64> m_lane_accepted[LANE_COUNT];
+		std::atomic<uint64> m_lane_dropped[LANE_COUNT];
+		std::atomic<uint64> m_lane_refused[LANE_COUNT];
+		//Состояние обхода полос в get, только для читателя
+		byte			m_read_lane;
+		uint32			m_credit[LANE_COUNT];
+		//Текущий сокет и сокет, выводимый из работы после смены порта
+		NativeUdpSocket	m_sockets[2];
+		byte			m_active;
+		bool			m_retiring;
+		tick			m_retire_time;
+		std::chrono::milliseconds m_rebind_grace;
+
+		sf::SocketSelector m_selector;
 		DDOSDefence		m_defence;
-		std::mutex		m_mutex;
-		void*			m_memory;
-		unsigned int	m_port;
+		//Кого будить при появлении пакетов в буфере
+		Wakeup*			m_wakeup;
+		//Будит поток, ждущий места в полосе GAME
+		Wakeup			m_drained;
+		//Куда писать принятые датаграммы, nullptr - захват выключен
+		CaptureWriter*	m_capture;
+
+		/**
+		 * \brief Прочитанная, но ещё не разложенная по блокам датаграмма или склеенная GRO пачка.
+		 * Если полоса GAME заполнилась посреди пачки, остаток ждёт следующего кадра
+		 */
+		struct Segments {
+			const byte*	  data	  = nullptr;
+			size_t		  size	  = 0;
+			size_t		  segment = 0;
+			size_t		  offset  = 0;
+			sf::IpAddress address;
+			sf::Uint16	  port	  = 0;
+		};
+		Segments		m_segments;
+		//Склеивать датаграммы через UDP_GRO, задаётся до start
+		std::atomic<bool> m_gro;
+		//Память под датаграмму или склеенную пачку до раскладки по полосам
+		std::vector<byte> m_staging;
+		//Счётчики принятых датаграмм и чтений, пишет только поток приёма
+		std::atomic<uint64> m_received;
+		std::atomic<uint64> m_reads;
+
+		//Запрошенный транспорт и то, что удалось открыть
+		std::atomic<Transport> m_transport;
+		std::atomic<bool> m_uring;
+#if defined(__linux__)
+		//Буферов приёма в кольце и группа, под которой они зарегистрированы
+		static constexpr unsigned URING_BUFFERS = 256;
+		static constexpr uint16	  URING_GROUP	= 0;
+
+		Uring			m_ring;
+		UringBuffers	m_ring_buffers;
+		//Шаблон recvmsg: места под адрес отправителя и размер датаграммы в пачке GRO
+		msghdr			m_ring_message;
+		//Метка действующей заявки приёма каждого сокета, 0 - заявки нет
+		uint64			m_armed[2];
+		uint64			m_next_tag;
+
+		bool openRing();
+		//Поставить многократную заявку приёма на сокет index
+		void arm(byte index);
+		//Отменить заявку приёма сокета index
+		void disarm(byte index);
+		//Разобрать готовые завершения, при их отсутствии подождать
+		void receiveRing();
+#endif
+
+		//Порт, на котором принимаются пакеты
+		std::atomic<sf::Uint16> m_port;
+		//Порт, запрошенный setPort, 0 - запроса нет
+		std::atomic<sf::Uint16> m_requested_port;
+
+		//Открыть сокет на новом порту, старый остаётся слушать до конца льготного периода.
+		//false - предыдущий старый сокет ещё не дочитан, смена порта откладывается до следующего кадра
+		bool rebind(sf::Uint16 port);
+		//Дочитать и закрыть старый сокет. false - заполнилась полоса GAME: сокет остаётся открытым до следующей попытки
+		bool retire();
+		//Принять пакеты из сокета, пока есть пакеты и место в буфере. false - чтение остановила заполненная полоса GAME
+		bool receive(NativeUdpSocket& socket);
+		//Открыть сокет на порту, с GRO если он запрошен
+		bool open(NativeUdpSocket& socket, sf::Uint16 port);
+		//Разложить m_segments по полосам, false - заполнилась полоса GAME
+		bool deliver(size_t& accepted);
+		//Самый большой принимаемый пакет
+		size_t payloadLimit() const;
+#if defined(__linux__)
+		//Приём через recvmsg с размером датаграммы GRO в управляющих данных
+		bool receiveSegments(NativeUdpSocket& socket);
+		//Размер датаграммы в склеенной пачке, size - если ядро его не передало
+		static size_t segmentSize(msghdr& message, size_t size);
+#endif
 	protected:
 		void onInit() override;
 		void onFrame() override;
+		void onDestruction() override;
+		void onInterrupt() override;
 	public:
-		InputThread(unsigned short port, size_t packetSize, byte packetCount, size_t defencePacketCount = 6, std::chrono::milliseconds defenceDuration = 500ms);
-		~InputThread() override = default;
+		/**
+		 * \param maxPacket - самый большой принимаемый пакет, большие отбрасываются
+		 * \param laneCapacity - байт памяти каждой полосы: пакет занимает заголовок и свои данные
+		 */
+		InputThread(unsigned short port, size_t maxPacket, size_t laneCapacity, size_t defencePacketCount = 6, std::chrono::milliseconds defenceDuration = 500ms,
+			std::chrono::milliseconds rebindGrace = 2000ms);
+		~InputThread() override;
 
+		//Запросить смену порта, выполняется потоком приёма без остановки
 		void setPort(sf::Uint16 port);
+		//Будить wakeup после каждой пачки принятых пакетов, задаётся до start
+		void setWakeup(Wakeup* wakeup);
+		//Записывать каждую принятую датаграмму в захват, задаётся до start или на паузе
+		void setCapture(CaptureWriter* capture);
+		//Транспорт приёма, задаётся до start
+		void setTransport(Transport transport);
+		//Склеивание датаграмм ядром (UDP_GRO, только Linux), задаётся до start
+		void setGro(bool enabled);
+		//Принято датаграмм и чтений, поля отправки не заполняются
+		TransportStats stats() const;
+		//Полоса для каждого пакета, задаётся до start; без неё всё идёт в GAME
+		void setClassifier(LaneClassifier classifier);
+		LaneStats laneStats(Lane lane) const;
+		//Приём идёт через io_uring
+		bool usesUring() const;
 		unsigned short getPort() const;
 
-		inline void* get();
+		//Следующий пакет по взвешенному обходу полос, nullptr если все пусты. Вызывается только читателем
+		void* get();
+		//Все полосы пусты, вызывается только читателем
+		bool empty() const;
+		//Читатель освободил место в полосах: будит поток, если он ждёт места в полосе GAME. Один вызов на пачку get
+		void drained();
+		/**
+		 * \brief Положить датаграмму в полосы в обход сокетов, для воспроизведения захвата. Только пока поток не запущен.
+		 * Защита от DDOS не применяется: в захват попадают уже принятые датаграммы
+		 * \return false, если полоса датаграммы заполнена: сначала нужно разобрать полосы через get
+		 */
+		bool inject(const sf::IpAddress& address, sf::Uint16 port, const void* data, size_t size);
 	};
 
 
 
-	inline void* TwoPageInput::_read() {
-		void* temp;
-		if (m_read) {
-			temp = shift(m_page1,m_output_position * m_block_size);
+	inline DDOSDefence::DDOSDefence(std::chrono::milliseconds defenceTime, size_t limitCounter):
+		m_defence_time(defenceTime), m_encounter_limit(limitCounter){
+	}
+
+	inline bool DDOSDefence::packet(sf::IpAddress address) {
+		auto it = m_chrono_defence.find(address);
+		if (it == m_chrono_defence.end()) {
+			m_chrono_defence.insert(it, std::make_pair(address, std::make_pair(Clock::now(), 1)));
+			return true;
 		}
-		else {
-			temp = shift(m_page2, m_output_position * m_block_size);
+		const tick now = Clock::now();
+		if (Clock::between(it->second.first, now) > m_defence_time) {
+			//Новое окно отсчитывается от этого пакета
+			it->second.first = now;
+			it->second.second = 1;
+			return true;
+		}
+		return (it->second.second++) < m_encounter_limit;
+	}
+
+	inline bool InputThread::rebind(sf::Uint16 port) {
+		if (port == m_port.load())
+			return true;
+
+		//Смена порта во время льготного периода: самый старый сокет закрывается сразу, как только будет дочитан
+		if (m_retiring && !retire())
+			return false;
+
+		const byte next = 1 - m_active;
+		NativeUdpSocket& socket = m_sockets[next];
+		if (!open(socket, port)) {
+			std::cerr << "Input error: can't bind port " << port << std::endl;
+			return true;
 		}
-		++m_output_position;
-		return temp;
+#if defined(__linux__)
+		if (m_uring.load(std::memory_order_relaxed))
+			arm(next);
+#endif
+		m_active = next;
+		m_port.store(port);
+		m_retiring = true;
+		m_retire_time = Clock::after(Clock::update(), m_rebind_grace);
+		return true;
 	}
 
-	inline TwoPageInput::TwoPageInput(size_t blockSize, byte blockCount):
-		m_block_size(blockSize + sizeof(size_t)), m_block_count(blockCount),
-		m_page1(std::malloc(blockSize*blockCount)),
-		m_page2(std::malloc(blockSize*blockCount)),
-		m_output_position(0), m_input_position(0),
-		m_page_free(true), m_page_fill(false), m_read(false){
+	inline bool InputThread::retire() {
+		NativeUdpSocket& socket = m_sockets[1 - m_active];
+#if defined(__linux__)
+		//Уже принятое ядром разбирается из кольца, остаток очереди сокета дочитывается напрямую
+		if (m_uring.load(std::memory_order_relaxed)) {
+			disarm(1 - m_active);
+			//Недоразложенную пачку завершения кольца доразложит receiveRing: чтение сокета приняло бы её за свою
+			if ((m_segments.data != nullptr) && (m_segments.data != m_staging.data()))
+				return false;
+		}
+#endif
+		//Закрытие сокета с непрочитанной очередью теряет её: закрываем только после чтения до пустой очереди
+		if (!receive(socket))
+			return false;
+		m_selector.remove(socket);
+		socket.unbind();
+		m_retiring = false;
+		return true;
 	}
 
-	inline TwoPageInput::~TwoPageInput() {
-		std::free(m_page1);
-		std::free(m_page2);
+	inline bool InputThread::open(NativeUdpSocket& socket, sf::Uint16 port) {
+		socket.setBlocking(false);
+		if (socket.bind(port) != sf::Socket::Done)
+			return false;
+		if (m_gro.load(std::memory_order_relaxed) && !socket.enableGro())
+			std::cerr << "Input: UDP_GRO is unavailable on port " << port << std::endl;
+		m_selector.add(socket);
+		return true;
 	}
 
-	inline void* TwoPageInput::read() {
-		byte shift = m_input_position.load();
-		if (m_page_free.load()) {
-			if (m_output_position < shift)
-				return _read();
-			return nullptr;
+	inline size_t InputThread::payloadLimit() const {
+		return m_lanes[0].maxPacket();
+	}
+
+	inline bool InputThread::deliver(size_t& accepted) {
+		const size_t payload_limit = payloadLimit();
+		while (m_segments.offset < m_segments.size) {
+			const size_t size = std::min(m_segments.segment, m_segments.size - m_segments.offset);
+			const byte* data = m_segments.data + m_segments.offset;
+			const Lane lane = (m_classifier != nullptr) ? m_classifier(data, size) : Lane::GAME;
+			const auto index = static_cast<size_t>(lane);
+
+			//Защита от DDOS спрашивается только при свободном месте: пакет, ждущий места в полосе GAME, не считается ей дважды
+			void* memory = (size <= payload_limit) ? m_lanes[index].write(size) : nullptr;
+			if (size > payload_limit) {
+				m_lane_dropped[index].store(m_lane_dropped[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			} else if (memory == nullptr) {
+				if (lane == Lane::GAME)
+					return false;
+				m_lane_dropped[index].store(m_lane_dropped[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			} else if (!m_defence.packet(m_segments.address)) {
+				m_lane_refused[index].store(m_lane_refused[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			} else {
+				std::memcpy(shift(memory, sizeof(PacketPrefix)), data, size);
+				new (memory) PacketPrefix(size, m_segments.address, m_segments.port);
+				m_lanes[index].validWrite();
+				m_lane_accepted[index].store(m_lane_accepted[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				++accepted;
+				if (m_capture != nullptr)
+					m_capture->record(Clock::now(), m_segments.address, m_segments.port, data, size);
+			}
+			m_received.store(m_received.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			m_segments.offset += size;
 		}
+		m_segments = Segments();
+		return true;
+	}
 
-		if (m_output_position == m_block_count) {
-			m_page_free.store(true);
-			m_output_position = 0;
-			m_read = !m_read;
+	inline bool InputThread::receive(NativeUdpSocket& socket) {
+#if defined(__linux__)
+		if (m_gro.load(std::memory_order_relaxed))
+			return receiveSegments(socket);
+#endif
+		size_t accepted = 0;
+		bool drained = false;
+		//Полосы известны только после чтения: датаграмма читается в общий буфер и копируется в запись полосы
+		while (deliver(accepted)) {
+			sf::IpAddress address;
+			size_t		  received;
+			unsigned short port;
+			const sf::Socket::Status result = socket.receive(m_staging.data(), m_staging.size(), received, address, port);
+			if (result != sf::Socket::Done) {
+				if (result == sf::Socket::Error) {
+					std::cerr << "Input error: " << "sender ip: " << address << "; sender port: " << port << std::endl;
+				}
+				drained = true;
+				break;
+			}
 
-			if (m_output_position < shift) 
-				return _read();
+			m_reads.store(m_reads.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			m_segments.data	   = m_staging.data();
+			m_segments.size	   = received;
+			m_segments.segment = received;
+			m_segments.offset  = 0;
+			m_segments.address = address;
+			m_segments.port	   = port;
+		}
+
+		//Одно пробуждение на пачку
+		if ((accepted != 0) && (m_wakeup != nullptr))
+			m_wakeup->notify();
+		return drained;
+	}
 
-			return nullptr;
+#if defined(__linux__)
+	inline size_t InputThread::segmentSize(msghdr& message, size_t size) {
+		for (cmsghdr* control = CMSG_FIRSTHDR(&message); control != nullptr; control = CMSG_NXTHDR(&message, control)) {
+			if ((control->cmsg_level == SOL_UDP) && (control->cmsg_type == UDP_GRO)) {
+				int segment;
+				std::memcpy(&segment, CMSG_DATA(control), sizeof(segment));
+				if (segment > 0)
+					return static_cast<size_t>(segment);
+			}
 		}
-		
-		return _read();
+		return size;
 	}
 
-	inline void* TwoPageInput::write() {
-		const auto pos = m_input_position.load();
-		if (pos == m_block_count) {
-			if (m_page_free) {
-				m_page_free.store(false);
-				m_input_position.store(0);
-				m_page_fill = !m_page_fill;
+	inline bool InputThread::receiveSegments(NativeUdpSocket& socket) {
+		size_t accepted = 0;
+		bool drained = false;
+		//Остаток пачки с прошлого кадра раскладывается первым
+		while (deliver(accepted)) {
+			sockaddr_in sender;
+			iovec vector{m_staging.data(), m_staging.size()};
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+
+			msghdr message;
+			std::memset(&message, 0, sizeof(message));
+			message.msg_name	   = &sender;
+			message.msg_namelen	   = sizeof(sender);
+			message.msg_iov		   = &vector;
+			message.msg_iovlen	   = 1;
+			message.msg_control	   = control;
+			message.msg_controllen = sizeof(control);
+
+			const ssize_t received = recvmsg(socket.getHandle(), &message, MSG_DONTWAIT);
+			if (received < 0) {
+				if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+					std::cerr << "Input error: recvmsg failed (" << errno << ")" << std::endl;
+				drained = true;
+				break;
+			}
+			m_reads.store(m_reads.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			if (message.msg_namelen < sizeof(sockaddr_in))
+				continue;
+
+			m_segments.data	   = m_staging.data();
+			m_segments.size	   = static_cast<size_t>(received);
+			//Обрезанная датаграмма длиннее самого большого пакета: deliver посчитает её потерянной целиком
+			m_segments.segment = (message.msg_flags & MSG_TRUNC) ? m_segments.size : segmentSize(message, m_segments.size);
+			m_segments.offset  = 0;
+			m_segments.address = sf::IpAddress(ntohl(sender.sin_addr.s_addr));
+			m_segments.port	   = ntohs(sender.sin_port);
+		}
+
+		if ((accepted != 0) && (m_wakeup != nullptr))
+			m_wakeup->notify();
+		return drained;
+	}
+#endif
+
+	inline void InputThread::onInit() {
+#if defined(__linux__)
+		//Склеенная пачка: до GRO_SEGMENTS датаграмм размером с блок
+		if (m_gro.load())
+			m_staging.resize(std::min<size_t>(GRO_SEGMENTS * payloadLimit(), 65535));
+		else
+#else
+		m_gro.store(false);
+#endif
+			//Байт сверх самого большого пакета: больший пакет виден по размеру и считается потерянным, а не обрезается
+			m_staging.resize(payloadLimit() + 1);
+		open(m_sockets[m_active], m_port.load());
+
+#if defined(__linux__)
+		if (m_transport.load() == Transport::URING) {
+			if (openRing()) {
+				m_uring.store(true);
+				arm(m_active);
+			} else {
+				std::cerr << "Input: io_uring is unavailable, using sockets" << std::endl;
 			}
-			else
-				return nullptr;
 		}
-		if (m_page_fill)
-			return shift(m_page1, pos * m_block_size);
-		return shift(m_page2, pos * m_block_size);
+#endif
 	}
 
-	inline void TwoPageInput::validWrite() {
-		++m_input_position;
+	inline void InputThread::onFrame() {
+		//Отложенная смена порта остаётся запрошенной, если за это время не пришёл новый запрос
+		sf::Uint16 requested = m_requested_port.exchange(0);
+		if ((requested != 0) && !rebind(requested)) {
+			sf::Uint16 none = 0;
+			m_requested_port.compare_exchange_strong(none, requested);
+		}
+
+		if (m_retiring && (Clock::between(m_retire_time, Clock::update()).count() >= 0))
+			retire();
+
+		//Полоса GAME заполнена: сокеты не читаются, пока сервер её не разберёт
+		const PacketRing& game = m_lanes[static_cast<size_t>(Lane::GAME)];
+		if (game.full()) {
+			const uint32 key = m_drained.prepare();
+			if (game.full())
+				m_drained.wait(key, WAIT_TIMEOUT);
+			else
+				m_drained.cancel();
+			return;
+		}
+
+#if defined(__linux__)
+		if (m_uring.load(std::memory_order_relaxed)) {
+			receiveRing();
+			return;
+		}
+#endif
+
+		if (!m_selector.wait(sf::milliseconds(static_cast<sf::Int32>(WAIT_TIMEOUT.count()))))
+			return;
+
+		//Одно чтение часов на пачку пакетов
+		Clock::update();
+		for (auto& socket : m_sockets)
+			if (m_selector.isReady(socket))
+				receive(socket);
 	}
 
-	inline size_t TwoPageInput::getBlockSize() const {
-		return m_block_size;
+	inline void InputThread::onDestruction() {
+#if defined(__linux__)
+		//Кольцо закрывается раньше буферов: после этого ядро в них не пишет
+		m_ring.close();
+		m_ring_buffers.close();
+		m_uring.store(false);
+#endif
+		m_selector.clear();
+		for (auto& socket : m_sockets)
+			socket.unbind();
 	}
 
-	inline DDOSDefence::DDOSDefence(std::chrono::milliseconds defenceTime, size_t limitCounter):
-		m_defence_time(defenceTime), m_encounter_limit(limitCounter){
+	inline void InputThread::onInterrupt() {
+		m_drained.notify();
 	}
 
-	inline bool DDOSDefence::packet(sf::IpAddress address) {
-		auto it = m_chrono_defence.find(address);
-		if (it == m_chrono_defence.end()) {
-			m_chrono_defence.insert(it, std::make_pair(address, std::make_pair(std::chrono::system_clock::now(), 1)));
-			return true;
+	inline InputThread::InputThread(unsigned short port, size_t maxPacket, size_t laneCapacity, size_t defencePacketCount, std::chrono::milliseconds defenceDuration,
+		std::chrono::milliseconds rebindGrace):
+		m_lanes{
+			PacketRing(laneCapacity, maxPacket),
+			PacketRing(laneCapacity, maxPacket),
+			PacketRing(laneCapacity, maxPacket)
+		},
+		m_classifier(nullptr), m_read_lane(0),
+		m_active(0), m_retiring(false), m_rebind_grace(rebindGrace),
+		m_defence(defenceDuration, defencePacketCount),
+		m_wakeup(nullptr), m_capture(nullptr),
+		m_gro(false), m_received(0), m_reads(0),
+		m_transport(Transport::SOCKETS), m_uring(false),
+		m_port(port), m_requested_port(0) {
+		for (size_t i = 0; i < LANE_COUNT; ++i) {
+			m_lane_accepted[i].store(0);
+			m_lane_dropped[i].store(0);
+			m_lane_refused[i].store(0);
+			m_credit[i] = LANE_WEIGHTS[i];
 		}
-		if ((std::chrono::system_clock::now() - it->second.first) > m_defence_time) {
-			it->second.second = 1;
-			return true;
+#if defined(__linux__)
+		m_armed[0] = m_armed[1] = 0;
+		m_next_tag = 1;
+#endif
+	}
+
+	inline InputThread::~InputThread() {
+		//Поток нужно остановить до разрушения сокетов и селектора
+		if (containsThread())
+			destroyThread();
+	}
+
+	inline void InputThread::setPort(sf::Uint16 port) {
+		m_requested_port.store(port);
+	}
+
+	inline void InputThread::setWakeup(Wakeup* wakeup) {
+		m_wakeup = wakeup;
+	}
+
+	inline void InputThread::setCapture(CaptureWriter* capture) {
+		m_capture = capture;
+	}
+
+	inline void InputThread::setTransport(Transport transport) {
+		m_transport.store(transport);
+	}
+
+	inline bool InputThread::usesUring() const {
+		return m_uring.load();
+	}
+
+	inline void InputThread::setGro(bool enabled) {
+		m_gro.store(enabled);
+	}
+
+	inline void InputThread::setClassifier(LaneClassifier classifier) {
+		m_classifier = classifier;
+	}
+
+	inline LaneStats InputThread::laneStats(Lane lane) const {
+		LaneStats stats;
+		stats.accepted = m_lane_accepted[static_cast<size_t>(lane)].load(std::memory_order_relaxed);
+		stats.dropped  = m_lane_dropped[static_cast<size_t>(lane)].load(std::memory_order_relaxed);
+		stats.refused  = m_lane_refused[static_cast<size_t>(lane)].load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	inline TransportStats InputThread::stats() const {
+		TransportStats stats;
+		stats.received = m_received.load(std::memory_order_relaxed);
+		stats.reads	   = m_reads.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+#if defined(__linux__)
+	inline bool InputThread::openRing() {
+		//Буфер: заголовок recvmsg, адрес отправителя, размер датаграммы GRO и датаграмма размером с самый большой пакет
+		//или склеенная пачка таких датаграмм
+		const bool gro = m_gro.load();
+		//Как и m_staging - с байтом сверх самого большого пакета
+		size_t payload = payloadLimit() + 1;
+		if (gro)
+			payload = std::min<size_t>(payload * GRO_SEGMENTS, 65535);
+		const size_t control = gro ? CMSG_SPACE(sizeof(int)) : 0;
+		const size_t size = (sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + control + payload + 63) / 64 * 64;
+
+		if (!m_ring.open(64, URING_BUFFERS * 2))
+			return false;
+		if (!m_ring_buffers.open(m_ring, URING_BUFFERS, size, URING_GROUP)) {
+			m_ring.close();
+			return false;
 		}
-		return (it->second.second++) < m_encounter_limit;
+
+		std::memset(&m_ring_message, 0, sizeof(m_ring_message));
+		m_ring_message.msg_namelen	  = sizeof(sockaddr_in);
+		m_ring_message.msg_controllen = control;
+		return true;
 	}
 
-	inline void InputThread::onInit() {
-		m_socket.setBlocking(false);
-		m_socket.bind(m_port);
+	inline void InputThread::arm(byte index) {
+		io_uring_sqe* sqe = m_ring.prepare();
+		if (sqe == nullptr)
+			return;
+		sqe->opcode		= IORING_OP_RECVMSG;
+		sqe->fd			= m_sockets[index].getHandle();
+		sqe->addr		= reinterpret_cast<uint64>(&m_ring_message);
+		sqe->ioprio		= IORING_RECV_MULTISHOT;
+		sqe->flags		= IOSQE_BUFFER_SELECT;
+		sqe->buf_group	= m_ring_buffers.group();
+		//Младший бит метки - номер сокета
+		m_armed[index]	= (m_next_tag++ << 1) | index;
+		sqe->user_data	= m_armed[index];
+		m_ring.enter(0, WAIT_TIMEOUT);
 	}
 
-	inline void InputThread::onFrame() {
-		if (m_memory == nullptr)
-			m_memory = m_buffer.write();
-		
-		if (m_memory != nullptr) {
-			void* shifted = shift(m_memory, sizeof(PacketPrefix));
+	inline void InputThread::disarm(byte index) {
+		if (m_armed[index] == 0)
+			return;
+		io_uring_sqe* sqe = m_ring.prepare();
+		if (sqe == nullptr)
+			return;
+		sqe->opcode	   = IORING_OP_ASYNC_CANCEL;
+		sqe->addr	   = m_armed[index];
+		sqe->user_data = 0;
+		m_armed[index] = 0;
+		m_ring.enter(0, WAIT_TIMEOUT);
+	}
 
-			sf::IpAddress address;
-			size_t		  received;
-			unsigned short port;
-			sf::Socket::Status result = m_socket.receive(shifted, m_buffer.getBlockSize() - sizeof(PacketPrefix), received, address, port);;
+	inline void InputThread::receiveRing() {
+		//Системный вызов - только когда разбирать нечего
+		if (m_ring.peek() == nullptr) {
+			m_ring.enter(1, WAIT_TIMEOUT);
+			if (m_ring.peek() == nullptr)
+				return;
+		}
 
-			if ((result == sf::Socket::Done)) {
-				if (m_defence.packet(address)) {
-					new (m_memory) PacketPrefix(received, address);
-					m_memory = nullptr;
-					m_buffer.validWrite();
+		//Одно чтение часов на пачку пакетов
+		Clock::update();
+		size_t accepted = 0;
+		//Остаток датаграммы, прочитанной из старого сокета напрямую в retire, раскладывается раньше завершений
+		if ((m_segments.data == m_staging.data()) && !deliver(accepted))
+			return;
+		while (io_uring_cqe* cqe = m_ring.peek()) {
+			const uint64 tag = cqe->user_data;
+			const int result = cqe->res;
+			const uint32 flags = cqe->flags;
+
+			if (flags & IORING_CQE_F_BUFFER) {
+				const auto id = static_cast<uint16>(flags >> IORING_CQE_BUFFER_SHIFT);
+				byte* buffer = m_ring_buffers.buffer(id);
+				//Пачка этого завершения могла остаться неразложенной с прошлого кадра
+				if ((m_segments.data == nullptr) && (result >= 0)) {
+					io_uring_recvmsg_out header;
+					std::memcpy(&header, buffer, sizeof(header));
+					m_reads.store(m_reads.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+					byte* control = buffer + sizeof(io_uring_recvmsg_out) + m_ring_message.msg_namelen;
+					if (header.namelen >= sizeof(sockaddr_in)) {
+						sockaddr_in sender;
+						std::memcpy(&sender, buffer + sizeof(io_uring_recvmsg_out), sizeof(sender));
+
+						msghdr message;
+						std::memset(&message, 0, sizeof(message));
+						message.msg_control	   = control;
+						message.msg_controllen = header.controllen;
+
+						m_segments.data	   = control + m_ring_message.msg_controllen;
+						m_segments.size	   = header.payloadlen;
+						m_segments.segment = segmentSize(message, m_segments.size);
+						//Обрезанная датаграмма длиннее самого большого пакета: в буфере её начало, deliver посчитает её потерянной
+						if (header.flags & MSG_TRUNC) {
+							m_segments.size	   = payloadLimit() + 1;
+							m_segments.segment = m_segments.size;
+						}
+						m_segments.offset  = 0;
+						m_segments.address = sf::IpAddress(ntohl(sender.sin_addr.s_addr));
+						m_segments.port	   = ntohs(sender.sin_port);
+					}
 				}
-			} else {
-				if (result == sf::Socket::Error) {
-					std::cerr << "Input error: " << "sender ip: " << address << "; sender port: " << port << std::endl;
+				//Полоса GAME заполнена: завершение остаётся в кольце до следующего кадра
+				if (!deliver(accepted))
+					break;
+				m_ring_buffers.recycle(id);
+			}
+
+			//Многократная заявка закончилась: кончились буферы или ошибка сокета
+			if ((tag != 0) && ((flags & IORING_CQE_F_MORE) == 0) && (tag == m_armed[tag & 1])) {
+				m_armed[tag & 1] = 0;
+				if ((result >= 0) || (result == -ENOBUFS)) {
+					m_ring.pop();
+					arm(static_cast<byte>(tag & 1));
+					continue;
 				}
+				std::cerr << "Input: io_uring receive failed (" << -result << "), using sockets" << std::endl;
+				m_uring.store(false);
+				disarm(static_cast<byte>(1 - (tag & 1)));
 			}
+			m_ring.pop();
 		}
+		//Возвращённые буферы уходят ядру одним вызовом на пачку
+		m_ring.enter(0, WAIT_TIMEOUT);
+
+		if ((accepted != 0) && (m_wakeup != nullptr))
+			m_wakeup->notify();
 	}
+#endif
 
-	inline InputThread::InputThread(unsigned short port, size_t packetSize, byte packetCount, size_t defencePacketCount, std::chrono::milliseconds defenceDuration):
-		m_defence(defenceDuration, defencePacketCount),
-		m_buffer(packetSize + sizeof(PacketPrefix), packetCount),
-		m_memory(nullptr), m_port(port) {
+	inline void* InputThread::get() {
+		//Два круга: полосы, исчерпавшие вес, получают его заново в начале круга
+		for (size_t step = 0; step < 2 * LANE_COUNT; ++step) {
+			if (m_credit[m_read_lane] != 0) {
+				if (void* memory = m_lanes[m_read_lane].read()) {
+					--m_credit[m_read_lane];
+					return memory;
+				}
+			}
+			if (++m_read_lane == LANE_COUNT) {
+				m_read_lane = 0;
+				for (size_t i = 0; i < LANE_COUNT; ++i)
+					m_credit[i] = LANE_WEIGHTS[i];
+			}
+		}
+		return nullptr;
 	}
 
-	inline void InputThread::setPort(sf::Uint16 port) {
-		if (isRunning())
-			pause();
-		while (!isRealyPaused() && containsThread());
+	inline bool InputThread::empty() const {
+		for (const auto& lane : m_lanes)
+			if (!lane.empty())
+				return false;
+		return true;
+	}
 
-		m_port = port;
-		m_socket.bind(port);
-		run();
+	inline void InputThread::drained() {
+		m_drained.notify();
 	}
 
-	inline void* InputThread::get() {
-		return m_buffer.read();
+	inline bool InputThread::inject(const sf::IpAddress& address, sf::Uint16 port, const void* data, size_t size) {
+		const auto* bytes = static_cast<const byte*>(data);
+		const Lane lane = (m_classifier != nullptr) ? m_classifier(bytes, size) : Lane::GAME;
+		const auto index = static_cast<size_t>(lane);
+		if (size > payloadLimit()) {
+			m_lane_dropped[index].store(m_lane_dropped[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		void* memory = m_lanes[index].write(size);
+		if (memory == nullptr)
+			return false;
+		std::memcpy(shift(memory, sizeof(PacketPrefix)), bytes, size);
+		new (memory) PacketPrefix(size, address, port);
+		m_lanes[index].validWrite();
+		m_lane_accepted[index].store(m_lane_accepted[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		m_received.store(m_received.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return true;
 	}
 
 	inline unsigned short InputThread::getPort() const {
-		return m_socket.getLocalPort();
+		return m_port.load();
 	}
 }
@@ -3,7 +3,11 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <memory>
+#include <string>
 #include <DSFML/Aliases.h>
 
 namespace demonorium
@@ -20,8 +24,8 @@ namespace demonorium
 
 
 	inline std::ostream& operator<<(std::ostream& stream, const BinaryOutput& output) {
-		for (int i = 0; i < output.m_size; ++i) {
-			uint byte = static_cast<uint>(reinterpret_cast<aliases::uint8*>(output.m_size)[i]);
+		for (size_t i = 0; i < output.m_size; ++i) {
+			uint byte = static_cast<uint>(reinterpret_cast<const aliases::uint8*>(output.m_pointer)[i]);
 			if (byte < 10) {
 				stream << byte << "   ";
 			}
@@ -36,10 +40,31 @@ namespace demonorium
 	}
 
 
+	//Записывает текущее время в формате ctime без перевода строки
+	inline void timestamp(char* buffer, size_t size) {
+		using namespace std::chrono;
+
+		const auto time = system_clock::to_time_t(system_clock::now());
+		std::tm local{};
+#ifdef _WIN32
+		localtime_s(&local, &time);
+#else
+		localtime_r(&time, &local);
+#endif
+		std::strftime(buffer, size, "%a %b %e %H:%M:%S %Y", &local);
+	}
+
+
 	class Log {
-		std::fstream m_output;
+		//Поток создаётся при открытии файла: неоткрытый лог почти ничего не стоит
+		std::unique_ptr<std::fstream> m_output;
+		//Файл <m_deferred><адрес>.log, который откроется при первой записи: путь собирается только тогда
+		const char* m_deferred = nullptr;
+		aliases::uint32 m_deferred_address = 0;
 		bool m_console;
 		
+		void openDeferred();
+		
 		template<class T, class ... Args>
 		void _log(const T& obj, Args&& ... args);
 
@@ -56,6 +81,12 @@ namespace demonorium
 		~Log();
 
 		void open(std::string filename);
+		/**
+		 * \brief Открыть файл <prefix><a.b.c.d>.log при первой записи: объекты, в которые не пишут, не держат файлов
+		 * \param prefix - строка со статическим временем жизни
+		 * \param address - IPv4 адрес в порядке байт хоста
+		 */
+		void openLater(const char* prefix, aliases::uint32 address);
 		void close();
 		
 		template<class ... Args>
@@ -75,7 +106,8 @@ namespace demonorium
 
 	template <class T>
 	void Log::_log(const T& obj) {
-		m_output << obj;
+		if (m_output)
+			*m_output << obj;
 		if (m_console)
 			std::cout << obj;
 	}
@@ -85,13 +117,14 @@ namespace demonorium
 	}
 
 	inline void Log::_log() {
-		m_output << std::endl;
+		if (m_output)
+			*m_output << std::endl;
 		if (m_console)
 			std::cout << std::endl;
 	}
 
 	inline Log::Log(const std::string filename, bool console):
-		m_output(filename, std::ios_base::app), m_console(console) {
+		m_output(std::make_unique<std::fstream>(filename, std::ios_base::app)), m_console(console) {
 	}
 
 	inline Log::Log(bool console):
@@ -99,37 +132,54 @@ namespace demonorium
 	}
 
 	inline Log::Log(Log&& log) noexcept:
-		m_output(std::move(log.m_output)), m_console(log.m_console){
+		m_output(std::move(log.m_output)), m_deferred(log.m_deferred), m_deferred_address(log.m_deferred_address), m_console(log.m_console){
+		log.m_deferred = nullptr;
 	}
 
 	inline Log::~Log() {
-		m_output.close();
+		close();
 	}
 
 	inline void Log::open(std::string filename) {
-		m_output.open(filename, std::ios_base::app);
+		if (!m_output)
+			m_output = std::make_unique<std::fstream>();
+		m_output->open(filename, std::ios_base::app);
+	}
+
+	inline void Log::openLater(const char* prefix, aliases::uint32 address) {
+		m_deferred = prefix;
+		m_deferred_address = address;
+	}
+
+	inline void Log::openDeferred() {
+		if (m_deferred != nullptr) {
+			char path[256];
+			std::snprintf(path, sizeof(path), "%s%u.%u.%u.%u.log", m_deferred,
+				(m_deferred_address >> 24) & 0xFF, (m_deferred_address >> 16) & 0xFF, (m_deferred_address >> 8) & 0xFF, m_deferred_address & 0xFF);
+			m_deferred = nullptr;
+			open(path);
+		}
 	}
 
 	inline void Log::close() {
-		m_output.close();
+		if (m_output)
+			m_output->close();
+		m_deferred = nullptr;
 	}
 
 	template <class ... Args>
 	void Log::write(Args&&... args) {
 		try {
-			using namespace std::chrono;
-			
-			auto time = system_clock::to_time_t(system_clock::now());
+			openDeferred();
 			auto pointer = std::make_unique<char[]>(64);
-			ctime_s(pointer.get(), 64, &time);
-			pointer[strlen(pointer.get()) - 1] = '\0';
+			timestamp(pointer.get(), 64);
 			
 			_log("[", pointer.get(), "]\t");
 			_log(std::forward<Args>(args)...);
 			_log();
 		}
 		catch (std::exception& ex) {
-			std::cout << "    \n";
+			std::cout << "Ошибка при записи в лог\n";
 			std::cout << ex.what() << std::endl;
 		}
 	}
@@ -137,13 +187,11 @@ namespace demonorium
 	template <class ... Args>
 	void Log::write_important(Args&&... args) {
 		try {
-			using namespace std::chrono;
+			openDeferred();
 			_log('\n');
 			
-			auto time = system_clock::to_time_t(system_clock::now());
 			auto pointer = std::make_unique<char[]>(64);
-			ctime_s(pointer.get(), 64, &time);
-			pointer[strlen(pointer.get()) - 1] = '\0';
+			timestamp(pointer.get(), 64);
 			
 			_log("IMPORTANT! [", pointer.get(), "]\t");
 			_log(std::forward<Args>(args)...);
@@ -151,7 +199,7 @@ namespace demonorium
 			_log();
 		}
 		catch (std::exception& ex) {
-			std::cout << "    \n";
+			std::cout << "Ошибка при записи в лог\n";
 			std::cout << ex.what() << std::endl;
 		}
 	}
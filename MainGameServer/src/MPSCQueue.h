@@ -0,0 +1,117 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Ограниченная очередь без блокировок: много писателей, один читатель.
+	 * Каждая ячейка хранит номер круга, поэтому писатели не мешают друг другу,
+	 * а переполнение честно сообщается писателю вместо потери данных.
+	 */
+	template<class T>
+	class MPSCQueue {
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		std::unique_ptr<Cell[]> m_cells;
+		const size_t m_mask;
+		alignas(64) std::atomic<size_t> m_tail;
+		alignas(64) size_t m_head;
+
+		static size_t roundCapacity(size_t capacity);
+	public:
+		//Ёмкость округляется вверх до степени двойки
+		explicit MPSCQueue(size_t capacity);
+
+		/**
+		 * \brief Добавить элемент, можно вызывать из любого потока
+		 * \return false, если очередь заполнена
+		 */
+		bool push(const T& value);
+
+		/**
+		 * \brief Извлечь элемент, вызывается только потоком-читателем
+		 * \return false, если очередь пуста
+		 */
+		bool pop(T& value);
+
+		//Есть ли что читать, вызывается только потоком-читателем
+		bool empty() const;
+		size_t capacity() const;
+	};
+
+
+	template <class T>
+	size_t MPSCQueue<T>::roundCapacity(size_t capacity) {
+		size_t result = 2;
+		while (result < capacity)
+			result <<= 1;
+		return result;
+	}
+
+	template <class T>
+	MPSCQueue<T>::MPSCQueue(size_t capacity):
+		m_cells(new Cell[roundCapacity(capacity)]),
+		m_mask(roundCapacity(capacity) - 1),
+		m_tail(0), m_head(0) {
+		for (size_t i = 0; i <= m_mask; ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	template <class T>
+	bool MPSCQueue<T>::push(const T& value) {
+		size_t position = m_tail.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true) {
+			cell = &m_cells[position & m_mask];
+			const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+
+			if (diff == 0) {
+				if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				//Читатель ещё не освободил ячейку прошлого круга
+				return false;
+			} else {
+				position = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->value = value;
+		cell->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	template <class T>
+	bool MPSCQueue<T>::pop(T& value) {
+		Cell& cell = m_cells[m_head & m_mask];
+		if (cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+			return false;
+
+		value = std::move(cell.value);
+		cell.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+		++m_head;
+		return true;
+	}
+
+	template <class T>
+	bool MPSCQueue<T>::empty() const {
+		return m_cells[m_head & m_mask].sequence.load(std::memory_order_acquire) != m_head + 1;
+	}
+
+	template <class T>
+	size_t MPSCQueue<T>::capacity() const {
+		return m_mask + 1;
+	}
+}
@@ -1,17 +1,53 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
+#ifndef DEMONORIUM_HEADLESS
 #include "UI.h"
+#else
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <clocale>
+#include <thread>
+#endif
+#include "AdminThread.h"
 #include "ServerAPI.h"
 
 demonorium::Server demonorium::ServerAPI::server("valid cd",3333);
 
-int main() {
+#ifdef DEMONORIUM_HEADLESS
+namespace
+{
+	//Выставляется обработчиком SIGINT/SIGTERM, сервер без окна живёт до сигнала
+	std::atomic<bool> g_terminate(false);
+
+	void on_terminate(int) {
+		g_terminate.store(true);
+	}
+}
+#endif
+
+//MainGameServer [файл захвата]: с файлом сервер записывает принятые датаграммы для bench_replay
+int main(int argc, char** argv) {
 	std::setlocale(LC_ALL, "RU");
 	
+	if (argc > 1)
+		demonorium::ServerAPI::set_capture(argv[1]);
 	demonorium::ServerAPI::init();
 	while (!demonorium::ServerAPI::is_launched());
+
+	//Канал управления слушает только 127.0.0.1
+	demonorium::AdminThread admin(3334);
+	admin.start();
 	
-	
+#ifdef DEMONORIUM_HEADLESS
+	std::signal(SIGINT, on_terminate);
+	std::signal(SIGTERM, on_terminate);
+
+	while (!g_terminate.load())
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+#else
 	demonorium::Window window(ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoCollapse,
 		3333,true);
+#endif
+	admin.destroyThread();
 	demonorium::ServerAPI::terminate();
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+#pragma once
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+//winnt.h определяет макрос DELETE, а это имя команды ClientCodes::DELETE
+#undef DELETE
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Файл, целиком отображённый в память только для чтения.
+	 * Данные не копируются: страницы подгружаются системой по мере обращения.
+	 */
+	class MappedFile {
+		const void*	m_data;
+		size_t		m_size;
+#if defined(_WIN32)
+		HANDLE		m_file;
+		HANDLE		m_mapping;
+#else
+		int			m_descriptor;
+#endif
+	public:
+		MappedFile();
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator =(const MappedFile&) = delete;
+
+		//Отобразить файл, false если файла нет или он пуст
+		bool open(const std::string& path);
+		void close();
+
+		bool isOpen() const;
+		const void* data() const;
+		size_t size() const;
+
+		//Записать файл целиком через временный файл и переименование: читатель видит либо старое, либо новое содержимое
+		static bool replace(const std::string& path, const void* data, size_t size);
+	};
+
+
+#if defined(_WIN32)
+	inline MappedFile::MappedFile():
+		m_data(nullptr), m_size(0), m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr) {
+	}
+
+	inline bool MappedFile::open(const std::string& path) {
+		close();
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || (size.QuadPart == 0)) {
+			close();
+			return false;
+		}
+
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping != nullptr)
+			m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		if (m_data == nullptr) {
+			close();
+			return false;
+		}
+		m_size = static_cast<size_t>(size.QuadPart);
+		return true;
+	}
+
+	inline void MappedFile::close() {
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_data		= nullptr;
+		m_size		= 0;
+		m_mapping	= nullptr;
+		m_file		= INVALID_HANDLE_VALUE;
+	}
+#else
+	inline MappedFile::MappedFile():
+		m_data(nullptr), m_size(0), m_descriptor(-1) {
+	}
+
+	inline bool MappedFile::open(const std::string& path) {
+		close();
+		m_descriptor = ::open(path.c_str(), O_RDONLY);
+		if (m_descriptor < 0)
+			return false;
+
+		struct stat info;
+		if ((fstat(m_descriptor, &info) != 0) || (info.st_size == 0)) {
+			close();
+			return false;
+		}
+
+		void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, m_descriptor, 0);
+		if (data == MAP_FAILED) {
+			close();
+			return false;
+		}
+		m_data = data;
+		m_size = static_cast<size_t>(info.st_size);
+		return true;
+	}
+
+	inline void MappedFile::close() {
+		if (m_data)
+			munmap(const_cast<void*>(m_data), m_size);
+		if (m_descriptor >= 0)
+			::close(m_descriptor);
+		m_data		 = nullptr;
+		m_size		 = 0;
+		m_descriptor = -1;
+	}
+#endif
+
+	inline MappedFile::~MappedFile() {
+		close();
+	}
+
+	inline bool MappedFile::isOpen() const {
+		return m_data != nullptr;
+	}
+
+	inline const void* MappedFile::data() const {
+		return m_data;
+	}
+
+	inline size_t MappedFile::size() const {
+		return m_size;
+	}
+
+	inline bool MappedFile::replace(const std::string& path, const void* data, size_t size) {
+		const std::string temporary = path + ".tmp";
+		{
+			std::ofstream output(temporary, std::ios_base::binary | std::ios_base::trunc);
+			output.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+			if (!output.flush())
+				return false;
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary, path, error);
+		return !error;
+	}
+}
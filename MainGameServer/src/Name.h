@@ -0,0 +1,350 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Имя игрока: 32-битный номер в таблице имён NameTable.
+	 * Одинаковые имена получают один номер, поэтому сравнение - операция над числом.
+	 * Копии имени считаются в таблице, где бы они ни лежали (игрок, снимок, очередь истории):
+	 * слот освобождается вместе с последней копией. Номер 0 - пустое имя, его копии не считаются.
+	 */
+	class Name {
+		uint32 m_id;
+
+		//Имя, копия которого уже учтена таблицей
+		explicit Name(uint32 id);
+		friend class NameTable;
+	public:
+		Name();
+		Name(const Name& other);
+		Name(Name&& other) noexcept;
+		Name& operator =(const Name& other);
+		Name& operator =(Name&& other) noexcept;
+		~Name();
+
+		uint32 id() const;
+		//Текст имени, не нуль-терминирован
+		std::string_view view() const;
+		size_t size() const;
+		bool empty() const;
+
+		bool operator ==(const Name& other) const;
+		bool operator !=(const Name& other) const;
+	};
+
+	std::ostream& operator <<(std::ostream& stream, const Name& name);
+
+	static_assert(sizeof(Name) == sizeof(uint32));
+
+
+	/**
+	 * \brief Таблица имён: каждое различное имя хранится один раз в слоте фиксированного размера.
+	 * Слоты выделяются блоками по CHUNK и не перемещаются, поэтому текст по номеру читается из любого потока,
+	 * получившего имя через синхронизацию (снимок, очередь). Добавляет имена только поток сервера.
+	 * Слот без копий имени занимается под новое имя, только если копий так и не появилось: текст живого имени не меняется.
+	 * Имена длиннее CAPACITY байт обрезаются.
+	 */
+	class NameTable {
+	public:
+		static constexpr size_t CAPACITY	= 32;
+		static constexpr size_t CHUNK		= 4096;
+		static constexpr size_t MAX_CHUNKS	= 256;
+		//Предел одновременно живых различных имён
+		static constexpr size_t LIMIT		= CHUNK * MAX_CHUNKS;
+	private:
+		struct Chunk {
+			//Копий имени в слоте
+			std::atomic<uint32> references[CHUNK];
+			byte sizes[CHUNK];
+			char data[CHUNK][CAPACITY];
+		};
+
+		std::atomic<Chunk*>	m_chunks[MAX_CHUNKS];
+		uint32				m_size;
+		//Открытая адресация по хешу текста, 0 - свободная ячейка (пустое имя в индекс не попадает)
+		std::vector<uint32>	m_index;
+		//Слоты, потерявшие последнюю копию. Копии умирают в любом потоке, но это редкий путь: удаление игрока или смена имени
+		std::mutex			m_released_mutex;
+		std::vector<uint32>	m_released;
+		//Освобождённые слоты, уже забранные потоком сервера
+		std::vector<uint32>	m_free;
+
+		NameTable();
+
+		static size_t hash(const char* data, size_t size);
+		void grow();
+		//Убрать слот из индекса, пока в нём лежит прежний текст
+		void erase(uint32 id);
+		//Слот под новое имя: сначала освобождённые, затем новые. 0 - таблица заполнена
+		uint32 allocate();
+
+		std::atomic<uint32>& references(uint32 id) const;
+		void acquire(uint32 id);
+		void release(uint32 id);
+		std::string_view view(uint32 id) const;
+	public:
+		~NameTable();
+		NameTable(const NameTable&) = delete;
+		NameTable& operator =(const NameTable&) = delete;
+
+		//Таблица процесса, не разрушается: имена нужны до остановки последнего потока
+		static NameTable& global();
+
+		/**
+		 * \brief Найти или добавить имя, вызывается только потоком сервера
+		 * \return false, если все слоты заняты живыми именами; name тогда пустое
+		 */
+		bool intern(const char* data, size_t size, Name& name);
+		bool intern(std::string_view text, Name& name);
+
+		std::string_view view(const Name& name) const;
+		//Число выделенных слотов, включая пустое имя и освобождённые
+		size_t size() const;
+
+		friend class Name;
+	};
+
+
+	inline Name::Name():
+		m_id(0) {
+	}
+
+	inline Name::Name(uint32 id):
+		m_id(id) {
+	}
+
+	inline Name::Name(const Name& other):
+		m_id(other.m_id) {
+		if (m_id != 0)
+			NameTable::global().acquire(m_id);
+	}
+
+	inline Name::Name(Name&& other) noexcept:
+		m_id(other.m_id) {
+		other.m_id = 0;
+	}
+
+	inline Name& Name::operator=(const Name& other) {
+		//Имя игрока в снимке обычно не меняется: тогда счётчик не трогается
+		if (m_id != other.m_id) {
+			Name copy(other);
+			std::swap(m_id, copy.m_id);
+		}
+		return *this;
+	}
+
+	inline Name& Name::operator=(Name&& other) noexcept {
+		if (this != &other)
+			std::swap(m_id, other.m_id);
+		return *this;
+	}
+
+	inline Name::~Name() {
+		if (m_id != 0)
+			NameTable::global().release(m_id);
+	}
+
+	inline uint32 Name::id() const {
+		return m_id;
+	}
+
+	inline std::string_view Name::view() const {
+		return NameTable::global().view(*this);
+	}
+
+	inline size_t Name::size() const {
+		return view().size();
+	}
+
+	inline bool Name::empty() const {
+		return m_id == 0;
+	}
+
+	inline bool Name::operator==(const Name& other) const {
+		return m_id == other.m_id;
+	}
+
+	inline bool Name::operator!=(const Name& other) const {
+		return m_id != other.m_id;
+	}
+
+	inline std::ostream& operator<<(std::ostream& stream, const Name& name) {
+		return stream << name.view();
+	}
+
+
+	inline NameTable::NameTable():
+		m_size(1), m_index(CHUNK * 2, 0) {
+		for (auto& chunk : m_chunks)
+			chunk.store(nullptr, std::memory_order_relaxed);
+
+		//Слот 0 - пустое имя
+		Chunk* first = new Chunk;
+		first->sizes[0] = 0;
+		m_chunks[0].store(first, std::memory_order_release);
+	}
+
+	inline NameTable::~NameTable() {
+		for (auto& chunk : m_chunks)
+			delete chunk.load(std::memory_order_relaxed);
+	}
+
+	inline NameTable& NameTable::global() {
+		static NameTable* table = new NameTable;
+		return *table;
+	}
+
+	inline size_t NameTable::hash(const char* data, size_t size) {
+		//FNV-1a
+		uint64 result = 14695981039346656037ull;
+		for (size_t i = 0; i < size; ++i) {
+			result ^= static_cast<byte>(data[i]);
+			result *= 1099511628211ull;
+		}
+		return static_cast<size_t>(result);
+	}
+
+	inline void NameTable::grow() {
+		std::vector<uint32> index(m_index.size() * 2, 0);
+		const size_t mask = index.size() - 1;
+		for (uint32 id : m_index) {
+			if (id == 0)
+				continue;
+			const auto text = view(id);
+			size_t position = hash(text.data(), text.size()) & mask;
+			while (index[position] != 0)
+				position = (position + 1) & mask;
+			index[position] = id;
+		}
+		m_index.swap(index);
+	}
+
+	inline void NameTable::erase(uint32 id) {
+		const size_t mask = m_index.size() - 1;
+		const auto text = view(id);
+		size_t hole = hash(text.data(), text.size()) & mask;
+		while (m_index[hole] != id)
+			hole = (hole + 1) & mask;
+
+		//Удаление со сдвигом назад: запись за дырой переезжает в неё, если дыра лежит на пути от её ячейки по хешу
+		for (size_t next = (hole + 1) & mask; m_index[next] != 0; next = (next + 1) & mask) {
+			const auto moved = view(m_index[next]);
+			const size_t home = hash(moved.data(), moved.size()) & mask;
+			if (((next - home) & mask) >= ((next - hole) & mask)) {
+				m_index[hole] = m_index[next];
+				hole = next;
+			}
+		}
+		m_index[hole] = 0;
+	}
+
+	inline uint32 NameTable::allocate() {
+		if (m_free.empty()) {
+			std::lock_guard<std::mutex> lock(m_released_mutex);
+			m_free.swap(m_released);
+		}
+		while (!m_free.empty()) {
+			const uint32 id = m_free.back();
+			m_free.pop_back();
+			//Пока слот ждал, то же имя могли найти снова: тогда он остаётся за ним
+			if (references(id).load(std::memory_order_acquire) == 0) {
+				erase(id);
+				return id;
+			}
+		}
+
+		if (m_size == LIMIT)
+			return 0;
+		const uint32 id = m_size;
+		if (m_chunks[id / CHUNK].load(std::memory_order_relaxed) == nullptr)
+			m_chunks[id / CHUNK].store(new Chunk, std::memory_order_release);
+		++m_size;
+		return id;
+	}
+
+	inline std::atomic<uint32>& NameTable::references(uint32 id) const {
+		return m_chunks[id / CHUNK].load(std::memory_order_acquire)->references[id % CHUNK];
+	}
+
+	inline void NameTable::acquire(uint32 id) {
+		//Новые копии делаются из существующих, поэтому счётчик не растёт из нуля в чужом потоке
+		references(id).fetch_add(1, std::memory_order_relaxed);
+	}
+
+	inline void NameTable::release(uint32 id) {
+		if (references(id).fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+		std::lock_guard<std::mutex> lock(m_released_mutex);
+		m_released.push_back(id);
+	}
+
+	inline bool NameTable::intern(const char* data, size_t size, Name& name) {
+		size = std::min(size, CAPACITY);
+		name = Name();
+		if (size == 0)
+			return true;
+
+		const size_t mask = m_index.size() - 1;
+		size_t position = hash(data, size) & mask;
+		while (m_index[position] != 0) {
+			const uint32 candidate = m_index[position];
+			const auto text = view(candidate);
+			if ((text.size() == size) && (std::memcmp(text.data(), data, size) == 0)) {
+				acquire(candidate);
+				name = Name(candidate);
+				return true;
+			}
+			position = (position + 1) & mask;
+		}
+
+		const uint32 id = allocate();
+		if (id == 0)
+			return false;
+		Chunk* chunk = m_chunks[id / CHUNK].load(std::memory_order_relaxed);
+		chunk->sizes[id % CHUNK] = static_cast<byte>(size);
+		std::memcpy(chunk->data[id % CHUNK], data, size);
+		chunk->references[id % CHUNK].store(1, std::memory_order_relaxed);
+
+		//Освобождение слота сдвигает записи индекса: свободная ячейка ищется заново
+		position = hash(data, size) & mask;
+		while (m_index[position] != 0)
+			position = (position + 1) & mask;
+		m_index[position] = id;
+		//Заполнение индекса не больше половины
+		if (m_size * 2 > m_index.size())
+			grow();
+
+		name = Name(id);
+		return true;
+	}
+
+	inline bool NameTable::intern(std::string_view text, Name& name) {
+		return intern(text.data(), text.size(), name);
+	}
+
+	inline std::string_view NameTable::view(const Name& name) const {
+		return view(name.id());
+	}
+
+	inline std::string_view NameTable::view(uint32 id) const {
+		const Chunk* chunk = m_chunks[id / CHUNK].load(std::memory_order_acquire);
+		return std::string_view(chunk->data[id % CHUNK], chunk->sizes[id % CHUNK]);
+	}
+
+	inline size_t NameTable::size() const {
+		return m_size;
+	}
+}
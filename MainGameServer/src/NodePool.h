@@ -0,0 +1,197 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Пул блоков одного размера для узлов контейнеров.
+	 * Размер блока фиксируется первым выделением: std::map выделяет только узлы одного типа.
+	 * Память берётся блоками по m_per_chunk узлов и не возвращается системе до разрушения пула,
+	 * освобождённые узлы уходят в список свободных и выдаются первыми.
+	 * Не потокобезопасен: пулом владеет один поток.
+	 */
+	class NodePool {
+		struct FreeBlock {
+			FreeBlock* next;
+		};
+
+		size_t			m_block;
+		size_t			m_per_chunk;
+		std::vector<byte*> m_chunks;
+		//Следующий ещё не выданный блок: номер куска и смещение в нём
+		size_t			m_chunk;
+		size_t			m_offset;
+		FreeBlock*		m_free;
+		size_t			m_live;
+
+		static size_t roundBlock(size_t size);
+	public:
+		explicit NodePool(size_t perChunk = 256);
+		~NodePool();
+		NodePool(const NodePool&) = delete;
+		NodePool& operator =(const NodePool&) = delete;
+
+		//Блоки другого размера или выравнивания выделяются обычным operator new
+		void* allocate(size_t size, size_t alignment);
+		void deallocate(void* block, size_t size, size_t alignment);
+
+		/**
+		 * \brief Вернуть все куски к началу, когда живых узлов не осталось.
+		 * Следующие выделения снова идут подряд по кускам, список свободных сбрасывается.
+		 * \return false, если в пуле есть живые узлы
+		 */
+		bool reset();
+
+		//Выданных и не освобождённых блоков
+		size_t live() const;
+		//Блоков во всех кусках
+		size_t capacity() const;
+	};
+
+
+	//Аллокатор для стандартных контейнеров поверх NodePool, в духе параметра Alloc у SimpleTree
+	template<class T>
+	class PoolAllocator {
+		template<class U>
+		friend class PoolAllocator;
+
+		NodePool* m_pool;
+	public:
+		using value_type = T;
+
+		explicit PoolAllocator(NodePool& pool) noexcept;
+		template<class U>
+		PoolAllocator(const PoolAllocator<U>& other) noexcept;
+
+		T* allocate(size_t count);
+		void deallocate(T* pointer, size_t count) noexcept;
+
+		NodePool& pool() const;
+
+		template<class U>
+		bool operator ==(const PoolAllocator<U>& other) const;
+		template<class U>
+		bool operator !=(const PoolAllocator<U>& other) const;
+	};
+
+
+	inline size_t NodePool::roundBlock(size_t size) {
+		constexpr size_t ALIGN = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+		size = std::max(size, sizeof(FreeBlock));
+		return (size + ALIGN - 1) / ALIGN * ALIGN;
+	}
+
+	inline NodePool::NodePool(size_t perChunk):
+		m_block(0), m_per_chunk(std::max<size_t>(perChunk, 1)),
+		m_chunk(0), m_offset(0),
+		m_free(nullptr), m_live(0) {
+	}
+
+	inline NodePool::~NodePool() {
+		for (byte* chunk : m_chunks)
+			::operator delete(chunk);
+	}
+
+	inline void* NodePool::allocate(size_t size, size_t alignment) {
+		if (m_block == 0)
+			m_block = roundBlock(size);
+		if ((roundBlock(size) != m_block) || (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__))
+			return ::operator new(size);
+
+		++m_live;
+		if (m_free != nullptr) {
+			FreeBlock* block = m_free;
+			m_free = block->next;
+			return block;
+		}
+
+		if (m_offset == m_per_chunk) {
+			++m_chunk;
+			m_offset = 0;
+		}
+		if (m_chunk == m_chunks.size())
+			m_chunks.push_back(static_cast<byte*>(::operator new(m_block * m_per_chunk)));
+		return m_chunks[m_chunk] + m_block * m_offset++;
+	}
+
+	inline void NodePool::deallocate(void* block, size_t size, size_t alignment) {
+		if ((roundBlock(size) != m_block) || (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)) {
+			::operator delete(block);
+			return;
+		}
+
+		--m_live;
+		m_free = ::new (block) FreeBlock{m_free};
+	}
+
+	inline bool NodePool::reset() {
+		if (m_live != 0)
+			return false;
+		m_free	 = nullptr;
+		m_chunk	 = 0;
+		m_offset = 0;
+		return true;
+	}
+
+	inline size_t NodePool::live() const {
+		return m_live;
+	}
+
+	inline size_t NodePool::capacity() const {
+		return m_chunks.size() * m_per_chunk;
+	}
+
+
+	template <class T>
+	PoolAllocator<T>::PoolAllocator(NodePool& pool) noexcept:
+		m_pool(&pool) {
+	}
+
+	template <class T>
+	template <class U>
+	PoolAllocator<T>::PoolAllocator(const PoolAllocator<U>& other) noexcept:
+		m_pool(other.m_pool) {
+	}
+
+	template <class T>
+	T* PoolAllocator<T>::allocate(size_t count) {
+		//Пул раздаёт только одиночные узлы
+		if (count != 1)
+			return static_cast<T*>(::operator new(count * sizeof(T)));
+		return static_cast<T*>(m_pool->allocate(sizeof(T), alignof(T)));
+	}
+
+	template <class T>
+	void PoolAllocator<T>::deallocate(T* pointer, size_t count) noexcept {
+		if (count != 1)
+			::operator delete(pointer);
+		else
+			m_pool->deallocate(pointer, sizeof(T), alignof(T));
+	}
+
+	template <class T>
+	NodePool& PoolAllocator<T>::pool() const {
+		return *m_pool;
+	}
+
+	template <class T>
+	template <class U>
+	bool PoolAllocator<T>::operator==(const PoolAllocator<U>& other) const {
+		return m_pool == other.m_pool;
+	}
+
+	template <class T>
+	template <class U>
+	bool PoolAllocator<T>::operator!=(const PoolAllocator<U>& other) const {
+		return m_pool != other.m_pool;
+	}
+}
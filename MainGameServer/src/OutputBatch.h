@@ -0,0 +1,421 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <SFML/Network.hpp>
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#endif
+
+#include "Framing.h"
+#include "Uring.h"
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	//UDP сокет SFML с доступом к системному дескриптору: пакетная отправка и io_uring
+	class NativeUdpSocket: public sf::UdpSocket {
+	public:
+		using sf::UdpSocket::getHandle;
+
+		/**
+		 * \brief Разрешить ядру склеивать датаграммы одного отправителя (UDP_GRO), сокет должен быть открыт.
+		 * Склеенная пачка читается одним recvmsg, размер датаграммы в ней приходит в управляющих данных
+		 * \return false, если ядро или система этого не умеют
+		 */
+		bool enableGro();
+	};
+
+	/**
+	 * \brief Счётчики транспорта с момента запуска.
+	 * Чтение - вызов recvmsg или завершение io_uring с данными, запись - системный вызов отправки
+	 */
+	struct TransportStats {
+		uint64 received = 0;
+		uint64 reads	= 0;
+		uint64 sent		= 0;
+		uint64 writes	= 0;
+	};
+
+	/**
+	 * \brief Пачка UDP сообщений, отправляемых одним вызовом.
+	 * Сообщения копируются в общий буфер, на Linux пачка уходит через sendmmsg или заявками SENDMSG
+	 * в io_uring - один системный вызов на SEND_CHUNK заголовков, на остальных системах - обычным send по одному.
+	 * С сегментацией подряд идущие сообщения одному адресату одного размера уходят одним заголовком с UDP_SEGMENT,
+	 * датаграммы из него нарезает ядро.
+	 * Сообщения с кадрами перед отправкой склеиваются: всё, что за пачку накопилось одному адресату,
+	 * уходит датаграммами с кадрами по FRAMED_DATAGRAM байт, на месте первого сообщения адресату.
+	 */
+	class OutputBatch {
+		struct Message {
+			sf::IpAddress	address;
+			sf::Uint16		port;
+			uint32			offset;
+			uint32			size;
+			bool			framed;
+		};
+
+		//Заголовков на один системный вызов
+		static constexpr size_t SEND_CHUNK = 64;
+		//Пределы ядра на одну сегментированную отправку: датаграмм и байт
+		static constexpr size_t SEGMENTS	   = 64;
+		static constexpr size_t SEGMENTS_BYTES = 65000;
+
+		std::vector<byte>		m_data;
+		std::vector<Message>	m_messages;
+		bool					m_segmentation;
+		uint64					m_writes;
+		//Сообщений с кадрами в пачке
+		size_t					m_framed;
+		//Память склейки живёт между пачками: после первых пачек склейка не выделяет память
+		std::vector<byte>		m_coalesced_data;
+		std::vector<Message>	m_coalesced;
+		std::vector<size_t>		m_placement;
+		std::unordered_map<uint64, size_t> m_open;
+#if defined(__linux__)
+		struct Header {
+			sockaddr_in address;
+			iovec		vector;
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16))];
+		};
+
+		//Заполнить заголовок сообщениями с begin, возвращает их число: больше одного только с UDP_SEGMENT
+		size_t fill(size_t begin, msghdr& message, Header& header) const;
+		//Ядро отвергло сегментированную отправку: дальше сообщения уходят по одному
+		bool dropSegmentation(int error);
+#endif
+		//Отправить сообщения [begin, end) по одному через сокет
+		size_t sendEach(NativeUdpSocket& socket, size_t begin, size_t end);
+		//Склеить сообщения с кадрами по адресатам, остальные остаются на своих местах
+		void coalesce();
+	public:
+		OutputBatch();
+
+		/**
+		 * \brief Добавить сообщение, данные копируются.
+		 * \param framed - адресат понимает датаграммы с кадрами, сообщение можно склеить с другими ему же
+		 */
+		void add(sf::IpAddress address, sf::Uint16 port, const void* data, size_t size, bool framed = false);
+
+		bool empty() const;
+		size_t size() const;
+
+		//Склеивать сообщения одному адресату через UDP_SEGMENT, где ядро это умеет
+		void setSegmentation(bool enabled);
+		bool segmentation() const;
+		//Системных вызовов отправки за всё время
+		uint64 writes() const;
+
+		//Отправить все сообщения и очистить пачку, возвращает число отправленных датаграмм
+		size_t flush(NativeUdpSocket& socket);
+#if defined(__linux__)
+		/**
+		 * \brief То же через io_uring: заявки SENDMSG уходят пачкой, пачка дожидается своих завершений,
+		 * поэтому данные живут до конца отправки. При ошибке кольца оно закрывается, остаток уходит через сокет
+		 */
+		size_t flush(NativeUdpSocket& socket, Uring& ring);
+#endif
+		//Очистить пачку без отправки
+		void clear();
+	};
+
+
+#if defined(__linux__)
+	inline bool NativeUdpSocket::enableGro() {
+		const int enabled = 1;
+		return setsockopt(getHandle(), SOL_UDP, UDP_GRO, &enabled, sizeof(enabled)) == 0;
+	}
+#else
+	inline bool NativeUdpSocket::enableGro() {
+		return false;
+	}
+#endif
+
+	inline OutputBatch::OutputBatch():
+		m_segmentation(false), m_writes(0), m_framed(0) {
+	}
+
+	inline void OutputBatch::add(sf::IpAddress address, sf::Uint16 port, const void* data, size_t size, bool framed) {
+		//Сообщение, не помещающееся в датаграмму с кадрами, уходит отдельно
+		framed = framed && (1 + FRAME_HEADER + size <= FRAMED_DATAGRAM);
+		const auto offset = static_cast<uint32>(m_data.size());
+		m_data.insert(m_data.end(), static_cast<const byte*>(data), static_cast<const byte*>(data) + size);
+		m_messages.push_back(Message{address, port, offset, static_cast<uint32>(size), framed});
+		if (framed)
+			++m_framed;
+	}
+
+	inline bool OutputBatch::empty() const {
+		return m_messages.empty();
+	}
+
+	inline size_t OutputBatch::size() const {
+		return m_messages.size();
+	}
+
+	inline void OutputBatch::setSegmentation(bool enabled) {
+		m_segmentation = enabled;
+	}
+
+	inline bool OutputBatch::segmentation() const {
+		return m_segmentation;
+	}
+
+	inline uint64 OutputBatch::writes() const {
+		return m_writes;
+	}
+
+#if defined(__linux__)
+	inline size_t OutputBatch::fill(size_t begin, msghdr& message, Header& header) const {
+		const Message& first = m_messages[begin];
+		size_t count = 1;
+		if (m_segmentation) {
+			//Серия: тот же адресат, тот же размер, данные подряд; последнее сообщение может быть короче
+			size_t bytes = first.size;
+			while ((begin + count < m_messages.size()) && (count < SEGMENTS)) {
+				const Message& previous = m_messages[begin + count - 1];
+				const Message& next = m_messages[begin + count];
+				if ((next.address != first.address) || (next.port != first.port) || (next.size > first.size) ||
+					(previous.size != first.size) || (bytes + next.size > SEGMENTS_BYTES))
+					break;
+				bytes += next.size;
+				++count;
+			}
+		}
+
+		std::memset(&header.address, 0, sizeof(sockaddr_in));
+		header.address.sin_family	   = AF_INET;
+		header.address.sin_addr.s_addr = htonl(first.address.toInteger());
+		header.address.sin_port		   = htons(first.port);
+
+		const Message& last = m_messages[begin + count - 1];
+		header.vector.iov_base = const_cast<byte*>(m_data.data()) + first.offset;
+		header.vector.iov_len  = last.offset + last.size - first.offset;
+
+		std::memset(&message, 0, sizeof(msghdr));
+		message.msg_name	= &header.address;
+		message.msg_namelen = sizeof(sockaddr_in);
+		message.msg_iov		= &header.vector;
+		message.msg_iovlen	= 1;
+		if (count > 1) {
+			message.msg_control	   = header.control;
+			message.msg_controllen = sizeof(header.control);
+			cmsghdr* control = CMSG_FIRSTHDR(&message);
+			control->cmsg_level = SOL_UDP;
+			control->cmsg_type	= UDP_SEGMENT;
+			control->cmsg_len	= CMSG_LEN(sizeof(uint16));
+			const auto segment = static_cast<uint16>(first.size);
+			std::memcpy(CMSG_DATA(control), &segment, sizeof(segment));
+		}
+		return count;
+	}
+
+	inline bool OutputBatch::dropSegmentation(int error) {
+		//Ядро без UDP_SEGMENT или устройство без сегментации
+		if (!m_segmentation || ((error != EINVAL) && (error != EIO) && (error != ENOPROTOOPT) && (error != EOPNOTSUPP)))
+			return false;
+		m_segmentation = false;
+		return true;
+	}
+#endif
+
+	inline size_t OutputBatch::sendEach(NativeUdpSocket& socket, size_t begin, size_t end) {
+		size_t sent = 0;
+		for (; begin < end; ++begin) {
+			const Message& message = m_messages[begin];
+			++m_writes;
+			if (socket.send(m_data.data() + message.offset, message.size, message.address, message.port) == sf::Socket::Done)
+				++sent;
+		}
+		return sent;
+	}
+
+	inline void OutputBatch::coalesce() {
+		if (m_framed == 0)
+			return;
+
+		//Первый проход: сообщению назначается датаграмма, датаграмма адресату встаёт на место его первого сообщения
+		m_open.clear();
+		m_coalesced.clear();
+		m_placement.clear();
+		for (const Message& message : m_messages) {
+			if (!message.framed) {
+				m_placement.push_back(m_coalesced.size());
+				m_coalesced.push_back(message);
+				continue;
+			}
+
+			const uint64 key = (uint64(message.address.toInteger()) << 16) | message.port;
+			auto open = m_open.find(key);
+			if ((open == m_open.end()) || (m_coalesced[open->second].size + FRAME_HEADER + message.size > FRAMED_DATAGRAM)) {
+				open = m_open.insert_or_assign(key, m_coalesced.size()).first;
+				m_coalesced.push_back(Message{message.address, message.port, 0, 1, true});
+			}
+			m_coalesced[open->second].size += static_cast<uint32>(FRAME_HEADER + message.size);
+			m_placement.push_back(open->second);
+		}
+
+		//Второй проход: датаграммы лежат подряд, сообщения дописываются в свои
+		uint32 offset = 0;
+		for (Message& datagram : m_coalesced) {
+			datagram.offset = offset;
+			offset += datagram.size;
+		}
+		m_coalesced_data.resize(offset);
+		for (Message& datagram : m_coalesced) {
+			if (datagram.framed) {
+				m_coalesced_data[datagram.offset] = FRAMED;
+				//До конца прохода size - заполненная часть датаграммы
+				datagram.size = 1;
+			}
+		}
+		for (size_t i = 0; i < m_messages.size(); ++i) {
+			const Message& message = m_messages[i];
+			Message& datagram = m_coalesced[m_placement[i]];
+			byte* target = m_coalesced_data.data() + datagram.offset;
+			if (!datagram.framed) {
+				std::memcpy(target, m_data.data() + message.offset, message.size);
+				continue;
+			}
+
+			const auto length = static_cast<uint16>(message.size);
+			std::memcpy(target + datagram.size, &length, FRAME_HEADER);
+			std::memcpy(target + datagram.size + FRAME_HEADER, m_data.data() + message.offset, message.size);
+			datagram.size += static_cast<uint32>(FRAME_HEADER + message.size);
+		}
+
+		m_messages.swap(m_coalesced);
+		m_data.swap(m_coalesced_data);
+		m_framed = 0;
+	}
+
+	inline size_t OutputBatch::flush(NativeUdpSocket& socket) {
+		coalesce();
+		size_t begin = 0;
+		size_t sent = 0;
+#if defined(__linux__)
+		mmsghdr	messages[SEND_CHUNK];
+		Header	headers[SEND_CHUNK];
+		size_t	counts[SEND_CHUNK];
+
+		while (begin < m_messages.size()) {
+			size_t count = 0;
+			for (size_t position = begin; (count < SEND_CHUNK) && (position < m_messages.size()); ++count) {
+				std::memset(&messages[count], 0, sizeof(mmsghdr));
+				counts[count] = fill(position, messages[count].msg_hdr, headers[count]);
+				position += counts[count];
+			}
+
+			++m_writes;
+			const int result = sendmmsg(socket.getHandle(), messages, static_cast<unsigned>(count), 0);
+			if (result <= 0) {
+				if ((result < 0) && ((errno == EINTR) || dropSegmentation(errno)))
+					continue;
+				//Остаток уходит по одному, чтобы одно плохое сообщение не остановило пачку
+				break;
+			}
+			for (int i = 0; i < result; ++i) {
+				begin += counts[i];
+				sent  += counts[i];
+			}
+		}
+#endif
+		sent += sendEach(socket, begin, m_messages.size());
+		clear();
+		return sent;
+	}
+
+#if defined(__linux__)
+	inline size_t OutputBatch::flush(NativeUdpSocket& socket, Uring& ring) {
+		if (!ring.isOpen())
+			return flush(socket);
+		coalesce();
+
+		msghdr	messages[SEND_CHUNK];
+		Header	headers[SEND_CHUNK];
+		size_t	counts[SEND_CHUNK];
+		int		results[SEND_CHUNK];
+
+		const size_t chunk = std::min<size_t>(SEND_CHUNK, ring.capacity());
+		size_t sent = 0;
+		size_t begin = 0;
+		while (begin < m_messages.size()) {
+			size_t count = 0;
+			for (size_t position = begin; (count < chunk) && (position < m_messages.size()); ++count) {
+				//Очередь заявок не освободилась или вызов ядра не прошёл: пачка уходит с тем, что уже подготовлено
+				io_uring_sqe* sqe = ring.prepare();
+				if (sqe == nullptr)
+					break;
+				counts[count] = fill(position, messages[count], headers[count]);
+				position += counts[count];
+
+				sqe->opcode	   = IORING_OP_SENDMSG;
+				sqe->fd		   = socket.getHandle();
+				sqe->addr	   = reinterpret_cast<uint64>(&messages[count]);
+				sqe->len	   = 1;
+				sqe->user_data = count + 1;
+			}
+			//Кольцо не приняло ни одной заявки: как при ошибке, остаток уходит через сокет
+			if (count == 0) {
+				ring.close();
+				break;
+			}
+
+			//Заявки и ожидание завершений - один вызов, заголовки на стеке живут до конца пачки
+			++m_writes;
+			size_t done = 0;
+			int result = ring.enter(static_cast<unsigned>(count), std::chrono::milliseconds(-1));
+			while (done < count) {
+				if ((result < 0) && (result != -EINTR)) {
+					ring.close();
+					break;
+				}
+				io_uring_cqe* cqe = ring.peek();
+				if (cqe == nullptr) {
+					++m_writes;
+					result = ring.enter(static_cast<unsigned>(count - done), std::chrono::milliseconds(-1));
+					continue;
+				}
+				results[cqe->user_data - 1] = cqe->res;
+				ring.pop();
+				++done;
+			}
+			if (done < count)
+				break;
+
+			for (size_t i = 0; i < count; ++i) {
+				if (results[i] >= 0) {
+					sent += counts[i];
+				} else if (counts[i] > 1) {
+					//Ядро не приняло серию: она и всё дальше уходит без сегментации
+					dropSegmentation(-results[i]);
+					sent += sendEach(socket, begin, begin + counts[i]);
+				}
+				begin += counts[i];
+			}
+		}
+
+		//Кольцо закрыто из-за ошибки: оставшиеся сообщения уходят через сокет
+		sent += sendEach(socket, begin, m_messages.size());
+		clear();
+		return sent;
+	}
+#endif
+
+	inline void OutputBatch::clear() {
+		m_data.clear();
+		m_messages.clear();
+		m_framed = 0;
+	}
+}
@@ -3,7 +3,8 @@
 #include <SFML/Network.hpp>
 #include <assert.h>
 #include <memory.h>
-#include <DSFML\Aliases.h>
+#include <cstring>
+#include <DSFML/Aliases.h>
 
 DEMONORIUM_ALIASES;
 DEMONORIUM_LOCAL_USE(demonorium::memory::memory_declarations);
@@ -12,8 +13,8 @@ DEMONORIUM_LOCAL_USE(demonorium::memory::memory_declarations);
 namespace demonorium
 {
 	/**
-	 * \brief        ,     
-	 *    sf::IpAddress
+	 * \brief Класс предназначен для представления отправляемых и получаемых данных, умеет читать данные разных типов
+	 * Имеется перегрузка для sf::IpAddress
 	 */
 	class Packet {
 		void*	m_memory;
@@ -23,49 +24,49 @@ namespace demonorium
 		void*	m_io_pos;
 		size_t	m_io_offset;
 	public:
-		//    ,          
+		//Конструирует пакет на основе данных, пакет содержит УКАЗАТЕЛЬ на эти данные И НЕУПРАВЛЯЕТ их жизнью
 		Packet(void* received, size_t size);
-		//      .     
+		//Конструирует пакет с хранилищем данных заданного размера. Хранилище разрушается при разрушении пакета
 		Packet(size_t size);
 		~Packet();
 
-		//   
+		//Указатель на начало хранилища
 		void* data();
-		// 
+		//Размер хранилища
 		size_t rawSize();
-		//     
+		// Количество считанных или записанных данных
 		size_t size() const;
 
-		//  /
+		//Сброс состояния чтения/записи
 		void resetIO();
 
-		//   count
+		//Считать массив размера count
 		template<class T>
 		const T* read(size_t count = 1);
 
-		//    len
+		//Считать сырую память размера len
 		const void* read(size_t len = 0);
 
-		//    1 2 3 4 
+		//Записать адрес в порядке 1 2 3 4 байты
 		void write(sf::IpAddress address);
 
-		// 
+		//Записать объект
 		template<class T>
 		void write(const T& object);
 
-		//  
+		//Записать массив объектов
 		template<class T>
 		void write(const T* object, size_t count = 1);
 
-		//      
+		//Достаточно ли памяти для размещения массива объектов
 		template<class T>
 		bool enoughMemory(size_t count = 1) const;
 
-		//      .
+		//Достаточно ли памяти для размещения последовательности объектов.
 		template<class T, class ... Args>
 		bool enoughMemoryMany(size_t current = 0) const;
 
-		//   
+		//Свободное место в пакете
 		size_t availableSpace() const;
 	};
 
@@ -100,21 +101,9 @@ namespace demonorium
 		return (m_io_offset + sizeof(T)*count) <= m_size;
 	}
 
-	namespace
-	{
-		template<class T, class ... Args>
-		size_t sum(T a, Args ... args) {
-			return a + sum(args...);
-		}
-
-		size_t sum() {
-			return 0;
-		}
-	}
-	
 	template <class T, class ... Args>
 	bool Packet::enoughMemoryMany(size_t current) const {
-		return (current + sizeof(T) + sum(sizeof(Args) ...)) <= m_size;
+		return (current + sizeof(T) + (sizeof(Args) + ... + 0)) <= m_size;
 	}
 
 
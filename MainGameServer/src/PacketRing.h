@@ -0,0 +1,179 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <new>
+
+#include <SFML/Network.hpp>
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	//Заголовок принятого пакета, за ним в памяти лежат size байт данных
+	struct PacketPrefix {
+		size_t size;
+		sf::IpAddress ip;
+		//Порт отправителя, 0 - неизвестен
+		sf::Uint16 port;
+
+		PacketPrefix(size_t size, const sf::IpAddress& ip, sf::Uint16 port = 0)
+			: size(size),
+			  ip(ip),
+			  port(port) {
+		}
+	};
+
+
+	/**
+	 * \brief Кольцо пакетов переменной длины для одного писателя и одного читателя, без блокировок.
+	 * Запись - PacketPrefix и данные, занимает RECORD_ALIGN-кратное число байт: однобайтовый пакет
+	 * занимает 32 байта, а не блок под самый большой пакет. Все записи выровнены под PacketPrefix.
+	 * Запись, не помещающаяся до конца памяти, начинается с начала, хвост помечается заголовком WRAP.
+	 */
+	class PacketRing {
+	public:
+		static constexpr size_t RECORD_ALIGN = alignof(std::max_align_t);
+	private:
+		static constexpr size_t WRAP = std::numeric_limits<size_t>::max();
+
+		byte*	m_data;
+		size_t	m_capacity;
+		size_t	m_max_packet;
+		//Байт записано и прочитано с начала работы: хвост двигает писатель, голову - читатель
+		std::atomic<uint64> m_tail;
+		std::atomic<uint64> m_head;
+		//Размер записи, выданной write, с пропуском до начала памяти
+		size_t	m_reserved;
+		//Размер записи, выданной read: она освобождается следующим read
+		size_t	m_release;
+
+		static size_t recordSize(size_t size);
+		//Поместится ли запись need байт после tail, pad - пропуск до начала памяти
+		bool fits(size_t need, uint64 tail, size_t& pad) const;
+	public:
+		/**
+		 * \param capacity - байт памяти, не меньше двух самых больших записей
+		 * \param maxPacket - самый большой пакет, больший write не примет
+		 */
+		PacketRing(size_t capacity, size_t maxPacket);
+		~PacketRing();
+		PacketRing(const PacketRing&) = delete;
+		PacketRing& operator =(const PacketRing&) = delete;
+
+		/**
+		 * \brief Память под заголовок и size байт данных, вызывается только писателем.
+		 * Запись видна читателю после validWrite, без него следующий write выдаст ту же память
+		 * \return nullptr, если места нет или пакет больше maxPacket
+		 */
+		void* write(size_t size);
+		void validWrite();
+		//Нет места под самый большой пакет, вызывается только писателем
+		bool full() const;
+
+		/**
+		 * \brief Следующая запись, вызывается только читателем.
+		 * \return Указатель на PacketPrefix, действителен до следующего read; nullptr если записей нет
+		 */
+		void* read();
+		//Нечего читать, вызывается только читателем
+		bool empty() const;
+
+		size_t maxPacket() const;
+		size_t capacity() const;
+	};
+
+
+	inline size_t PacketRing::recordSize(size_t size) {
+		return (sizeof(PacketPrefix) + size + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+	}
+
+	inline bool PacketRing::fits(size_t need, uint64 tail, size_t& pad) const {
+		const uint64 head = m_head.load(std::memory_order_acquire);
+		const size_t offset = static_cast<size_t>(tail % m_capacity);
+		pad = (offset + need > m_capacity) ? m_capacity - offset : 0;
+		return tail + pad + need - head <= m_capacity;
+	}
+
+	inline PacketRing::PacketRing(size_t capacity, size_t maxPacket):
+		m_data(nullptr),
+		m_capacity(std::max((capacity + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN, 2 * recordSize(maxPacket))),
+		m_max_packet(maxPacket),
+		m_tail(0), m_head(0),
+		m_reserved(0), m_release(0) {
+		m_data = static_cast<byte*>(::operator new(m_capacity, std::align_val_t(RECORD_ALIGN)));
+	}
+
+	inline PacketRing::~PacketRing() {
+		::operator delete(m_data, std::align_val_t(RECORD_ALIGN));
+	}
+
+	inline void* PacketRing::write(size_t size) {
+		if (size > m_max_packet)
+			return nullptr;
+
+		const size_t need = recordSize(size);
+		const uint64 tail = m_tail.load(std::memory_order_relaxed);
+		size_t pad;
+		if (!fits(need, tail, pad))
+			return nullptr;
+
+		const size_t offset = static_cast<size_t>(tail % m_capacity);
+		if (pad != 0)
+			new (m_data + offset) PacketPrefix(WRAP, sf::IpAddress());
+		m_reserved = pad + need;
+		return m_data + (offset + pad) % m_capacity;
+	}
+
+	inline void PacketRing::validWrite() {
+		m_tail.store(m_tail.load(std::memory_order_relaxed) + m_reserved, std::memory_order_release);
+		m_reserved = 0;
+	}
+
+	inline bool PacketRing::full() const {
+		size_t pad;
+		return !fits(recordSize(m_max_packet), m_tail.load(std::memory_order_relaxed), pad);
+	}
+
+	inline void* PacketRing::read() {
+		uint64 head = m_head.load(std::memory_order_relaxed);
+		if (m_release != 0) {
+			head += m_release;
+			m_release = 0;
+			m_head.store(head, std::memory_order_release);
+		}
+
+		const uint64 tail = m_tail.load(std::memory_order_acquire);
+		if (head == tail)
+			return nullptr;
+
+		byte* record = m_data + head % m_capacity;
+		if (static_cast<PacketPrefix*>(static_cast<void*>(record))->size == WRAP) {
+			head += m_capacity - head % m_capacity;
+			m_head.store(head, std::memory_order_release);
+			if (head == tail)
+				return nullptr;
+			record = m_data;
+		}
+
+		m_release = recordSize(static_cast<PacketPrefix*>(static_cast<void*>(record))->size);
+		return record;
+	}
+
+	inline bool PacketRing::empty() const {
+		return m_head.load(std::memory_order_relaxed) + m_release == m_tail.load(std::memory_order_acquire);
+	}
+
+	inline size_t PacketRing::maxPacket() const {
+		return m_max_packet;
+	}
+
+	inline size_t PacketRing::capacity() const {
+		return m_capacity;
+	}
+}
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <type_traits>
 #include <SFML/Network.hpp>
 
+#include "Clock.h"
 #include "Log.h"
+#include "Name.h"
+#include "SessionTable.h"
+#include "Reliable.h"
 
 
 namespace demonorium
@@ -14,22 +22,59 @@ namespace demonorium
 		using namespace std::chrono_literals;
 	}
 
+	//Моменты монотонного времени сервера, см. Clock
 	struct PlayerTimeInfo {
-		using clock = std::chrono::system_clock;
-		using point = clock::time_point;
-		using delay = clock::duration;
-		
-		point last_request;
-		point last_warning;
-		point die_time;
+		tick last_request;
+		tick last_warning;
+		tick die_time;
 
 		void set_default();
 		PlayerTimeInfo();
 	};
 
 
+	/**
+	 * \brief Оценка задержки игрока по парам запрос-ответ: RESP_CHECK - ACTIVE и READY_REQ - READY.
+	 * Сглаженная задержка и разброс считаются как RTO в TCP. Каждый повтор запроса удваивает интервал,
+	 * ответ на повторённый запрос в оценку не входит: неизвестно, на какой он (алгоритм Карна).
+	 * Удвоение снимает только однозначный ответ, поэтому игрок с задержкой больше интервала всё равно будет измерен
+	 */
+	struct Heartbeat {
+		using delay = Clock::delay;
+
+		//Самая большая оценка RTO и самое большое удвоение интервала повтора
+		static constexpr delay RTO_LIMIT   = delay(3000);
+		static constexpr byte  MAX_BACKOFF = 3;
+
+		//Миллисекунды, srtt < 0 - замеров ещё не было
+		int32	srtt;
+		int32	rttvar;
+		//Момент первого неотвеченного запроса
+		tick	probe;
+		//Неотвеченных запросов подряд
+		byte	unanswered;
+		//Удвоений интервала повтора
+		byte	backoff;
+
+		//Отправлен запрос, на который игрок должен ответить
+		void sent(tick current_time);
+		//Пришёл ответ на запрос
+		void answered(tick current_time);
+		//Интервал до следующего запроса: не меньше base и RTO, с удвоениями
+		delay retry(delay base) const;
+		//Запас к срокам смерти от бездействия: игрок с большой задержкой отвечает позже
+		delay grace() const;
+		//Забыть неотвеченные запросы и удвоения интервала. Оценка RTT - свойство сети игрока, она сохраняется
+		void restart();
+
+		void set_default();
+		Heartbeat();
+	};
+
 	struct Life {
 		sf::IpAddress	killer;
+		//Сессия убившего: по ней убийца находится без поиска, IP остаётся для истории и файла состояния
+		SessionId		killer_session;
 		bool			alive;
 		bool			ready;
 		bool			killed;
@@ -37,43 +82,73 @@ namespace demonorium
 		void set_default();
 		Life();
 	};
+
+	//Всё состояние игрока, кроме лога, копируется побайтно
+	static_assert(std::is_trivially_copyable_v<PlayerTimeInfo> && std::is_trivially_copyable_v<Life> &&
+		std::is_trivially_copyable_v<Heartbeat>);
 	
 	class Player {
-		std::string		m_name;
+		Name			m_name;
 		PlayerTimeInfo	m_time;
 		Life			m_life;
+		//Оценка задержки переживает сброс игры: она про сеть игрока, а не про матч
+		Heartbeat		m_heartbeat;
 		sf::Uint16		m_port;
 		size_t			m_kill_count;
+		SessionId		m_session;
+		//Игрок получает изменения состава игры без запросов TABLE
+		bool			m_subscribed;
+		//Игрок присылал датаграммы с кадрами: ответы ему склеиваются, см. Framing.h
+		bool			m_framed;
+		//Неподтверждённые управляющие сообщения игроку
+		ReliableChannel	m_reliable;
 		Log				m_log;
 	public:
-		Player(sf::Uint16 port, std::string name, sf::IpAddress ip);
+		//Лог игрока открывается при первой записи: регистрация не открывает файлов
+		Player(sf::Uint16 port, const Name& name, sf::IpAddress ip);
+		//Игрок из файла состояния
+		Player(sf::Uint16 port, const Name& name, sf::IpAddress ip, const Life& life, size_t killCount, tick dieTime);
 		~Player() = default;
 
-		Player(Player&& other);
+		Player(Player&&) = default;
 		Player& operator =(Player&&) = default;
 
-		//    
+		//Игрок готов к началу игры
 		bool isReady() const;
-		//   
+		//Ставит игроку флаг готовности
 		void ready();
-		//     
+		//Сбросить состояние игрока на начало игры
 		void setDefaultState();
 
-		// 1   
+		//Добавить 1 к счётчику убийств
 		void incKillCounter();
-		// 
+		//Счётчик убийств
 		auto getKillCounter() const;
-		//IP 
+		//IP убившего
 		const auto& getKillerIP() const;
+		//Сессия убившего, NO_SESSION если убийца неизвестен или игрок погиб сам
+		SessionId getKillerSession() const;
 		
-		void setName(std::string newName);
+		void setName(const Name& newName);
 		void setPort(sf::Uint16 port);
+		//Сессия, выданная игроку при регистрации
+		void setSession(SessionId session);
+		SessionId getSession() const;
+		//Подписка на изменения состава игры, действует до удаления игрока
+		void subscribe();
+		bool isSubscribed() const;
+		//Игрок понимает датаграммы с кадрами, отметка не снимается
+		void setFramed();
+		bool isFramed() const;
+		//Канал надёжной доставки, включается подтверждением игрока
+		ReliableChannel& reliable();
+		const ReliableChannel& reliable() const;
 
 		sf::Uint16 getPort() const;
-		const std::string& getName() const;
+		const Name& getName() const;
 		
-		const chrono::system_clock::time_point& getDieTime() const;
-		void kill(sf::IpAddress kiAddress);
+		tick getDieTime() const;
+		void kill(sf::IpAddress kiAddress, SessionId kiSession = NO_SESSION);
 		void acceptKill();
 		bool alive() const;
 		bool on_death() const;
@@ -82,25 +157,84 @@ namespace demonorium
 		
 		
 		void updateLastRequest();
-		PlayerTimeInfo::point getLastRequest() const;
+		tick getLastRequest() const;
 
 		void updateLastWarning();
-		PlayerTimeInfo::point getLastWarning() const;
+		tick getLastWarning() const;
+
+		//Игроку отправлен RESP_CHECK или READY_REQ
+		void probe();
+		//Игрок ответил ACTIVE или READY
+		void answerProbe();
+		const Heartbeat& getHeartbeat() const;
 	};
 
 
 	inline void PlayerTimeInfo::set_default() {
-		last_request = clock::now();
+		last_request = Clock::now();
 		last_warning = last_request;
-		die_time = point();
+		die_time = 0;
 	}
 
 	inline PlayerTimeInfo::PlayerTimeInfo() {
 		set_default();
 	}
 
+	inline void Heartbeat::sent(tick current_time) {
+		if (unanswered == 0)
+			probe = current_time;
+		else if (backoff < MAX_BACKOFF)
+			++backoff;
+		if (unanswered != std::numeric_limits<byte>::max())
+			++unanswered;
+	}
+
+	inline void Heartbeat::answered(tick current_time) {
+		//После повторов не ясно, на какой запрос пришёл ответ
+		if (unanswered == 1) {
+			backoff = 0;
+			const int32 sample = std::max<int32>(Clock::between(probe, current_time).count(), 0);
+			if (srtt < 0) {
+				srtt   = sample;
+				rttvar = sample / 2;
+			} else {
+				rttvar = (3 * rttvar + std::abs(srtt - sample)) / 4;
+				srtt   = (7 * srtt + sample) / 8;
+			}
+		}
+		unanswered = 0;
+	}
+
+	inline Heartbeat::delay Heartbeat::retry(delay base) const {
+		return std::max(base, grace()) * (1 << backoff);
+	}
+
+	inline Heartbeat::delay Heartbeat::grace() const {
+		if (srtt < 0)
+			return delay(0);
+		return std::min(delay(srtt + 4 * rttvar), RTO_LIMIT);
+	}
+
+	inline void Heartbeat::restart() {
+		unanswered = 0;
+		backoff	   = 0;
+	}
+
+	inline void Heartbeat::set_default() {
+		srtt	   = -1;
+		rttvar	   = 0;
+		probe	   = 0;
+		unanswered = 0;
+		backoff	   = 0;
+	}
+
+	inline Heartbeat::Heartbeat() {
+		set_default();
+	}
+
 	inline void Life::set_default() {
 		killer = sf::IpAddress(0, 0, 0, 0);
+		killer_session = NO_SESSION;
 		alive = true;
 		ready = false;
 		killed = false;
@@ -110,32 +244,29 @@ namespace demonorium
 		set_default();
 	}
 
-	inline Player::Player(sf::Uint16 port, std::string name, sf::IpAddress logip):
-		m_port(port), m_name(std::move(name)), m_kill_count(0) {
-		m_log.open("player_" + logip.toString() + ".log");
-		
-		m_log.write_important("    : ", name, "; port: ", port);
+	inline Player::Player(sf::Uint16 port, const Name& name, sf::IpAddress logip):
+		m_name(name), m_port(port), m_kill_count(0), m_session(NO_SESSION), m_subscribed(false), m_framed(false) {
+		m_log.openLater("player_", logip.toInteger());
 	}
 
-	inline Player::Player(Player&& other) :
-		m_log(std::move(other.m_log)),
-		m_name(std::move(other.m_name)),
-		m_port(std::move(other.m_port)),
-		m_kill_count(std::move(other.m_kill_count)),
-		m_life(other.m_life),
-		m_time(other.m_time) {
+	inline Player::Player(sf::Uint16 port, const Name& name, sf::IpAddress logip, const Life& life, size_t killCount, tick dieTime):
+		m_name(name), m_life(life), m_port(port), m_kill_count(killCount), m_session(NO_SESSION), m_subscribed(false), m_framed(false) {
+		m_time.die_time = dieTime;
+		m_log.openLater("player_", logip.toInteger());
 	}
 
 	inline void Player::setDefaultState() {
 		m_time.set_default();
+		//Повторы прошлой игры не должны растягивать первые запросы новой
+		m_heartbeat.restart();
 		m_life.set_default();
 		m_kill_count = 0;
 
-		m_log.write_important("  ");
+		m_log.write_important("Сброс внутренного состояния");
 	}
 
 	inline void Player::incKillCounter() {
-		m_log.write(" ");
+		m_log.write("Регистрация убийства");
 		++m_kill_count;
 	}
 
@@ -147,42 +278,81 @@ namespace demonorium
 		return m_life.killer;
 	}
 
-	inline void Player::setName(std::string newName) {
+	inline SessionId Player::getKillerSession() const {
+		return m_life.killer_session;
+	}
+
+	inline void Player::setName(const Name& newName) {
 		if (m_name != newName) {
-			m_log.write(" : \"", m_name, "\" -> \"", newName, '"');
-			m_name = std::move(newName);
+			m_log.write("Смена имени: \"", m_name, "\" -> \"", newName, '"');
+			m_name = newName;
 		}
 	}
 
 	inline void Player::setPort(sf::Uint16 port) {
 		if (m_port != port) {
-			m_log.write(" : \"", m_port, "\" -> \"", port, '"');
+			m_log.write("Смена порта: \"", m_port, "\" -> \"", port, '"');
 			m_port = port;
 		}
 	}
 
+	inline void Player::setSession(SessionId session) {
+		m_session = session;
+	}
+
+	inline SessionId Player::getSession() const {
+		return m_session;
+	}
+
+	inline void Player::subscribe() {
+		if (!m_subscribed)
+			m_log.write("Подписка на состав игры");
+		m_subscribed = true;
+	}
+
+	inline bool Player::isSubscribed() const {
+		return m_subscribed;
+	}
+
+	inline void Player::setFramed() {
+		m_framed = true;
+	}
+
+	inline bool Player::isFramed() const {
+		return m_framed;
+	}
+
+	inline ReliableChannel& Player::reliable() {
+		return m_reliable;
+	}
+
+	inline const ReliableChannel& Player::reliable() const {
+		return m_reliable;
+	}
+
 	inline sf::Uint16 Player::getPort() const {
 		return m_port;
 	}
 
-	inline const std::string& Player::getName() const {
+	inline const Name& Player::getName() const {
 		return m_name;
 	}
 
-	inline const chrono::system_clock::time_point& Player::getDieTime() const {
+	inline tick Player::getDieTime() const {
 		return m_time.die_time;
 	}
 
-	inline void Player::kill(sf::IpAddress kiAddress) {
-		m_log.write("  :  ", kiAddress.toString());
+	inline void Player::kill(sf::IpAddress kiAddress, SessionId kiSession) {
+		m_log.write("Зафиксирована попытка убийства: игроком ", kiAddress.toString());
 
-		m_time.die_time = PlayerTimeInfo::clock::now();
+		m_time.die_time = Clock::now();
 		m_life.killer = kiAddress;
+		m_life.killer_session = kiSession;
 		m_life.killed = true;
 	}
 
 	inline void Player::acceptKill() {
-		m_log.write_important("!");
+		m_log.write_important("СМЕРТЬ!");
 		m_life.alive = false;
 	}
 
@@ -195,35 +365,47 @@ namespace demonorium
 	}
 
 	inline void Player::reset_death() {
-		m_log.write("  ");
+		m_log.write("Попытка убийства отменена");
 		m_life.killed = false;
 	}
 
 	inline void Player::resurrection() {
-		m_log.write("");
+		m_log.write("Воскрешение");
 		m_life.alive = true;
 	}
 
 	inline void Player::updateLastRequest() {
 		if (!on_death())
 			updateLastWarning();
-		m_time.last_request = PlayerTimeInfo::clock::now();
+		m_time.last_request = Clock::now();
 	}
 
-	inline PlayerTimeInfo::point Player::getLastRequest() const {
+	inline tick Player::getLastRequest() const {
 		return m_time.last_request;
 	}
 
 	inline void Player::updateLastWarning() {
-		m_time.last_warning = PlayerTimeInfo::clock::now();
+		m_time.last_warning = Clock::now();
 	}
 
-	inline PlayerTimeInfo::point Player::getLastWarning() const {
+	inline tick Player::getLastWarning() const {
 		return m_time.last_warning;
 	}
 
+	inline void Player::probe() {
+		m_heartbeat.sent(Clock::now());
+	}
+
+	inline void Player::answerProbe() {
+		m_heartbeat.answered(Clock::now());
+	}
+
+	inline const Heartbeat& Player::getHeartbeat() const {
+		return m_heartbeat;
+	}
+
 	inline void Player::ready() {
-		m_log.write("   ");
+		m_log.write("Игрок готов к игре");
 		m_life.ready = true;
 	}
 
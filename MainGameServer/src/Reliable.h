@@ -0,0 +1,191 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "Clock.h"
+#include "SessionTable.h"
+#include "TimerWheel.h"
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Надёжная доставка управляющих сообщений одному игроку.
+	 * Сообщение уходит обёрнутым: код RELIABLE, номер uint32, исходное сообщение. Игрок подтверждает
+	 * сообщением ACK: номер, до которого получено всё, и маска 32 следующих номеров - выборочное подтверждение.
+	 * Канал включается первым ACK игрока и продолжает нумерацию с его номера, так что после перезапуска
+	 * сервера номера не начинаются заново под носом у клиента. Неподтверждённые сообщения хранятся в канале
+	 * по порядку номеров, повторы по таймеру ведёт RetransmitQueue.
+	 */
+	class ReliableChannel {
+	public:
+		//Самое длинное сообщение, которое канал хранит для повтора
+		static constexpr size_t PAYLOAD = 16;
+		//Неподтверждённых сообщений не больше: при переполнении самое старое забывается
+		static constexpr size_t LIMIT = 64;
+
+		struct Message {
+			uint32	sequence;
+			byte	size;
+			//Отправок сверх первой
+			byte	retries;
+			byte	data[PAYLOAD];
+		};
+	private:
+		std::vector<Message> m_outstanding;
+		uint32	m_next;
+		bool	m_enabled;
+	public:
+		ReliableChannel();
+
+		//Включить канал: следующий номер - acknowledged + 1
+		void enable(uint32 acknowledged);
+		bool enabled() const;
+
+		/**
+		 * \brief Запомнить сообщение для повтора и выдать ему номер.
+		 * \return nullptr, если канал выключен или сообщение длиннее PAYLOAD
+		 */
+		Message* push(const void* data, size_t size);
+		//Подтверждение игрока, возвращает число подтверждённых сообщений
+		size_t acknowledge(uint32 cumulative, uint32 mask);
+		//Неподтверждённое сообщение с номером sequence или nullptr
+		Message* find(uint32 sequence);
+		//Забыть сообщение без подтверждения
+		void drop(uint32 sequence);
+
+		size_t size() const;
+	};
+
+
+	/**
+	 * \brief Очередь повторов надёжных сообщений на колесе таймеров.
+	 * Таймер хранит сессию и номер: игрок находится через таблицу сессий, ушедший игрок просто не находится.
+	 */
+	class RetransmitQueue {
+	public:
+		using delay = Clock::delay;
+
+		//Точность таймеров
+		static constexpr delay TICK = delay(10);
+	private:
+		struct Entry {
+			SessionId	session;
+			uint32		sequence;
+		};
+
+		TimerWheel<Entry> m_timers;
+		//Последний момент advance и миллисекунды от создания: 32-битные моменты копятся в 64 бита
+		tick	m_last;
+		uint64	m_elapsed;
+	public:
+		explicit RetransmitQueue(tick now, size_t slots = 256);
+
+		//Повторить сообщение sequence сессии session через after
+		void schedule(SessionId session, uint32 sequence, delay after);
+		/**
+		 * \brief Продвинуть время
+		 * \param callback вызывается как callback(session, sequence) для каждого наступившего повтора
+		 */
+		template<class F>
+		void advance(tick now, F&& callback);
+		void clear();
+
+		size_t size() const;
+	};
+
+
+	inline ReliableChannel::ReliableChannel():
+		m_next(1), m_enabled(false) {
+	}
+
+	inline void ReliableChannel::enable(uint32 acknowledged) {
+		m_next	  = acknowledged + 1;
+		m_enabled = true;
+	}
+
+	inline bool ReliableChannel::enabled() const {
+		return m_enabled;
+	}
+
+	inline ReliableChannel::Message* ReliableChannel::push(const void* data, size_t size) {
+		if (!m_enabled || (size > PAYLOAD))
+			return nullptr;
+		if (m_outstanding.size() == LIMIT)
+			m_outstanding.erase(m_outstanding.begin());
+
+		Message message;
+		message.sequence = m_next++;
+		message.size	 = static_cast<byte>(size);
+		message.retries	 = 0;
+		std::memcpy(message.data, data, size);
+		m_outstanding.push_back(message);
+		return &m_outstanding.back();
+	}
+
+	inline size_t ReliableChannel::acknowledge(uint32 cumulative, uint32 mask) {
+		const size_t before = m_outstanding.size();
+		//Номера сравниваются разностью: нумерация может перейти через 2^32
+		m_outstanding.erase(std::remove_if(m_outstanding.begin(), m_outstanding.end(), [cumulative, mask](const Message& message) {
+			const auto distance = static_cast<int32>(message.sequence - cumulative);
+			return (distance <= 0) || ((distance <= 32) && ((mask >> (distance - 1)) & 1));
+		}), m_outstanding.end());
+		return before - m_outstanding.size();
+	}
+
+	inline ReliableChannel::Message* ReliableChannel::find(uint32 sequence) {
+		for (auto& message : m_outstanding)
+			if (message.sequence == sequence)
+				return &message;
+		return nullptr;
+	}
+
+	inline void ReliableChannel::drop(uint32 sequence) {
+		m_outstanding.erase(std::remove_if(m_outstanding.begin(), m_outstanding.end(), [sequence](const Message& message) {
+			return message.sequence == sequence;
+		}), m_outstanding.end());
+	}
+
+	inline size_t ReliableChannel::size() const {
+		return m_outstanding.size();
+	}
+
+
+	inline RetransmitQueue::RetransmitQueue(tick now, size_t slots):
+		m_timers(slots), m_last(now), m_elapsed(0) {
+	}
+
+	inline void RetransmitQueue::schedule(SessionId session, uint32 sequence, delay after) {
+		//Округление вверх: повтор не должен уйти раньше срока
+		const uint64 ticks = (static_cast<uint64>(std::max<int64>(after.count(), 0)) + TICK.count() - 1) / TICK.count();
+		//Между кадрами поток сервера мог спать: срок считается от текущего момента, а не от последнего advance
+		const uint64 elapsed = m_elapsed + static_cast<uint64>(std::max<int32>(Clock::between(m_last, Clock::now()).count(), 0));
+		m_timers.schedule(elapsed / TICK.count() + std::max<uint64>(ticks, 1), Entry{session, sequence});
+	}
+
+	template <class F>
+	void RetransmitQueue::advance(tick now, F&& callback) {
+		const auto passed = Clock::between(m_last, now).count();
+		if (passed > 0) {
+			m_elapsed += static_cast<uint64>(passed);
+			m_last = now;
+		}
+		m_timers.advance(m_elapsed / TICK.count(), [&callback](const Entry& entry) {
+			callback(entry.session, entry.sequence);
+		});
+	}
+
+	inline void RetransmitQueue::clear() {
+		m_timers.clear();
+	}
+
+	inline size_t RetransmitQueue::size() const {
+		return m_timers.size();
+	}
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "Capture.h"
+#include "Clock.h"
+#include "Server.h"
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	struct ReplayStats {
+		//Датаграмм, переданных серверу
+		uint64	datagrams = 0;
+		//Кадров сервера
+		uint64	frames	  = 0;
+		//Ответов, которые сервер отправил бы
+		uint64	responses = 0;
+		//Длительность захвата в виртуальном времени
+		Clock::delay duration = Clock::delay(0);
+		//Настоящее время воспроизведения без остановки сервера
+		std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::duration(0);
+	};
+
+
+	/**
+	 * \brief Воспроизведение захвата: датаграммы из файла идут в полосы приёма сервера и разбираются обычными кадрами.
+	 * Кадры выполняются в вызывающем потоке, поток сервера и сеть не запускаются, ответы только считаются.
+	 * Время сервера - виртуальное (ручной режим Clock): кадр видит момент записи датаграммы, а между датаграммами
+	 * время идёт шагами FRAME_STEP, так что таймеры сервера срабатывают как при записи.
+	 * Одинаковый захват даёт одинаковую последовательность кадров, поэтому прогоны разных сборок сравнимы.
+	 */
+	class CaptureReplay {
+		//Самый длинный шаг виртуального времени между кадрами: точность таймеров FlowScheduler и RetransmitQueue
+		static constexpr Clock::delay FRAME_STEP = Clock::delay(10);
+
+		Server&			m_server;
+		CaptureReader	m_reader;
+
+		//Кадр сервера в момент now, с ожиданием настоящего времени при воспроизведении с заданной скоростью
+		void frame(tick now, tick origin, std::chrono::steady_clock::time_point start, double speed, ReplayStats& stats);
+	public:
+		//Сервер не должен быть запущен: воспроизведение само выполняет его инициализацию и кадры
+		explicit CaptureReplay(Server& server);
+
+		//Открыть захват, false если файла нет или это не захват
+		bool open(const std::string& path);
+
+		/**
+		 * \brief Воспроизвести захват от начала до конца.
+		 * \param speed 1 - в темпе записи, 10 - в десять раз быстрее, 0 - без ожидания, насколько быстро разберёт сервер
+		 * \return статистика прогона, пустая если захват не открыт или поток сервера запущен
+		 */
+		ReplayStats run(double speed = 0.0);
+	};
+
+
+	inline CaptureReplay::CaptureReplay(Server& server):
+		m_server(server) {
+	}
+
+	inline bool CaptureReplay::open(const std::string& path) {
+		return m_reader.open(path);
+	}
+
+	inline void CaptureReplay::frame(tick now, tick origin, std::chrono::steady_clock::time_point start, double speed, ReplayStats& stats) {
+		if (speed > 0.0) {
+			const auto offset = std::chrono::duration<double, std::milli>(Clock::between(origin, now).count() / speed);
+			std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset));
+		}
+		Clock::set(now);
+		m_server.onFrame();
+		++stats.frames;
+	}
+
+	inline ReplayStats CaptureReplay::run(double speed) {
+		ReplayStats stats;
+		if (m_server.containsThread())
+			return stats;
+		m_reader.rewind();
+		CapturedDatagram datagram;
+		if (!m_reader.next(datagram))
+			return stats;
+
+		//Виртуальное время продолжает настоящее: моменты, уже выданные Clock, остаются в прошлом
+		const tick origin = Clock::update();
+		Clock::manual(true);
+		m_server.m_replaying = true;
+		const uint64 sent_before = m_server.m_sent.load();
+		const auto start = std::chrono::steady_clock::now();
+		m_server.onInit();
+
+		tick now = origin;
+		bool pending = true;
+		while (pending) {
+			const tick due = Clock::after(origin, Clock::delay(datagram.time));
+			//Таймеры между датаграммами: пустые кадры не реже FRAME_STEP
+			while (Clock::between(now, due) > FRAME_STEP) {
+				now = Clock::after(now, FRAME_STEP);
+				frame(now, origin, start, speed, stats);
+			}
+			now = due;
+			Clock::set(now);
+
+			//Датаграммы одной миллисекунды разбираются одним кадром, как пачка одного чтения
+			while (pending && (datagram.time == static_cast<uint32>(Clock::between(origin, now).count()))) {
+				if (!m_server.m_input_thread.inject(datagram.address, datagram.port, datagram.data, datagram.size)) {
+					frame(now, origin, start, speed, stats);
+					continue;
+				}
+				++stats.datagrams;
+				pending = m_reader.next(datagram);
+			}
+			frame(now, origin, start, speed, stats);
+		}
+		//Разобрать то, что осталось в полосах
+		while (!m_server.m_input_thread.empty())
+			frame(now, origin, start, speed, stats);
+
+		//Остановка сервера - сброс журналов игроков на диск - в замер не входит
+		stats.elapsed	= std::chrono::steady_clock::now() - start;
+		m_server.onDestruction();
+		stats.responses = m_server.m_sent.load() - sent_before;
+		stats.duration	= Clock::between(origin, now);
+		m_server.m_replaying = false;
+		Clock::manual(false);
+		return stats;
+	}
+}
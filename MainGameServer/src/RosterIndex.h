@@ -0,0 +1,231 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Snapshot.h"
+
+
+namespace demonorium
+{
+	//Ключ сортировки списка игроков
+	enum class RosterOrder: byte {
+		IP		= 0,
+		NAME	= 1,
+		KILLS	= 2,
+		ALIVE	= 3
+	};
+
+	//Фильтр списка игроков, пустые поля пропускают всех
+	struct RosterFilter {
+		//Подстрока имени без учёта регистра
+		std::string name;
+		//Начало IP в записи через точку
+		std::string ip;
+		//Только живые игроки
+		bool alive_only = false;
+
+		bool operator ==(const RosterFilter& other) const;
+		bool operator !=(const RosterFilter& other) const;
+	};
+
+	/**
+	 * \brief Отсортированный и отфильтрованный индекс записей снимка RosterSnapshot.
+	 * Пока состав игроков не менялся, при новом снимке переставляются только изменившиеся записи,
+	 * полная пересборка идёт только при смене состава, порядка или фильтра.
+	 */
+	class RosterIndex {
+		std::vector<uint32> m_rows;
+		std::vector<uint32> m_changed;
+
+		RosterOrder		m_order;
+		bool			m_descending;
+		RosterFilter	m_filter;
+
+		//Последний учтённый снимок
+		size_t	m_version;
+		//Нужна полная пересборка
+		bool	m_dirty;
+
+		bool less(const RosterSnapshot& snapshot, uint32 a, uint32 b) const;
+		bool accept(const PlayerView& view) const;
+		void rebuild(const RosterSnapshot& snapshot);
+		void patch(const RosterSnapshot& snapshot);
+	public:
+		RosterIndex();
+
+		void setOrder(RosterOrder order, bool descending);
+		void setFilter(RosterFilter filter);
+
+		//Привести индекс к снимку
+		void update(const RosterSnapshot& snapshot);
+
+		//Количество строк, прошедших фильтр
+		size_t size() const;
+		//Позиция записи в снимке для строки row
+		uint32 operator[](size_t row) const;
+	};
+
+
+	namespace
+	{
+		//Записывает IP в текстовом виде без выделения памяти, возвращает длину
+		inline size_t format_ip(sf::IpAddress ip, char (&buffer)[16]) {
+			const sf::Uint32 value = ip.toInteger();
+			size_t length = 0;
+			for (int shift = 24; shift >= 0; shift -= 8) {
+				const unsigned part = (value >> shift) & 0xFF;
+				if (part >= 100)
+					buffer[length++] = static_cast<char>('0' + part / 100);
+				if (part >= 10)
+					buffer[length++] = static_cast<char>('0' + part / 10 % 10);
+				buffer[length++] = static_cast<char>('0' + part % 10);
+				if (shift != 0)
+					buffer[length++] = '.';
+			}
+			buffer[length] = '\0';
+			return length;
+		}
+
+		inline bool contains_nocase(std::string_view text, const std::string& part) {
+			return std::search(text.begin(), text.end(), part.begin(), part.end(), [](char a, char b) {
+				return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+			}) != text.end();
+		}
+	}
+
+	inline bool RosterFilter::operator==(const RosterFilter& other) const {
+		return (alive_only == other.alive_only) && (name == other.name) && (ip == other.ip);
+	}
+
+	inline bool RosterFilter::operator!=(const RosterFilter& other) const {
+		return !(*this == other);
+	}
+
+	inline RosterIndex::RosterIndex():
+		m_order(RosterOrder::IP), m_descending(false),
+		m_version(0), m_dirty(true) {
+	}
+
+	inline bool RosterIndex::less(const RosterSnapshot& snapshot, uint32 a, uint32 b) const {
+		const auto& left  = snapshot.players[m_descending ? b : a];
+		const auto& right = snapshot.players[m_descending ? a : b];
+
+		switch (m_order) {
+		case RosterOrder::NAME:
+			if (left.name != right.name)
+				return left.name.view() < right.name.view();
+			break;
+		case RosterOrder::KILLS:
+			if (left.kills != right.kills)
+				return left.kills < right.kills;
+			break;
+		case RosterOrder::ALIVE:
+			//Живые впереди, мёртвые по времени смерти
+			if (left.alive != right.alive)
+				return left.alive;
+			if (!left.alive && (left.die_time != right.die_time))
+				return left.die_time > right.die_time;
+			break;
+		default:
+			break;
+		}
+		//Записи снимка упорядочены по IP, позиция делает порядок строгим
+		return m_descending ? (b < a) : (a < b);
+	}
+
+	inline bool RosterIndex::accept(const PlayerView& view) const {
+		if (m_filter.alive_only && !view.alive)
+			return false;
+		if (!m_filter.name.empty() && !contains_nocase(view.name.view(), m_filter.name))
+			return false;
+		if (!m_filter.ip.empty()) {
+			char buffer[16];
+			const size_t length = format_ip(view.ip, buffer);
+			if ((length < m_filter.ip.size()) || (m_filter.ip.compare(0, m_filter.ip.size(), buffer, m_filter.ip.size()) != 0))
+				return false;
+		}
+		return true;
+	}
+
+	inline void RosterIndex::rebuild(const RosterSnapshot& snapshot) {
+		m_rows.clear();
+		for (uint32 i = 0; i < snapshot.players.size(); ++i)
+			if (accept(snapshot.players[i]))
+				m_rows.push_back(i);
+
+		std::sort(m_rows.begin(), m_rows.end(), [this, &snapshot](uint32 a, uint32 b) {
+			return less(snapshot, a, b);
+		});
+	}
+
+	inline void RosterIndex::patch(const RosterSnapshot& snapshot) {
+		//Изменившиеся записи вынимаются из индекса, остальные сохраняют порядок
+		const size_t seen = m_version;
+		m_rows.erase(std::remove_if(m_rows.begin(), m_rows.end(), [&snapshot, seen](uint32 row) {
+			return snapshot.players[row].revision > seen;
+		}), m_rows.end());
+
+		for (const uint32 row : m_changed) {
+			if (accept(snapshot.players[row])) {
+				const auto position = std::upper_bound(m_rows.begin(), m_rows.end(), row, [this, &snapshot](uint32 a, uint32 b) {
+					return less(snapshot, a, b);
+				});
+				m_rows.insert(position, row);
+			}
+		}
+	}
+
+	inline void RosterIndex::setOrder(RosterOrder order, bool descending) {
+		if ((m_order != order) || (m_descending != descending)) {
+			m_order = order;
+			m_descending = descending;
+			m_dirty = true;
+		}
+	}
+
+	inline void RosterIndex::setFilter(RosterFilter filter) {
+		if (m_filter != filter) {
+			m_filter = std::move(filter);
+			m_dirty = true;
+		}
+	}
+
+	inline void RosterIndex::update(const RosterSnapshot& snapshot) {
+		if (!m_dirty && (snapshot.version == m_version))
+			return;
+
+		if (m_dirty || (snapshot.structure_version > m_version)) {
+			rebuild(snapshot);
+		} else {
+			//Пропущенные снимки восстанавливаются по revision, иначе достаточно списка изменений
+			if (snapshot.version == m_version + 1) {
+				m_changed = snapshot.changed;
+			} else {
+				m_changed.clear();
+				for (uint32 i = 0; i < snapshot.players.size(); ++i)
+					if (snapshot.players[i].revision > m_version)
+						m_changed.push_back(i);
+			}
+
+			//Вставка по одной дешевле сортировки, пока изменений немного
+			if (m_changed.size() * 8 > snapshot.players.size())
+				rebuild(snapshot);
+			else
+				patch(snapshot);
+		}
+
+		m_version = snapshot.version;
+		m_dirty = false;
+	}
+
+	inline size_t RosterIndex::size() const {
+		return m_rows.size();
+	}
+
+	inline uint32 RosterIndex::operator[](size_t row) const {
+		return m_rows[row];
+	}
+}
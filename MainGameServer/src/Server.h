@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstring>
+#include <functional>
 #include <set>
+#include <unordered_map>
 
 #include "BaseThread.h"
 #include "InputThread.h"
@@ -8,6 +11,21 @@
 
 #include "Packet.h"
 #include "Log.h"
+#include "Snapshot.h"
+#include "StateFile.h"
+#include "History.h"
+#include "MPSCQueue.h"
+#include "Clock.h"
+#include "Flow.h"
+#include "WorkerPool.h"
+#include "OutputBatch.h"
+#include "Uring.h"
+#include "Name.h"
+#include "NodePool.h"
+#include "SessionTable.h"
+#include "Wakeup.h"
+#include "Framing.h"
+#include "Reliable.h"
 
 
 #include <DSFML/Aliases.h>
@@ -22,29 +40,64 @@ namespace demonorium
 
 
 	struct GameState {
-		//  
+		//Игра в процессе
 		bool game_started;
-		//   
+		//Опрос участников на готовность
 		bool ready_testing;
-		//  
+		//Игра успешно закончилась
 		bool game_ended;
 		
 		void set_default();
 		GameState();
 	};
 
-	//        
+	//Хранит ключ сервера и проверяет строки на соответсвие ключу
 	struct Password {
 		static constexpr const size_t LENGTH = 8;
 		static constexpr size_t TERMINATOR_LENGTH = LENGTH + 1;
 		char password[TERMINATOR_LENGTH];
 		
-		bool isValid(const char* string);
+		//Сравнение за постоянное время: не выдаёт, сколько первых символов совпало
+		bool isValid(const char* string) const;
 
 		Password(const char* string);
 	};
 
-	// mask_ip    alias
+	//Заявка на регистрацию, прошедшая проверку пароля и ждущая допуска.
+	//Имя лежит байтами: в таблицу имён попадают только допущенные заявки
+	struct Registration {
+		sf::IpAddress	ip;
+		sf::Uint16		port;
+		char			name[NameTable::CAPACITY];
+		byte			name_size;
+		//Заявка пришла в датаграмме с кадрами
+		bool			framed;
+	};
+
+	//Ключ игрока: адрес и сессия. Клиенты за общим NAT делят адрес, но каждый получает свою сессию.
+	//Игроки одного адреса лежат в списке подряд, поиск по адресу - поиск диапазона
+	struct PlayerKey {
+		sf::IpAddress	ip;
+		SessionId		session;
+
+		bool operator <(const PlayerKey& other) const;
+	};
+
+	//Допуск регистраций: не больше rate в секунду, неизрасходованный запас - не больше секунды
+	struct Admission {
+		//Регистраций в секунду, 0 - без ограничения
+		std::atomic<uint32> rate;
+		//Запас в тысячных долях регистрации
+		uint64 credit;
+		tick last;
+
+		//Списать одну регистрацию, false если запас исчерпан
+		bool take(tick current_time);
+
+		explicit Admission(uint32 rate);
+	};
+
+	//Подменяет mask_ip на указанный в alias
 	struct IPAlias {
 		const sf::IpAddress			mask_ip;
 		std::atomic<sf::IpAddress>	alias;
@@ -54,22 +107,26 @@ namespace demonorium
 		IPAlias(const sf::IpAddress& mask);
 	};
 
+	//Задержки и моменты сервера, моменты - в монотонном времени Clock
 	struct Chrono {
-		using delay		 = std::chrono::milliseconds;
-		using clock		 = std::chrono::system_clock;
-		using time_point = clock::time_point;
+		using delay	  = Clock::delay;
 		using crdelay = const delay&;
 		
-		//   kill   
+		//Задержка после получения kill перед неспосредственной смертью
 		const delay kill_delay;
-		//     
+		//Задержка после которой игрок засчитается замоубившимся
 		const delay inactive_delay;
-		//    
+		//Задержка перед предупреждением о бездействии и наименьший интервал повтора предупреждений,
+		//игроку с большой задержкой или молчащему игроку они повторяются реже, см. Heartbeat
 		const delay warning_delay;
-		//  
-		time_point game_start;
-
-		Chrono(crdelay kill, crdelay inactive, crdelay warning);
+		//Время начала игры
+		tick game_start;
+		//Период публикации снимков списка игроков
+		std::atomic<delay::rep> snapshot_period;
+		//Время последней публикации снимка
+		tick last_snapshot;
+
+		Chrono(crdelay kill, crdelay inactive, crdelay warning, crdelay snapshot);
 	};
 
 	enum class ServerCodes: byte {
@@ -79,8 +136,10 @@ namespace demonorium
 		DEATH		 = 3,
 		REGISTER	 = 4,
 		RESP_CHECK   = 5,
-		GAME_ENDED	 = 6
-		
+		GAME_ENDED	 = 6,
+		ROSTER		 = 7,
+		ROSTER_DELTA = 8,
+		RELIABLE	 = 9
 	};
 
 	enum class ClientCodes: byte {
@@ -91,9 +150,57 @@ namespace demonorium
 		TABLE		= 4,
 		ACTIVE		= 5,
 		NAME		= 6,
-		KILL		= 7
+		KILL		= 7,
+		SUBSCRIBE	= 8,
+		ACK			= 9
 	};
 
+	/**
+	 * \brief Изменение состава игры - живых готовых игроков, которых перечисляет TABLE.
+	 * ROSTER_DELTA: код, номер изменения uint32, событие, IP, номер сессии.
+	 * ROSTER: код, номер изменения uint32, номер части uint16, число частей uint16, записи IP и номер сессии.
+	 * Каждое изменение увеличивает номер на 1, пропуск номера - повод прислать SUBSCRIBE с последним
+	 * полученным номером: в ответ придёт полный состав. Во время игры состав меняется только смертями,
+	 * начало игры меняет его целиком и рассылается подписчикам полным составом
+	 */
+	enum class RosterEvent: byte {
+		DIED = 0
+	};
+
+	//Бит в коде клиента: за кодом идёт номер сессии, а цели KILL и DEATH - номера сессий вместо IP
+	static constexpr byte SESSION_FLAG = 0x80;
+
+	//Полоса приёма по коду пакета: поздний ACTIVE убивает живого игрока, поэтому он не ждёт за флудом регистраций и TABLE
+	inline Lane clientLane(const byte* data, size_t size) {
+		if (size == 0)
+			return Lane::BULK;
+		if (isFramed(data, size)) {
+			//Датаграмма с кадрами идёт полосой самого срочного сообщения в ней
+			Lane lane = Lane::BULK;
+			FrameReader frames(data, size);
+			const byte* message;
+			size_t length;
+			while ((lane != Lane::GAME) && frames.next(message, length))
+				if ((length != 0) && (*message != FRAMED))
+					lane = std::min(lane, clientLane(message, length));
+			return lane;
+		}
+		switch (static_cast<ClientCodes>(data[0] & ~SESSION_FLAG)) {
+		case ClientCodes::DEATH:
+		case ClientCodes::ACTIVE:
+		case ClientCodes::KILL:
+			return Lane::GAME;
+		case ClientCodes::DELETE:
+		case ClientCodes::READY:
+		case ClientCodes::NAME:
+		case ClientCodes::SUBSCRIBE:
+		case ClientCodes::ACK:
+			return Lane::CONTROL;
+		default:
+			return Lane::BULK;
+		}
+	}
+
 	enum class UserRequest: byte {
 		START_GAME	 = 0,
 		FORCE_START	 = 1,
@@ -104,13 +211,14 @@ namespace demonorium
 	
 	class Server : public BaseThread {
 		friend class ServerAPI;
+		friend class CaptureReplay;
 
-		//    -   
+		//Псевдоним для указателя на метод-реакции на сообщение игрока
 		using ServerResponse = void (Server::*)(const sf::IpAddress& IP, Player& player, Packet& packet);
-		//    -     
+		//Псевдоним для указателя на метод-реакции на запрос от интерфеса 
 		using UserResponse = void (Server::*)();
 		
-		//,    
+		//Проверка, что сервер успешно запущен
 		std::atomic<bool> m_launched;
 		
 		InputThread		m_input_thread;
@@ -118,22 +226,118 @@ namespace demonorium
 		Password		m_password;
 		IPAlias			m_host;
 		Chrono			m_chrono;
-		sf::UdpSocket	m_output;
+		NativeUdpSocket		m_output;
 
 		Log m_log;
 
-		using PlayerMap = std::map<sf::IpAddress, Player>;
+		//Узлы списка игроков берутся из пула: регистрации и удаления между матчами не дробят кучу
+		//Игроки хранятся по адресу и сессии: у каждой допущенной регистрации своя запись, даже с общего адреса
+		using PlayerMap = std::map<PlayerKey, Player, std::less<PlayerKey>, PoolAllocator<std::pair<const PlayerKey, Player>>>;
 		using PlayerBundle = PlayerMap::iterator;
+		NodePool  m_player_pool;
 		PlayerMap m_players;
+		//Сессии игроков: номер из пакета находит игрока индексом, без поиска по IP
+		SessionTable<PlayerBundle> m_sessions;
+		//Разбираемый пакет пришёл с номером сессии
+		bool m_session_request = false;
 		
 
 		std::unordered_map<byte, ServerResponse> m_server_response;
 		std::unordered_map<byte, UserResponse>	 m_user_response;
-		TwoPageInput m_requests;
+		//Запросы администратора из интерфейса и канала управления
+		MPSCQueue<UserRequest> m_requests;
+
+		//Номер последнего изменения состава игры, см. RosterEvent
+		uint32		 m_roster_sequence = 0;
+		//Самый большой пакет полного состава: одна датаграмма без фрагментации при MTU 1500
+		static constexpr size_t ROSTER_PACKET = 1472;
+
+		RosterBuffer m_snapshot;
+		size_t		 m_snapshot_version;
+
+		//Файл состояния для быстрого перезапуска, пишется фоновым потоком из опубликованных снимков
+		static constexpr const char* STATE_FILE = "Server.state";
+		StateWriter	 m_state_writer;
+
+		//История законченных матчей, пишется фоновым потоком
+		static constexpr const char* HISTORY_DIRECTORY = "history";
+		HistoryWriter m_history;
+
+		//Захват входящего трафика для воспроизведения, пишется фоновым потоком
+		static constexpr size_t CAPTURE_CAPACITY = 1024 * 1024;
+		CaptureWriter m_capture;
+		//Сервер ведёт CaptureReplay: пакеты приходят из захвата, ответы не отправляются, сна нет
+		bool m_replaying = false;
+
+		//Регистрации ждут допуска в очереди фиксированной ёмкости
+		MPSCQueue<Registration> m_registrations;
+		Admission	 m_admission;
+		//Ответы кадра копятся и уходят одной пачкой в конце кадра
+		OutputBatch	 m_outbox;
+		//Транспорт, запрошенный до запуска
+		std::atomic<Transport> m_transport;
+		//Склеивание датаграмм ядром: GRO на приёме, UDP_SEGMENT на отправке
+		std::atomic<bool> m_offload;
+		//Отправлено сообщений и системных вызовов отправки, пишет поток сервера
+		std::atomic<uint64> m_sent;
+		std::atomic<uint64> m_writes;
+#if defined(__linux__)
+		//Кольцо отправки, открыто только с транспортом URING
+		Uring		 m_send_ring;
+#endif
+		//Пакетов, разбираемых за один кадр
+		static constexpr size_t PACKETS_PER_FRAME = 256;
+		//Сообщений, разбираемых из одной датаграммы с кадрами: защита от DDOS считает датаграммы, а не сообщения
+		static constexpr size_t MESSAGES_PER_DATAGRAM = 16;
+
+		//Многошаговые сценарии, ждущие пакетов игроков или таймеров
+		FlowScheduler m_flows;
+
+		//Повторы надёжных сообщений: GAME_STARTED, GAME_ENDED, DEATH, ответы REGISTER и READY_REQ
+		RetransmitQueue m_retransmits;
+		//Первый повтор не раньше этого срока и RTO игрока, каждый следующий - вдвое позже
+		static constexpr Chrono::delay RELIABLE_RTO = Chrono::delay(200);
+		//Повторов одного сообщения, после них сообщение забывается
+		static constexpr byte RELIABLE_RETRIES = 6;
+
+		//Между матчами поток сервера спит, его будят поток приёма, запросы администратора и управление потоком
+		Wakeup m_wakeup;
+		//После последнего снимка что-то менялось: снимок нужно опубликовать и во сне
+		bool m_unpublished = true;
+		//Самый долгий сон без событий
+		static constexpr Chrono::delay IDLE_LIMIT = Chrono::delay(1000);
+		//Пауза между попытками допуска, пока очередь регистраций не пуста
+		static constexpr Chrono::delay ADMISSION_RETRY = Chrono::delay(1);
+
+		//Параллельные части кадра: проверка активности по шардам
+		WorkerPool	m_workers;
+		//Игроков в одном шарде проверки активности
+		static constexpr size_t SWEEP_GRAIN		= 256;
+
+		//Итог проверки активности игрока
+		enum class Liveness: byte {
+			OK		= 0,
+			WARN	= 1,
+			DEAD	= 2
+		};
+		std::vector<PlayerBundle> m_sweep;
+		std::vector<Liveness>	  m_verdicts;
 		
-		//  
-		void registerPlayer(std::map<sf::IpAddress, Player>::iterator& hint, const sf::IpAddress& IP, Packet& packet);
-		//    
+		//Разобрать датаграмму игрока: одно сообщение или сообщения с кадрами, см. Framing.h
+		void receive(const sf::IpAddress& IP, void* data, size_t size);
+		//Разобрать одно сообщение игрока, framed - оно пришло в датаграмме с кадрами
+		void dispatch(const sf::IpAddress& IP, Packet& packet, bool framed = false);
+		//Проверить заявку на регистрацию нового игрока и поставить её в очередь допуска
+		void registerPlayer(const sf::IpAddress& IP, Packet& packet, bool framed);
+		//Допустить заявки из очереди в пределах запаса Admission и отправить подтверждения
+		void admitRegistrations(tick current_time);
+		//Цель из 4 байт пакета: номер сессии или IP, смотря по форме пакета. m_players.end(), если цели нет
+		PlayerBundle findTarget(Packet& packet);
+		//Единственный игрок адреса. m_players.end(), если игроков с адреса нет или их несколько: тогда нужен номер сессии
+		PlayerBundle findAddress(const sf::IpAddress& IP);
+		//Игрок адреса, принимающий ответы на порт port
+		PlayerBundle findEndpoint(const sf::IpAddress& IP, sf::Uint16 port);
+		//Удаление всех игроков по условию
 		void removeByCondition(std::function<bool(PlayerBundle& it)> deleter, std::string message);
 		
 		void updatePlayer(	const sf::IpAddress& IP, Player& player, Packet& packet);
@@ -144,6 +348,8 @@ namespace demonorium
 		void playerResponse(const sf::IpAddress& IP, Player& player, Packet& packet);
 		void playerReqName(	const sf::IpAddress& IP, Player& player, Packet& packet);
 		void playerKill(	const sf::IpAddress& IP, Player& player, Packet& packet);
+		void playerSubscribe(const sf::IpAddress& IP, Player& player, Packet& packet);
+		void playerAck(		const sf::IpAddress& IP, Player& player, Packet& packet);
 		
 		void requestStart();
 		void requestForce();
@@ -151,180 +357,313 @@ namespace demonorium
 		void requestForceExists();
 		void requestEndGame();
 
-		//   ServerCodes::READY_REQ
-		void sendReadyRequest(const Chrono::time_point& current_time);
-		// 
-		void checkLife(const Chrono::time_point& current_time);
-		//     
+		//Отправить всем игрокам ServerCodes::READY_REQ
+		void sendReadyRequest(tick current_time);
+		//Проверить активность игроков, которых не убивают прямо сейчас
+		void checkLife(tick current_time);
+		//Решение по активности одного игрока, только чтение - выполняется в рабочих потоках
+		Liveness liveness(const Player& player, tick current_time) const;
+		//Отправить пакет всем живым готовым игрокам, возвращает число получателей
+		size_t broadcast(Packet& packet, const char* message);
+		//Отправить игроку полный состав игры частями по ROSTER_PACKET
+		void sendRoster(const sf::IpAddress& IP, const Player& player);
+		//Разослать подписчикам изменение состава игры
+		void pushRoster(RosterEvent event, const sf::IpAddress& IP, const Player& player);
+		//Подтверждение убийства: цель должна ответить ACTIVE, иначе смерть засчитывается
+		Flow confirmKill(SessionId target);
+		//Засчитать смерть игрока и сообщить живым
+		void acceptDeath(PlayerBundle bundle);
+		//Пометить начало игры и сообщить игрокам
 		void startGame();
-		//    
-		void endGame();
+		/**
+		 * \brief Закончить игру и сообщить игрокам
+		 * \param record записать итоги в историю матчей. При остановке сервера игра не записывается:
+		 * она сохранена в файле состояния и продолжится после перезапуска
+		 */
+		void endGame(bool record = true);
+		//Поставить итоги текущего матча в очередь истории
+		void recordMatch();
+		//Опубликовать снимок списка игроков для интерфейса
+		void publishSnapshot(tick current_time);
+		//Восстановить список игроков и состояние игры из файла состояния
+		void restoreState(tick current_time);
+		//Уснуть до пакета, запроса администратора или ближайшего таймера, только пока игра не идёт
+		void sleepIdle(tick current_time);
+		//Отправить ответы, накопленные за кадр
+		void flushOutput();
+
+		//Отправить сообщение надёжно, если игрок включил подтверждения, иначе как обычно
+		void reliable(Packet& pack, sf::IpAddress address, Player& player);
+		template<class ... Args>
+		void reliableResponse(sf::IpAddress address, Player& player, ServerCodes code, Args&& ... args);
+		//Отправить сообщение канала в обёртке RELIABLE
+		void sendWrapped(sf::IpAddress address, const Player& player, const ReliableChannel::Message& message);
+		//Повтор по таймеру: неподтверждённое сообщение уходит снова, пока не кончатся повторы
+		void retransmit(SessionId session, uint32 sequence);
+		Chrono::delay retransmitDelay(const Player& player, byte retries) const;
 		
-		//   ip  port 
+		//Отправить данные игроку на ip и его порт, игроку с кадрами - склеить с остальными ответами ему за кадр
 		template<class ... Args>
-		void response(sf::IpAddress address, sf::Uint16 port, ServerCodes code, Args&& ...);
+		void response(sf::IpAddress address, const Player& player, ServerCodes code, Args&& ...);
 		template<class T, class ... Args>
-		void response(Packet& pack, sf::IpAddress address, sf::Uint16 port, const T& a, Args&& ... args);
-		void response(Packet& pack, sf::IpAddress address, sf::Uint16 port);
+		void response(Packet& pack, sf::IpAddress address, const Player& player, const T& a, Args&& ... args);
+		void response(Packet& pack, sf::IpAddress address, const Player& player);
 	public:
 		explicit Server(const char password[9], unsigned short port = 3333, 
 			Chrono::crdelay kill		= 20s,
 			Chrono::crdelay inactive	= 35s,
-			Chrono::crdelay warning		= 1s);
+			Chrono::crdelay warning		= 1s,
+			Chrono::crdelay snapshot	= 200ms,
+			Chrono::crdelay state		= 1s,
+			uint32 admissionRate		= 2000,
+			size_t admissionQueue		= 4096,
+			size_t maxPacket			= 1472,
+			size_t laneCapacity			= 64 * 1024);
 
 		void onInit() override;
 		void onPause() override;
 		void onFrame() override;
 		void onUnPause() override;
 		void onDestruction() override;
+		void onInterrupt() override;
 
-		void request(UserRequest request);
+		//Поставить запрос администратора в очередь, false если очередь переполнена
+		bool request(UserRequest request);
 	};
 
 	template <class ... Args>
-	void Server::response(sf::IpAddress address, sf::Uint16 port, ServerCodes code, Args&&... args) {
+	void Server::response(sf::IpAddress address, const Player& player, ServerCodes code, Args&&... args) {
 		Packet packet(255);
-		response(packet, address, port, code, std::forward<Args>(args)...);
+		response(packet, address, player, code, std::forward<Args>(args)...);
 	}
 
 	template <class T, class ... Args>
-	void Server::response(Packet& pack, sf::IpAddress address, sf::Uint16 port, const T& a, Args&&... args) {
+	void Server::response(Packet& pack, sf::IpAddress address, const Player& player, const T& a, Args&&... args) {
 		pack.write(a);
-		response(pack, address, port, std::forward<Args>(args)...);
+		response(pack, address, player, std::forward<Args>(args)...);
+	}
+
+	template <class ... Args>
+	void Server::reliableResponse(sf::IpAddress address, Player& player, ServerCodes code, Args&&... args) {
+		Packet packet(255);
+		packet.write(code);
+		(packet.write(args), ...);
+		reliable(packet, address, player);
 	}
 	
-	void Server::onInit() {
+	inline void Server::onInit() {
 		m_log.open("Server.log");
-		m_input_thread.start();
-		m_output.bind(sf::Socket::AnyPort);
-		m_log.write("   : ", m_output.getLocalPort());
+		m_input_thread.setTransport(m_transport.load());
+		m_input_thread.setGro(m_offload.load());
+		m_outbox.setSegmentation(m_offload.load());
+		//При воспроизведении сеть не открывается: пакеты кладёт в полосы CaptureReplay
+		if (!m_replaying) {
+			if (m_capture.enabled()) {
+				m_capture.start();
+				m_input_thread.setCapture(&m_capture);
+			}
+			m_input_thread.start();
+			m_output.bind(sf::Socket::AnyPort);
+			m_log.write("Выбран порт для отправки: ", m_output.getLocalPort());
+		}
+#if defined(__linux__)
+		if (!m_replaying && (m_transport.load() == Transport::URING)) {
+			if (m_send_ring.open(64, 128))
+				m_log.write("Отправка через io_uring");
+			else
+				m_log.write_important("io_uring недоступен, отправка через сокет");
+		}
+#endif
 
 		m_players.clear();
+		m_sessions.clear();
+		m_retransmits.clear();
+		m_player_pool.reset();
+		//Воспроизведение начинается с пустого сервера, иначе прогоны зависят от прошлого файла состояния
+		if (!m_replaying)
+			restoreState(Clock::update());
+		publishSnapshot(Clock::update());
+		m_state_writer.start();
+		m_history.start();
 		
-		
-		m_log.write_important(" !");	
+		m_log.write_important("Сервер запущен!");	
 		m_launched.store(true);
 	}
 
-	inline void Server::registerPlayer(std::map<sf::IpAddress, Player>::iterator& hint, const sf::IpAddress& IP, Packet& packet) {
-		//    
-		m_log.write("  : ", IP.toString());
+	inline void Server::registerPlayer(const sf::IpAddress& IP, Packet& packet, bool framed) {
+		//Быстрый путь: проверка и постановка в очередь допуска, без выделений памяти и открытия файлов
 		if (!m_state.game_started && !m_state.ready_testing) {
-			if (packet.enoughMemoryMany<sf::Uint16>(Password::LENGTH)) {
-				// 
-				const char* password = packet.read<char>(Password::LENGTH);
-
-				m_log.write(": ", std::string(password, Password::LENGTH));
-				//  
-				if (m_password.isValid(password)) {
-					const unsigned short send_port = *packet.read<sf::Uint16>();
+			if (packet.availableSpace() >= Password::LENGTH + sizeof(sf::Uint16)) {
+				if (m_password.isValid(packet.read<char>(Password::LENGTH))) {
+					Registration registration;
+					registration.ip		= IP;
+					registration.port	= *packet.read<sf::Uint16>();
+					registration.framed = framed;
 					const size_t size = packet.availableSpace();
+					registration.name_size = static_cast<byte>(std::min(size, NameTable::CAPACITY));
+					std::memcpy(registration.name, packet.read<char>(size), registration.name_size);
 
-					m_log.write(": ", send_port);
-					
-					std::string name(packet.read<char>(size), size);
-					m_log.write(": ", name);
-
-					//    
-					m_players.insert(hint, std::make_pair(IP, Player(send_port, std::move(name), IP)));
-					m_log.write_important(" !");
-
-					response(IP, send_port, ServerCodes::REGISTER, IP);
-					m_log.write("  : ", name, " : ", IP.toString());
+					if (!m_registrations.push(registration))
+						m_log.write("Регистрация ", IP.toString(), " отклонена: очередь регистраций переполнена");
 				}
 				else {
-					m_log.write(" :  ");
+					m_log.write("Регистрация ", IP.toString(), " отклонена: неверный пароль");
 				}
 			}
 			else {
-				m_log.write(" :   ");
+				m_log.write("Регистрация ", IP.toString(), " отклонена: недостаточный размер запроса");
 			}
 		} else {
-			m_log.write(" :   ");
+			m_log.write("Регистрация ", IP.toString(), " отклонена: неверное состояние игры");
+		}
+	}
+
+	inline void Server::admitRegistrations(tick current_time) {
+		Registration registration;
+		while (!m_registrations.empty() && m_admission.take(current_time)) {
+			m_registrations.pop(registration);
+			//Пока заявка ждала, могла начаться игра
+			if (m_state.game_started || m_state.ready_testing) {
+				m_log.write("Регистрация ", registration.ip.toString(), " отклонена: неверное состояние игры");
+				continue;
+			}
+
+			//Повтор заявки того же клиента получает подтверждение ещё раз, клиент с другим портом того же адреса - новый игрок
+			auto bundle = findEndpoint(registration.ip, registration.port);
+			if (bundle == m_players.end()) {
+				Name name;
+				if (!NameTable::global().intern(registration.name, registration.name_size, name)) {
+					m_log.write_important("Регистрация ", registration.ip.toString(), " отклонена: таблица имён заполнена");
+					continue;
+				}
+				//Игрок без сессии не отличим от других клиентов своего адреса
+				const SessionId session = m_sessions.open(m_players.end());
+				if (session == NO_SESSION) {
+					m_log.write_important("Регистрация ", registration.ip.toString(), " отклонена: таблица сессий заполнена");
+					continue;
+				}
+				bundle = m_players.emplace(std::piecewise_construct, std::forward_as_tuple(PlayerKey{registration.ip, session}),
+					std::forward_as_tuple(registration.port, name, registration.ip)).first;
+				*m_sessions.find(session) = bundle;
+				bundle->second.setSession(session);
+				if (registration.framed)
+					bundle->second.setFramed();
+				m_log.write("Регистрация: ", name, " : ", registration.ip.toString(), " : ", registration.port, "; сессия ", session);
+			}
+
+			byte memory[5 + sizeof(SessionId)];
+			Packet ack(memory, sizeof(memory));
+			ack.write(static_cast<byte>(ServerCodes::REGISTER));
+			ack.write(registration.ip);
+			ack.write(bundle->second.getSession());
+			m_outbox.add(registration.ip, registration.port, ack.data(), ack.size(), bundle->second.isFramed());
+		}
+	}
+
+	inline Server::PlayerBundle Server::findTarget(Packet& packet) {
+		if (m_session_request) {
+			SessionId session;
+			std::memcpy(&session, packet.read(sizeof(SessionId)), sizeof(SessionId));
+			const PlayerBundle* found = m_sessions.find(session);
+			return (found != nullptr) ? *found : m_players.end();
 		}
+
+		const byte* raw_ip = packet.read<byte>(4);
+		return findAddress(sf::IpAddress(raw_ip[0], raw_ip[1], raw_ip[2], raw_ip[3]));
+	}
+
+	inline Server::PlayerBundle Server::findAddress(const sf::IpAddress& IP) {
+		auto bundle = m_players.lower_bound(PlayerKey{IP, NO_SESSION});
+		if ((bundle == m_players.end()) || (bundle->first.ip != IP))
+			return m_players.end();
+		const auto next = std::next(bundle);
+		if ((next != m_players.end()) && (next->first.ip == IP))
+			return m_players.end();
+		return bundle;
+	}
+
+	inline Server::PlayerBundle Server::findEndpoint(const sf::IpAddress& IP, sf::Uint16 port) {
+		for (auto bundle = m_players.lower_bound(PlayerKey{IP, NO_SESSION}); (bundle != m_players.end()) && (bundle->first.ip == IP); ++bundle)
+			if (bundle->second.getPort() == port)
+				return bundle;
+		return m_players.end();
 	}
 
 	inline void Server::removeByCondition(std::function<bool(PlayerBundle& it)> deleter,
 			std::string message) {
 
-		bool found;
-		do {
-			found = false;
-			auto it = m_players.begin();
-			for (; it != m_players.end(); ++it) {
-				if (deleter(it)) {
-					found = true;
-					break;
-				}
+		//Один проход: узел возвращается в пул, обход продолжается со следующего
+		for (auto it = m_players.begin(); it != m_players.end();) {
+			if (deleter(it)) {
+				m_log.write("Игрок ", it->second.getName(), " будет удалён. Причина: ", message);
+				m_sessions.close(it->second.getSession());
+				it = m_players.erase(it);
 			}
-			if (found) {
-				m_log.write(" ", it->second.getName(), "  . : ", message);
-				m_players.erase(it);
+			else {
+				++it;
 			}
-		} while (found);
+		}
 	}
 
 	inline void Server::updatePlayer(const sf::IpAddress& IP, Player& player, Packet& packet) {
-		//    
-		m_log.write(player.getName(), ":  ");
+		//Проверка состояния и размера пакета
+		m_log.write(player.getName(), ": запрос обновления");
 		if (!m_state.game_started && !m_state.ready_testing) {
-			if (packet.enoughMemoryMany<sf::Uint16>(Password::LENGTH)) {
-				// 
-				const char* password = packet.read<char>(Password::LENGTH);
-
-				m_log.write(": ", std::string(password, Password::LENGTH));
-				//  
-				if (m_password.isValid(password)) {
+			if (packet.availableSpace() >= Password::LENGTH + sizeof(sf::Uint16)) {
+				//Если пароль верен
+				if (m_password.isValid(packet.read<char>(Password::LENGTH))) {
 					const unsigned short send_port = *packet.read<sf::Uint16>();
 					const size_t size = packet.availableSpace();
+					Name name;
+					if (!NameTable::global().intern(packet.read<char>(size), size, name)) {
+						m_log.write_important("Имя не изменено: таблица имён заполнена");
+						name = player.getName();
+					}
 
-					m_log.write(" : ", send_port);
-
-					std::string name(packet.read<char>(size), size);
-					m_log.write(" : ", name);
-
-					//    
-					player.setName(std::move(name));
+					m_log.write("Новый порт: ", send_port, "; новое имя: ", name);
+					player.setName(name);
 					player.setPort(send_port);
-					m_log.write_important(" !");
+					m_log.write_important("Успешное обновление!");
 
-					response(IP, send_port, ServerCodes::REGISTER, IP);
-					m_log.write("  : ", name, " : ", IP.toString());
+					reliableResponse(IP, player, ServerCodes::REGISTER, IP, player.getSession());
+					m_log.write("Уведомление об обновлении: ", name, " : ", IP.toString());
 
 					player.resurrection();
 				}
 				else {
-					m_log.write(" :  ");
+					m_log.write("Запрос отклонён: неверный пароль");
 				}
 			}
 			else {
-				m_log.write(" :   ");
+				m_log.write("Запрос отклонён: недостаточный размер запроса");
 			}
 		}
 		else {
-			m_log.write(" :   ");
+			m_log.write("Запрос отклонён: неверное состояние игры");
 		}
 	}
 
 	inline void Server::removePlayer(const sf::IpAddress& IP, Player& player, Packet& packet) {
-		m_log.write(player.getName(), ":  ");
-		//  ,         
+		m_log.write(player.getName(), ": запрос удаления");
+		//Удалиться можно только, если игра не началась или игрок не дал согласие
 		if (!m_state.game_started || !player.isReady()) {
-			m_log.write_important(" : ", player.getName());
-			m_players.erase(m_players.find(IP));
+			m_log.write_important("Удаление игрока: ", player.getName());
+			m_sessions.close(player.getSession());
+			m_players.erase(PlayerKey{IP, player.getSession()});
 		} else {
-			m_log.write(" :   ");
+			m_log.write("Запрос отклонён: неверное состояние игры");
 		} 
 	}
 
 	inline void Server::playerReady(const sf::IpAddress& IP, Player& player, Packet& packet) {
-		m_log.write(player.getName(), ":  ");
-		//        
+		m_log.write(player.getName(), ": запрос готовности");
+		player.answerProbe();
+		//Запросы на регистрацию принимаются только если идёт опрос игроков
 		if (m_state.ready_testing) {
 			player.ready();
-			m_log.write(player.getName(), ":    ");
+			m_log.write(player.getName(), ": игрок готов к игре");
 			
-			//,    
+			//Проверяем, что все игроки готовы
 			bool start = true;
 			for (const auto& bundle : m_players)
 				if (bundle.second.alive() && !bundle.second.isReady()) {
@@ -332,69 +671,65 @@ namespace demonorium
 					break;
 				}
 			
-			//    -  
+			//Если все игроки готовы - начинаем игру
 			if (start) {
-				m_log.write("  ");
+				m_log.write("Все игроки готовы");
 				startGame();
 			}
 		}
 		else {
-			m_log.write(" :   ");
+			m_log.write("Запрос отклонён: неверное состояние игры");
 		}
 	}
 
 	inline void Server::playerDie(const sf::IpAddress& IP, Player& player, Packet& packet) {
-		m_log.write(player.getName(), ":  ");
+		m_log.write(player.getName(), ": запрос смерти");
 		if (m_state.game_started && player.alive() && player.isReady()) {
 			if (packet.enoughMemory<byte>(4)) {
-				Packet packet(5);
-				packet.write(static_cast<byte>(ServerCodes::DEATH));
-				packet.write(IP);
+				Packet death(5 + sizeof(SessionId));
+				death.write(static_cast<byte>(ServerCodes::DEATH));
+				death.write(IP);
+				death.write(player.getSession());
 									
-				int alive_counter = 0;
-				for (const auto& bundle : m_players) {
-					if (bundle.second.alive() && bundle.second.isReady()) {
-						m_log.write("  : ", bundle.second.getName(), " : ", bundle.first.toString());
-						response(packet, bundle.first, bundle.second.getPort());
-						++alive_counter;
-					}
-				}
-				if (alive_counter < 2) {
-					m_log.write("  2  .");
+				if (broadcast(death, "Уведомление о смерти: ") < 2) {
+					m_log.write("Осталось менее 2 живых игроков.");
 					endGame();
 				}
 
-				const byte* raw_ip = packet.read<byte>(4);
-				sf::IpAddress killer(raw_ip[0], raw_ip[1], raw_ip[2], raw_ip[3]);
-
-				DEMONORIUM_SIMPLE_FIND(m_players, find, killer, killer_player) {
-					m_log.write(" ", player.getName(), "   ", killer_player->second.getName());
+				sf::IpAddress killer = IP;
+				SessionId killer_session = player.getSession();
+				const auto killer_player = findTarget(packet);
+				if (killer_player != m_players.end()) {
+					m_log.write("Игрок ", player.getName(), " убит игроком ", killer_player->second.getName());
 					killer_player->second.incKillCounter();
+					killer = killer_player->first.ip;
+					killer_session = killer_player->second.getSession();
 				}
 				else {
-					m_log.write(" ");
-					killer = IP;
+					m_log.write("Неизвестный убийца");
 				}
 				if (killer == IP)
-					m_log.write_important(": ", killer.toString());
+					m_log.write_important("самоубийство: ", killer.toString());
 				
-				m_log.write(" ");
-				player.kill(killer);
+				m_log.write("Убийство игрока");
+				player.kill(killer, killer_session);
 				player.acceptKill();
+				pushRoster(RosterEvent::DIED, IP, player);
 			}
 			else {
-				m_log.write(" :   ");
+				m_log.write("Запрос отклонён: недостаточный размер запроса");
 			}
 		}
 		else {
-			m_log.write(" :       / ");
+			m_log.write("Запрос отклонён: неверное состояние игры или игрок уже мёртв/не готов");
 		}
 	}
 
 	inline void Server::playerReqTable(const sf::IpAddress& IP, Player& player, Packet& packet) {
-		m_log.write(player.getName(), ":  ");
+		m_log.write(player.getName(), ": запрос таблицы");
 		if (m_state.game_started && player.alive() && player.isReady()) {
-			size_t count = 252 / 4;
+			//Клиенту с сессией запись - IP и номер сессии, остальным - только IP
+			const size_t entry = m_session_request ? 4 + sizeof(SessionId) : 4;
 			byte fcount = 0;
 
 			Packet packet(255);
@@ -404,105 +739,151 @@ namespace demonorium
 
 			for (const auto& bundle : m_players) {
 				if (bundle.second.alive() && bundle.second.isReady()) {
-					packet.write(bundle.first);
+					if (packet.availableSpace() < entry)
+						break;
+					packet.write(bundle.first.ip);
+					if (m_session_request)
+						packet.write(bundle.second.getSession());
 					++fcount;
 				}
 			}
 			static_cast<byte*>(packet.data())[1] = fcount;
-			response(packet, IP, player.getPort());
+			response(packet, IP, player);
 		}
 		else {
-			m_log.write(" :       / ");
+			m_log.write("Запрос отклонён: неверное состояние игры или игрок уже мёртв/не готов");
 		}
 	}
 
 	inline void Server::playerResponse(const sf::IpAddress& IP, Player& player, Packet& packet) {
-		m_log.write(player.getName(), ":   ");
+		m_log.write(player.getName(), ": запрос подтверждения жизни");
+		player.answerProbe();
 		if (player.alive() && player.isReady())
 			player.reset_death();
 		else
-			m_log.write(" :      ");
+			m_log.write("Запрос отклонён: игрок уже мёртв или не готов");
 	}
 
 	inline void Server::playerReqName(const sf::IpAddress& IP, Player& player, Packet& packet) {
-		m_log.write(player.getName(), ":   ");
-		response(IP, player.getPort(), ServerCodes::REGISTER, IP);
+		m_log.write(player.getName(), ": запрос внешнего имени");
+		reliableResponse(IP, player, ServerCodes::REGISTER, IP, player.getSession());
 	}
 
 	inline void Server::playerKill(const sf::IpAddress& IP, Player& player, Packet& packet) {
-		m_log.write(player.getName(), ":  ");
+		m_log.write(player.getName(), ": запрос убийства");
 		if (m_state.game_started && player.alive() && player.isReady()) {
 			if (packet.enoughMemory<byte>(4)) {
-				const byte* raw_ip = packet.read<byte>(4);
-				const sf::IpAddress killed(raw_ip[0], raw_ip[1], raw_ip[2], raw_ip[3]);
-
-				DEMONORIUM_SIMPLE_FIND(m_players, find, killed, killed_player) {
+				const auto killed_player = findTarget(packet);
+				if (killed_player != m_players.end()) {
+					const sf::IpAddress killed = killed_player->first.ip;
 					if (killed_player->second.isReady() && killed_player->second.alive()) {
-						killed_player->second.kill(IP);
-						m_log.write("  : ", killed_player->second.getName(), " : ", killed);
-						response(killed, killed_player->second.getPort(), ServerCodes::RESP_CHECK);
-						m_log.write("  : ", killed_player->second.getName(), " : ", killed_player->first.toString());
+						//Повторное убийство меняет убийцу, но подтверждение уже идёт
+						const bool confirming = killed_player->second.on_death();
+						killed_player->second.kill(IP, player.getSession());
+						m_log.write("Начато убийство цели: ", killed_player->second.getName(), " : ", killed);
+						if (!confirming)
+							confirmKill(killed_player->second.getSession());
 					} else {
-						m_log.write(" :        ");
+						m_log.write("Запрос отклонён: цель не готова к игре или уже мертва");
 					}
 				}
 				else {
-					m_log.write(" :  : ", killed.toString());
+					m_log.write("Запрос отклонён: неизвестная цель");
 				}
 			} else {
-				m_log.write(" :   ");
+				m_log.write("Запрос отклонён: недостаточный размер запроса");
 			}
 		}
 		else {
-			m_log.write(" :       / ");
+			m_log.write("Запрос отклонён: неверное состояние игры или игрок уже мёртв/не готов");
+		}
+	}
+
+	inline void Server::playerSubscribe(const sf::IpAddress& IP, Player& player, Packet& packet) {
+		m_log.write(player.getName(), ": запрос подписки на состав игры");
+		player.subscribe();
+
+		//Подписчик с последним номером ничего не пропустил
+		if (packet.enoughMemory<uint32>()) {
+			uint32 known;
+			std::memcpy(&known, packet.read(sizeof(uint32)), sizeof(uint32));
+			if (known == m_roster_sequence)
+				return;
+		}
+		sendRoster(IP, player);
+	}
+
+	inline void Server::playerAck(const sf::IpAddress& IP, Player& player, Packet& packet) {
+		if (!packet.enoughMemory<uint32>()) {
+			m_log.write("Запрос отклонён: недостаточный размер запроса");
+			return;
+		}
+		uint32 cumulative;
+		uint32 mask = 0;
+		std::memcpy(&cumulative, packet.read(sizeof(uint32)), sizeof(uint32));
+		if (packet.enoughMemory<uint32>())
+			std::memcpy(&mask, packet.read(sizeof(uint32)), sizeof(uint32));
+
+		//Первое подтверждение включает канал: нумерация продолжается с номера игрока
+		if (!player.reliable().enabled()) {
+			player.reliable().enable(cumulative);
+			m_log.write(player.getName(), ": надёжная доставка включена");
+			return;
 		}
+		player.reliable().acknowledge(cumulative, mask);
 	}
 
 	inline void Server::requestStart() {
-		m_log.write_important(":   ");
+		m_log.write_important("АДМИНИСТРАТОР: запрос начала игры");
 		endGame();
 		if (m_state.game_ended) {
 			m_state.game_ended = false;
-			m_log.write("  ,  ");
-			removeByCondition([](PlayerBundle& it) { return !it->second.alive(); }, "    ");
+			m_log.write("Обнаружено завершение игры, принудительная очистка");
+			removeByCondition([](PlayerBundle& it) { return !it->second.alive(); }, "Игрок мёртв во время перезапуска");
 		}
 		m_state.ready_testing = true;
 
 		for (auto& player : m_players) {
 			player.second.setDefaultState();
-			response(player.first, player.second.getPort(), ServerCodes::READY_REQ);
-			m_log.write(" : ", player.second.getName(), " : ", player.first.toString());
+			player.second.probe();
+			reliableResponse(player.first.ip, player.second, ServerCodes::READY_REQ);
+			m_log.write("Запрос готовности: ", player.second.getName(), " : ", player.first.ip.toString());
 		}
 	}
 
 	inline void Server::requestForce() {
-		m_log.write_important(":    ");
+		m_log.write_important("АДМИНИСТРАТОР: запрос принудительного начала игры");
 
 		endGame();
 		if (m_state.game_ended) {
 			m_state.game_ended = false;
-			m_log.write("  ,  ");
-			removeByCondition([](PlayerBundle& it) { return !it->second.alive(); }, "    ");
+			m_log.write("Обнаружено завершение игры, принудительная очистка");
+			removeByCondition([](PlayerBundle& it) { return !it->second.alive(); }, "Игрок мёртв во время перезапуска");
 		}
 		
 		for (auto& player : m_players) {
 			player.second.setDefaultState();
 			player.second.ready();
-			response(player.first, player.second.getPort(), ServerCodes::READY_REQ);
-			m_log.write(" : ", player.second.getName(), " : ", player.first.toString());			
+			player.second.probe();
+			reliableResponse(player.first.ip, player.second, ServerCodes::READY_REQ);
+			m_log.write("Запрос готовности: ", player.second.getName(), " : ", player.first.ip.toString());
 		}
 		
 		startGame();
 	}
 
 	inline void Server::requestClear() {
-		m_log.write_important(":      ");
+		m_log.write_important("АДМИНИСТРАТОР: сброс состояния игры и списка игроков");
 		m_players.clear();
+		m_sessions.clear();
+		m_retransmits.clear();
+		//Список пуст: следующие регистрации займут куски пула подряд с начала
+		m_player_pool.reset();
 		m_state.set_default();
 	}
 
 	inline void Server::requestForceExists() {
-		m_log.write_important(":    ");
+		m_log.write_important("АДМИНИСТРАТОР: запрос принудительного начала игры");
 
 		if (m_state.ready_testing) {
 			startGame();
@@ -511,16 +892,17 @@ namespace demonorium
 			endGame();
 			if (m_state.game_ended) {
 				m_state.game_ended = false;
-				m_log.write("  ,  ");
-				removeByCondition([](PlayerBundle& it) { return !it->second.alive(); }, "    ");
+				m_log.write("Обнаружено завершение игры, принудительная очистка");
+				removeByCondition([](PlayerBundle& it) { return !it->second.alive(); }, "Игрок мёртв во время перезапуска");
 			}
 
 
 			for (auto& player : m_players) {
 				player.second.setDefaultState();
 				player.second.ready();
-				response(player.first, player.second.getPort(), ServerCodes::READY_REQ);
-				m_log.write(" : ", player.second.getName(), " : ", player.first.toString());
+				player.second.probe();
+				reliableResponse(player.first.ip, player.second, ServerCodes::READY_REQ);
+				m_log.write("Запрос готовности: ", player.second.getName(), " : ", player.first.ip.toString());
 			}
 		}
 		
@@ -528,108 +910,441 @@ namespace demonorium
 	}
 
 	inline void Server::requestEndGame() {
-		m_log.write_important(":   ");
+		m_log.write_important("АДМИНИСТРАТОР: запрос остановки игры");
 		endGame();
 	}
 
-	inline void Server::sendReadyRequest(const Chrono::time_point& current_time) {
+	inline void Server::sendReadyRequest(tick current_time) {
 		for (auto& bundle : m_players) {
 			auto& player = bundle.second;
-			if (!player.isReady()) {
-				auto dt = current_time - player.getLastWarning();
-				//   
-				if (dt > m_chrono.warning_delay) {
+			//Игроку с надёжной доставкой READY_REQ повторяет канал, пока он не подтвердит
+			if (!player.isReady() && !player.reliable().enabled()) {
+				auto dt = Clock::between(player.getLastWarning(), current_time);
+				//Переодически опрашиваем всех игроков, молчащих - всё реже
+				if (dt > player.getHeartbeat().retry(m_chrono.warning_delay)) {
 					player.updateLastWarning();
-					response(bundle.first, player.getPort(), ServerCodes::READY_REQ);
-					m_log.write(" : ", player.getName(), " : ", bundle.first.toString());
+					player.probe();
+					response(bundle.first.ip, player, ServerCodes::READY_REQ);
+					m_log.write("Запрос готовности: ", player.getName(), " : ", bundle.first.ip.toString());
 				}
 			}
 		}
 	}
 
-	inline void Server::checkLife(const Chrono::time_point& current_time) {
-		for (auto& player_p : m_players) {
-			auto& player = player_p.second;
-			if (player.alive() && player.isReady()) {
-				auto dt = std::chrono::duration_cast<Chrono::delay>(current_time - player.getLastRequest()).count();
-				
-				if (dt > m_chrono.kill_delay.count() && player.on_death() || dt > m_chrono.inactive_delay.count()) {
-					if (player.getKillerIP() == sf::IpAddress(0, 0, 0, 0)) {
-						m_log.write(" ", player.getName(), "  -  ");
-						player.kill(player_p.first);
-					} else {
-						auto killer = m_players.find(player.getKillerIP());
-						killer->second.incKillCounter();
-						
-						m_log.write(" ", player.getName(), "   ", killer->second.getName(), "     ");
-					}
-					player.acceptKill();
-
-					Packet packet(5);
-					packet.write(static_cast<byte>(ServerCodes::DEATH));
-					packet.write(player_p.first);
-
-					int alive_counter = 0;
-					for (const auto& bundle : m_players) {
-						if (bundle.second.alive() && bundle.second.isReady()) {
-							response(packet, bundle.first, bundle.second.getPort());
-							m_log.write("  : ", bundle.second.getName(), " : ", bundle.first.toString());
-							++alive_counter;
-						}
-					}
-					if (alive_counter < 2) {
-						endGame();
-					}
+	inline void Server::checkLife(tick current_time) {
+		//Решения принимаются параллельно по шардам, смерти и отправка - в потоке сервера по порядку
+		m_sweep.clear();
+		for (auto it = m_players.begin(); it != m_players.end(); ++it)
+			m_sweep.push_back(it);
+		m_verdicts.resize(m_sweep.size());
+
+		m_workers.parallelFor(m_sweep.size(), SWEEP_GRAIN, [this, current_time](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+				m_verdicts[i] = liveness(m_sweep[i]->second, current_time);
+		});
+
+		//Смерть могла завершить игру: остальные решения этого обхода уже не действуют, иначе следующая смерть
+		//вызовет endGame ещё раз и сбросит game_ended
+		for (size_t i = 0; (i < m_sweep.size()) && m_state.game_started; ++i) {
+			auto it = m_sweep[i];
+			auto& player = it->second;
+			if (m_verdicts[i] == Liveness::DEAD) {
+				acceptDeath(it);
+			} else if (m_verdicts[i] == Liveness::WARN) {
+				response(it->first.ip, player, ServerCodes::RESP_CHECK);
+				player.updateLastWarning();
+				player.probe();
+				m_log.write("Уведомление о неактивности: ", player.getName(), " : ", it->first.ip.toString());
+			}
+		}
+	}
+
+	inline Server::Liveness Server::liveness(const Player& player, tick current_time) const {
+		//Цель убийства ведёт confirmKill
+		if (!player.alive() || !player.isReady() || player.on_death())
+			return Liveness::OK;
+
+		//Игроку с большой задержкой ответ идёт дольше: срок смерти сдвигается на его RTO
+		const auto& heartbeat = player.getHeartbeat();
+		const auto dt = Clock::between(player.getLastRequest(), current_time);
+		if (dt > m_chrono.inactive_delay + heartbeat.grace())
+			return Liveness::DEAD;
+		if ((dt > m_chrono.warning_delay) && (Clock::between(player.getLastWarning(), current_time) > heartbeat.retry(m_chrono.warning_delay)))
+			return Liveness::WARN;
+		return Liveness::OK;
+	}
+
+	inline size_t Server::broadcast(Packet& packet, const char* message) {
+		//Рассылка уходит с остальными ответами кадра: один системный вызов на пачку получателей
+		size_t count = 0;
+		for (auto& bundle : m_players) {
+			if (bundle.second.alive() && bundle.second.isReady()) {
+				reliable(packet, bundle.first.ip, bundle.second);
+				m_log.write(message, bundle.second.getName(), " : ", bundle.first.ip.toString());
+				++count;
+			}
+		}
+		return count;
+	}
+
+	inline void Server::sendRoster(const sf::IpAddress& IP, const Player& player) {
+		constexpr size_t HEADER = 1 + sizeof(uint32) + 2 * sizeof(uint16);
+		constexpr size_t ENTRY	= 4 + sizeof(SessionId);
+		constexpr size_t PER_PART = (ROSTER_PACKET - HEADER) / ENTRY;
+
+		size_t members = 0;
+		if (m_state.game_started)
+			for (const auto& bundle : m_players)
+				if (bundle.second.alive() && bundle.second.isReady())
+					++members;
+
+		//Пустой состав - одна пустая часть
+		constexpr size_t MAX_PARTS = std::numeric_limits<uint16>::max();
+		const size_t needed = std::max<size_t>((members + PER_PART - 1) / PER_PART, 1);
+		const size_t parts = std::min(needed, MAX_PARTS);
+		if (needed > MAX_PARTS)
+			m_log.write_important("Полный состав не помещается в ", MAX_PARTS, " частей: отправлено ", MAX_PARTS * PER_PART, " игроков из ", members);
+		byte memory[ROSTER_PACKET];
+		auto bundle = m_players.cbegin();
+		for (size_t part = 0; part < parts; ++part) {
+			Packet packet(memory, sizeof(memory));
+			packet.write(static_cast<byte>(ServerCodes::ROSTER));
+			packet.write(m_roster_sequence);
+			packet.write(static_cast<uint16>(part));
+			packet.write(static_cast<uint16>(parts));
+
+			for (size_t written = 0; m_state.game_started && (written < PER_PART) && (bundle != m_players.cend()); ++bundle) {
+				if (bundle->second.alive() && bundle->second.isReady()) {
+					packet.write(bundle->first.ip);
+					packet.write(bundle->second.getSession());
+					++written;
 				}
-				else if (dt > m_chrono.warning_delay.count()) {
-					auto dt2 = std::chrono::duration_cast<Chrono::delay>(current_time - player.getLastWarning()).count();
-					if (dt2 > m_chrono.warning_delay.count()) {
-						response(player_p.first, player_p.second.getPort(), ServerCodes::RESP_CHECK);
-						player.updateLastWarning();
-						m_log.write("  : ", player.getName(), " : ", player_p.first.toString());
-					}
-				}	
 			}
+			response(packet, IP, player);
+		}
+		m_log.write("Полный состав игры: ", player.getName(), " : ", IP.toString(), "; игроков: ", members);
+	}
+
+	inline void Server::pushRoster(RosterEvent event, const sf::IpAddress& IP, const Player& player) {
+		++m_roster_sequence;
+
+		byte memory[1 + sizeof(uint32) + 1 + 4 + sizeof(SessionId)];
+		Packet packet(memory, sizeof(memory));
+		packet.write(static_cast<byte>(ServerCodes::ROSTER_DELTA));
+		packet.write(m_roster_sequence);
+		packet.write(static_cast<byte>(event));
+		packet.write(IP);
+		packet.write(player.getSession());
+
+		for (const auto& bundle : m_players)
+			if (bundle.second.isSubscribed())
+				response(packet, bundle.first.ip, bundle.second);
+	}
+
+	inline Flow Server::confirmKill(SessionId target) {
+		if (const PlayerBundle* found = m_sessions.find(target)) {
+			const auto& bundle = *found;
+			response(bundle->first.ip, bundle->second, ServerCodes::RESP_CHECK);
+			bundle->second.probe();
+			m_log.write("Уведомление о неактивности: ", bundle->second.getName(), " : ", bundle->first.ip.toString());
+		}
+
+		Chrono::delay wait = m_chrono.warning_delay;
+		while (true) {
+			const bool answered = co_await m_flows.packet(target, static_cast<byte>(ClientCodes::ACTIVE), wait);
+
+			//За время ожидания игрока могли удалить, воскресить или закончить игру. Номер удалённого игрока не находится
+			const PlayerBundle* found = m_sessions.find(target);
+			if (found == nullptr)
+				co_return;
+			const PlayerBundle bundle = *found;
+			const sf::IpAddress address = bundle->first.ip;
+			auto& player = bundle->second;
+			if (answered || !m_state.game_started || !player.alive() || !player.isReady() || !player.on_death())
+				co_return;
+
+			const tick current_time = Clock::now();
+			const auto silence = Clock::between(player.getLastRequest(), current_time);
+			const auto& heartbeat = player.getHeartbeat();
+			const auto limit = std::min(m_chrono.kill_delay, m_chrono.inactive_delay) + heartbeat.grace();
+			if (silence > limit) {
+				acceptDeath(bundle);
+				co_return;
+			}
+
+			if (silence > m_chrono.warning_delay && Clock::between(player.getLastWarning(), current_time) > heartbeat.retry(m_chrono.warning_delay)) {
+				response(address, player, ServerCodes::RESP_CHECK);
+				player.updateLastWarning();
+				player.probe();
+				m_log.write("Уведомление о неактивности: ", player.getName(), " : ", address.toString());
+			}
+			//Просыпаемся к следующему предупреждению или ровно к концу срока
+			wait = std::min(heartbeat.retry(m_chrono.warning_delay), limit - silence + Chrono::delay(1));
+		}
+	}
+
+	inline void Server::acceptDeath(PlayerBundle bundle) {
+		auto& player = bundle->second;
+		if (player.getKillerIP() == sf::IpAddress(0, 0, 0, 0)) {
+			m_log.write("Игрок ", player.getName(), " погиб из-за отсутствия активности");
+			player.kill(bundle->first.ip, player.getSession());
+		} else {
+			//Убийца восстановленного из файла состояния игрока не знает сессии и ищется по IP
+			const PlayerBundle* by_session = m_sessions.find(player.getKillerSession());
+			const PlayerBundle killer = (by_session != nullptr) ? *by_session : findAddress(player.getKillerIP());
+			if (killer != m_players.end()) {
+				killer->second.incKillCounter();
+				m_log.write("Игрок ", player.getName(), " убит игроком ", killer->second.getName(), " с помощью запроса об убийстве");
+			} else {
+				m_log.write("Игрок ", player.getName(), " убит выбывшим игроком ", player.getKillerIP().toString());
+			}
+		}
+		player.acceptKill();
+		pushRoster(RosterEvent::DIED, bundle->first.ip, player);
+
+		Packet packet(5 + sizeof(SessionId));
+		packet.write(static_cast<byte>(ServerCodes::DEATH));
+		packet.write(bundle->first.ip);
+		packet.write(player.getSession());
+
+		if (broadcast(packet, "Уведомление о смерти: ") < 2) {
+			endGame();
 		}
 	}
 
 	inline void Server::startGame() {
-		//  
+		//Обновление переменных состояния
 		m_state.game_ended		= false;
 		m_state.ready_testing	= false;
 		m_state.game_started	= true;
-		m_log.write_important(" !");
-		//    
-		for (const auto& bundle : m_players) {
-			if (bundle.second.alive() && bundle.second.isReady()) {
-				response(bundle.first, bundle.second.getPort(), ServerCodes::GAME_STARTED);
-				m_log.write("   : ", bundle.second.getName(), " : ", bundle.first.toString());
-			}
-		}
-		m_chrono.game_start = Chrono::clock::now();
+		m_log.write_important("ИГРА НАЧАЛАСЬ!");
+		//Сообщаем игрокам о начале игры
+		Packet packet(1);
+		packet.write(static_cast<byte>(ServerCodes::GAME_STARTED));
+		broadcast(packet, "Уведомление о начале игры: ");
+		m_chrono.game_start = Clock::now();
+
+		//Состав сменился целиком: подписчики получают его полностью
+		++m_roster_sequence;
+		for (const auto& bundle : m_players)
+			if (bundle.second.isSubscribed())
+				sendRoster(bundle.first.ip, bundle.second);
 	}
 
-	inline void Server::endGame() {
+	inline void Server::endGame(bool record) {
 		if (m_state.game_started) {
-			m_log.write_important(" !");
-			for (const auto& bundle : m_players) {
-				if (bundle.second.alive() && bundle.second.isReady()) {
-					response(bundle.first, bundle.second.getPort(), ServerCodes::GAME_ENDED);
-					m_log.write("   : ", bundle.second.getName(), " : ", bundle.first.toString());
-				}
-			}
+			m_log.write_important("ИГРА ЗАВЕРШЕНА!");
+			if (record)
+				recordMatch();
+			Packet packet(1);
+			packet.write(static_cast<byte>(ServerCodes::GAME_ENDED));
+			broadcast(packet, "Уведомление о конце игры: ");
 			m_state.ready_testing = false;
 			m_state.game_started  = false;
 			m_state.game_ended    = true;
 		}
 		else {
-			m_log.write("C  ");
+			m_log.write("Cброс состояния игры");
 			m_state.set_default();
 		}
 	}
 
-	inline void Server::response(Packet& pack, sf::IpAddress address, sf::Uint16 port) {
-		m_output.send(pack.data(), pack.size(), address, port);
+	inline void Server::recordMatch() {
+		MatchResult match;
+		match.finished = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		match.duration = static_cast<uint32>(std::max<int32>(Clock::between(m_chrono.game_start, Clock::now()).count(), 0));
+
+		match.rows.reserve(m_players.size());
+		for (const auto& bundle : m_players) {
+			const auto& player = bundle.second;
+			//Не готовые игроки в матче не участвовали
+			if (!player.isReady())
+				continue;
+
+			const bool alive = player.alive();
+			match.rows.push_back(MatchRow{
+				bundle.first.ip,
+				alive ? sf::IpAddress(0, 0, 0, 0) : player.getKillerIP(),
+				player.getName(),
+				static_cast<uint32>(player.getKillCounter()),
+				alive ? -1 : static_cast<int32>(Clock::between(m_chrono.game_start, player.getDieTime()).count())
+			});
+		}
+
+		if (!m_history.push(match))
+			m_log.write_important("Очередь истории матчей переполнена, матч не сохранён");
+	}
+
+	inline void Server::publishSnapshot(tick current_time) {
+		RosterSnapshot* snapshot = m_snapshot.write();
+		//Прошлый снимок ещё читают, попробуем на следующем кадре
+		if (snapshot == nullptr)
+			return;
+
+		//Предыдущий снимок нужен, чтобы отметить изменившиеся записи, обе страницы упорядочены по IP и сессии
+		const auto previous = m_snapshot.read();
+		auto old_view = previous->players.cbegin();
+		bool structure_changed = previous->players.size() != m_players.size();
+
+		snapshot->version		= ++m_snapshot_version;
+		snapshot->game_started	= m_state.game_started;
+		snapshot->ready_testing	= m_state.ready_testing;
+		snapshot->game_ended	= m_state.game_ended;
+		snapshot->time			= current_time;
+		snapshot->game_start	= m_chrono.game_start;
+		snapshot->players.resize(m_players.size());
+		snapshot->changed.clear();
+
+		auto view = snapshot->players.begin();
+		for (const auto& bundle : m_players) {
+			const auto& player = bundle.second;
+			
+			view->ip		= bundle.first.ip;
+			view->session	= bundle.first.session;
+			view->killer	= player.getKillerIP();
+			view->name = player.getName();
+			view->port		= player.getPort();
+			view->ready		= player.isReady();
+			view->alive		= player.alive();
+			view->kills		= player.getKillCounter();
+			view->die_time	= std::chrono::duration_cast<std::chrono::seconds>(Clock::between(m_chrono.game_start, player.getDieTime())).count();
+			view->died		= player.getDieTime();
+
+			if ((old_view != previous->players.cend()) && (old_view->ip == view->ip) && (old_view->session == view->session)) {
+				if (view->sameState(*old_view)) {
+					view->revision = old_view->revision;
+				} else {
+					view->revision = snapshot->version;
+					snapshot->changed.push_back(static_cast<uint32>(view - snapshot->players.begin()));
+				}
+			} else {
+				view->revision = snapshot->version;
+				structure_changed = true;
+			}
+			if (old_view != previous->players.cend())
+				++old_view;
+			++view;
+		}
+
+		snapshot->structure_version = structure_changed ? snapshot->version : previous->structure_version;
+		if (structure_changed)
+			snapshot->changed.clear();
+
+		m_snapshot.publish();
+		m_chrono.last_snapshot = current_time;
+		m_unpublished = false;
+	}
+
+	inline void Server::restoreState(tick current_time) {
+		StateReader state;
+		if (!state.open(STATE_FILE)) {
+			m_log.write("Файл состояния не найден или повреждён, список игроков пуст");
+			return;
+		}
+
+		const auto& header = state.header();
+		m_state.game_started  = header.game_started;
+		m_state.ready_testing = header.ready_testing;
+		m_state.game_ended	  = header.game_ended;
+		//Игра продолжается с момента снимка, время простоя в игру не засчитывается
+		m_chrono.game_start	  = Clock::after(current_time, -Chrono::delay(header.game_time));
+
+		//Записи упорядочены по IP, а новые сессии обычно растут: вставка почти всегда в конец дерева
+		for (size_t i = 0; i < state.size(); ++i) {
+			const StateRecord& record = state[i];
+			const sf::IpAddress ip(record.ip);
+
+			Life life;
+			life.killer = sf::IpAddress(record.killer);
+			life.alive	= (record.flags & StateRecord::ALIVE) != 0;
+			life.ready	= (record.flags & StateRecord::READY) != 0;
+			//Подтверждения убийств не переживают перезапуск: сценарии confirmKill не сохраняются
+
+			Name name;
+			NameTable::global().intern(state.name(record), name);
+			//Сессии не переживают перезапуск: игроки получают новые номера в ответах REGISTER и NAME
+			const SessionId session = m_sessions.open(m_players.end());
+			if (session == NO_SESSION) {
+				m_log.write_important("Таблица сессий заполнена: игрок ", name, " не восстановлен");
+				continue;
+			}
+			const auto bundle = m_players.emplace_hint(m_players.end(), std::piecewise_construct, std::forward_as_tuple(PlayerKey{ip, session}),
+				std::forward_as_tuple(record.port, name, ip,
+					life, record.kills, Clock::after(m_chrono.game_start, Chrono::delay(record.died))));
+			*m_sessions.find(session) = bundle;
+			bundle->second.setSession(session);
+		}
+
+		m_log.write_important("Восстановлено из файла состояния: игроков ", m_players.size(),
+			"; игра идёт: ", m_state.game_started, "; опрос готовности: ", m_state.ready_testing);
+	}
+
+	inline void Server::response(Packet& pack, sf::IpAddress address, const Player& player) {
+		m_outbox.add(address, player.getPort(), pack.data(), pack.size(), player.isFramed());
+	}
+
+	inline void Server::flushOutput() {
+		if (m_outbox.empty())
+			return;
+		size_t sent;
+		if (m_replaying) {
+			//Адресаты из захвата - настоящие игроки: ответы только считаются
+			sent = m_outbox.size();
+			m_outbox.clear();
+		} else
+#if defined(__linux__)
+		if (m_send_ring.isOpen())
+			sent = m_outbox.flush(m_output, m_send_ring);
+		else
+#endif
+			sent = m_outbox.flush(m_output);
+
+		m_sent.store(m_sent.load(std::memory_order_relaxed) + sent, std::memory_order_relaxed);
+		m_writes.store(m_outbox.writes(), std::memory_order_relaxed);
+	}
+
+	inline void Server::reliable(Packet& pack, sf::IpAddress address, Player& player) {
+		//Повтор находит игрока по сессии: без неё сообщение уходит как обычно
+		const ReliableChannel::Message* message = (player.getSession() != NO_SESSION) ? player.reliable().push(pack.data(), pack.size()) : nullptr;
+		if (message == nullptr) {
+			response(pack, address, player);
+			return;
+		}
+		sendWrapped(address, player, *message);
+		m_retransmits.schedule(player.getSession(), message->sequence, retransmitDelay(player, 0));
+	}
+
+	inline void Server::sendWrapped(sf::IpAddress address, const Player& player, const ReliableChannel::Message& message) {
+		byte memory[1 + sizeof(uint32) + ReliableChannel::PAYLOAD];
+		Packet packet(memory, 1 + sizeof(uint32) + message.size);
+		packet.write(static_cast<byte>(ServerCodes::RELIABLE));
+		packet.write(message.sequence);
+		packet.write(message.data, message.size);
+		response(packet, address, player);
+	}
+
+	inline void Server::retransmit(SessionId session, uint32 sequence) {
+		const PlayerBundle* bundle = m_sessions.find(session);
+		if (bundle == nullptr)
+			return;
+		Player& player = (*bundle)->second;
+		ReliableChannel::Message* message = player.reliable().find(sequence);
+		//Уже подтверждено
+		if (message == nullptr)
+			return;
+
+		if (message->retries == RELIABLE_RETRIES) {
+			m_log.write("Сообщение ", sequence, " не подтверждено игроком ", player.getName(), ", повторы прекращены");
+			player.reliable().drop(sequence);
+			return;
+		}
+		++message->retries;
+		sendWrapped((*bundle)->first.ip, player, *message);
+		m_retransmits.schedule(session, sequence, retransmitDelay(player, message->retries));
+	}
+
+	inline Chrono::delay Server::retransmitDelay(const Player& player, byte retries) const {
+		return std::max(RELIABLE_RTO, player.getHeartbeat().grace()) * (1 << retries);
 	}
 
 	inline void GameState::set_default() {
@@ -642,17 +1357,43 @@ namespace demonorium
 		set_default();
 	}
 
-	inline bool Password::isValid(const char* pas) {
-		for (int i = 0; i < LENGTH; ++i)
-			if (password[i] != pas[i])
-				return false;
-		return true;
+	inline bool PlayerKey::operator<(const PlayerKey& other) const {
+		if (ip != other.ip)
+			return ip < other.ip;
+		return session < other.session;
+	}
+
+	inline bool Password::isValid(const char* pas) const {
+		byte difference = 0;
+		for (size_t i = 0; i < LENGTH; ++i)
+			difference |= static_cast<byte>(password[i] ^ pas[i]);
+		return difference == 0;
 	}
 
 	inline Password::Password(const char* pas) {
 		std::memcpy(password, pas, TERMINATOR_LENGTH);
 	}
 
+	inline bool Admission::take(tick current_time) {
+		const uint64 limit = rate.load();
+		if (limit == 0)
+			return true;
+
+		const auto elapsed = Clock::between(last, current_time).count();
+		if (elapsed > 0) {
+			credit = std::min<uint64>(credit + static_cast<uint64>(elapsed) * limit, limit * 1000);
+			last = current_time;
+		}
+		if (credit < 1000)
+			return false;
+		credit -= 1000;
+		return true;
+	}
+
+	inline Admission::Admission(uint32 rate):
+		rate(rate), credit(uint64(rate) * 1000), last(Clock::now()) {
+	}
+
 	inline sf::IpAddress IPAlias::convert(sf::IpAddress ip) const {
 		if (ip == mask_ip)
 			return alias.load();
@@ -663,25 +1404,44 @@ namespace demonorium
 		mask_ip(mask), alias(mask){ 
 	}
 
-	inline Chrono::Chrono(crdelay kill, crdelay inactive, crdelay warning):
-		kill_delay(kill), inactive_delay(inactive), warning_delay(warning) {
+	inline Chrono::Chrono(crdelay kill, crdelay inactive, crdelay warning, crdelay snapshot):
+		kill_delay(kill), inactive_delay(inactive), warning_delay(warning),
+		game_start(0), snapshot_period(snapshot.count()), last_snapshot(0) {
 	}
 
 
 	inline Server::Server(const char password[9], unsigned short port,
 	                      Chrono::crdelay kill,
 	                      Chrono::crdelay inactive,
-	                      Chrono::crdelay warning):
+	                      Chrono::crdelay warning,
+	                      Chrono::crdelay snapshot,
+	                      Chrono::crdelay state,
+	                      uint32 admissionRate,
+	                      size_t admissionQueue,
+	                      size_t maxPacket,
+	                      size_t laneCapacity):
 		m_launched(false),
-		m_input_thread(port, 255, 128),
+		m_input_thread(port, maxPacket, laneCapacity),
 		m_password(password),
 		m_host(sf::IpAddress::LocalHost),
-		m_chrono(kill, inactive, warning),
+		m_chrono(kill, inactive, warning, snapshot),
 		m_log(true),
-		m_requests(sizeof(ServerResponse), 32),
+		m_players(PlayerMap::allocator_type(m_player_pool)),
 		m_server_response(std::numeric_limits<byte>::max()),
-		m_user_response(std::numeric_limits<byte>::max()) {
-		
+		m_user_response(std::numeric_limits<byte>::max()),
+		m_requests(256),
+		m_snapshot_version(0),
+		m_state_writer(m_snapshot, STATE_FILE, state),
+		m_history(HISTORY_DIRECTORY),
+		m_capture(CAPTURE_CAPACITY, maxPacket),
+		m_registrations(admissionQueue),
+		m_admission(admissionRate),
+		m_transport(Transport::SOCKETS), m_offload(false), m_sent(0), m_writes(0),
+		m_flows(Clock::update()),
+		m_retransmits(Clock::now()) {
+		m_input_thread.setWakeup(&m_wakeup);
+		m_input_thread.setClassifier(&clientLane);
+
 		m_server_response[static_cast<byte>(ClientCodes::REGISTER)]  = &Server::updatePlayer;
 		m_server_response[static_cast<byte>(ClientCodes::DELETE)]	 = &Server::removePlayer;
 		m_server_response[static_cast<byte>(ClientCodes::DEATH)]	 = &Server::playerDie;
@@ -690,6 +1450,8 @@ namespace demonorium
 		m_server_response[static_cast<byte>(ClientCodes::ACTIVE)]	 = &Server::playerResponse;
 		m_server_response[static_cast<byte>(ClientCodes::NAME)]		 = &Server::playerReqName;
 		m_server_response[static_cast<byte>(ClientCodes::TABLE)]	 = &Server::playerReqTable;
+		m_server_response[static_cast<byte>(ClientCodes::SUBSCRIBE)] = &Server::playerSubscribe;
+		m_server_response[static_cast<byte>(ClientCodes::ACK)]		 = &Server::playerAck;
 
 		m_user_response[static_cast<byte>(UserRequest::START_GAME)]   = &Server::requestStart;
 		m_user_response[static_cast<byte>(UserRequest::FORCE_START)]  = &Server::requestForce;
@@ -703,76 +1465,201 @@ namespace demonorium
 	}
 
 	inline void Server::onFrame() {
-		//  
-		void* request_memory = m_requests.read();
-		
-		if (request_memory != nullptr) {
-			DEMONORIUM_SIMPLE_FIND(m_user_response, find, as_reference<byte>(request_memory), request) {
+		//Время кадра: все обработчики кадра видят один и тот же момент
+		const tick current_time = Clock::update();
+
+		//Запросы от интерфейса
+		UserRequest user_request;
+		while (m_requests.pop(user_request)) {
+			m_unpublished = true;
+			DEMONORIUM_SIMPLE_FIND(m_user_response, find, static_cast<byte>(user_request), request) {
 				std::mem_fn(request->second)(this);
 			}
 		}
 
-		//  
-		void* received_memory = m_input_thread.get();
-		if (received_memory != nullptr) {
-			//C       
-			PacketPrefix prefix = as_reference<PacketPrefix>(received_memory);
-			prefix.ip = m_host.convert(prefix.ip);
-			
-			received_memory = shift(received_memory, sizeof(PacketPrefix));
-			Packet pack(received_memory, prefix.size);
+		//Пакеты из сети: за кадр разбирается пачка, а не один пакет, чтобы всплеск не копился в буфере приёма
+		size_t packets = 0;
+		for (; packets < PACKETS_PER_FRAME; ++packets) {
+			void* received_memory = m_input_thread.get();
+			if (received_memory == nullptr)
+				break;
+			m_unpublished = true;
 
-			//     
-			if (pack.enoughMemory<byte>()) {
-				const auto code = static_cast<ClientCodes>(*pack.read<byte>());
-				
-				DEMONORIUM_SIMPLE_FIND(m_players, find, prefix.ip, sender) {
-					sender->second.updateLastRequest();
-					
-					DEMONORIUM_SIMPLE_FIND(m_server_response, find, (byte)code, response) {
-						std::mem_fn(response->second)(this, sender->first, sender->second, pack);
-					} else {
-						m_log.write(sender->second.getName(), ":   : ", static_cast<int>(code));
-						m_log.write(": ", BinaryOutput(pack.data(), pack.size()));
-					}
-				} else {
-					if (code == ClientCodes::REGISTER)
-						registerPlayer(sender, prefix.ip, pack);
-					else {
-						m_log.write(" : ", prefix.ip);
-					}
-				}
-			}
+			//Cчитывание пакета из буффера
+			PacketPrefix prefix = as_reference<PacketPrefix>(received_memory);
+			receive(m_host.convert(prefix.ip), shift(received_memory, sizeof(PacketPrefix)), prefix.size);
 		}
-
-		// 
-		auto current_time = Chrono::clock::now();
+		if (packets != 0)
+			m_input_thread.drained();
+		admitRegistrations(current_time);
+
+		m_flows.advance(current_time);
+		m_retransmits.advance(current_time, [this](SessionId session, uint32 sequence) {
+			retransmit(session, sequence);
+		});
 		
 		
 		if (m_state.ready_testing) {
-			//    ,    
+			//Если игра в режиме опрашивания, перодически отсылаем запросы активности
 			sendReadyRequest(current_time);
 		} else if (m_state.game_started) { 
-			//    ,    
+			//Если игра началась периодически проверяем, что игроки живы 
 			checkLife(current_time);
 		}
+
+		if (Clock::between(m_chrono.last_snapshot, current_time) >= Chrono::delay(m_chrono.snapshot_period.load()))
+			publishSnapshot(current_time);
+
+		flushOutput();
+		if (!m_state.ready_testing && !m_state.game_started && !m_replaying)
+			sleepIdle(current_time);
+	}
+
+	inline void Server::sleepIdle(tick current_time) {
+		Chrono::delay timeout = IDLE_LIMIT;
+		if (!m_registrations.empty())
+			timeout = ADMISSION_RETRY;
+		else if ((m_flows.size() != 0) || (m_retransmits.size() != 0))
+			timeout = FlowScheduler::TICK;
+
+		//Сценарии и допуск меняют игроков без пакетов
+		if (timeout != IDLE_LIMIT)
+			m_unpublished = true;
+		if (m_unpublished) {
+			const auto until_snapshot = Chrono::delay(m_chrono.snapshot_period.load()) - Clock::between(m_chrono.last_snapshot, current_time);
+			timeout = std::min(timeout, until_snapshot);
+		}
+		if (timeout.count() <= 0)
+			return;
+
+		//Событие между проверкой и сном разбудит сразу
+		const uint32 key = m_wakeup.prepare();
+		if (!m_requests.empty() || !m_input_thread.empty()) {
+			m_wakeup.cancel();
+			return;
+		}
+		m_wakeup.wait(key, timeout);
+	}
+
+	inline void Server::receive(const sf::IpAddress& IP, void* data, size_t size) {
+		if (!isFramed(data, size)) {
+			Packet pack(data, size);
+			dispatch(IP, pack);
+			return;
+		}
+
+		//Сообщения разбираются на месте, в памяти кольца приёма
+		FrameReader frames(data, size);
+		const byte* message;
+		size_t length;
+		for (size_t count = 0; frames.next(message, length); ++count) {
+			if (count == MESSAGES_PER_DATAGRAM) {
+				m_log.write("Датаграмма с кадрами от ", IP, " обрезана: больше ", MESSAGES_PER_DATAGRAM, " сообщений");
+				break;
+			}
+			Packet pack(const_cast<byte*>(message), length);
+			dispatch(IP, pack, true);
+		}
+	}
+
+	inline void Server::dispatch(const sf::IpAddress& IP, Packet& pack, bool framed) {
+		//Проверяем что в пакете есть код
+		if (!pack.enoughMemory<byte>())
+			return;
+		const byte raw_code = *pack.read<byte>();
+		const auto code = static_cast<ClientCodes>(raw_code & ~SESSION_FLAG);
+
+		//Номер сессии - индекс в таблице сессий, IP только подтверждает отправителя.
+		//У каждого клиента своя сессия, в том числе у клиентов за общим NAT
+		m_session_request = (raw_code & SESSION_FLAG) != 0;
+		PlayerBundle sender = m_players.end();
+		if (m_session_request) {
+			if (!pack.enoughMemory<SessionId>()) {
+				m_log.write("Некорректный пакет: нет номера сессии: ", IP);
+				return;
+			}
+			SessionId session;
+			std::memcpy(&session, pack.read(sizeof(SessionId)), sizeof(SessionId));
+			if (const PlayerBundle* found = m_sessions.find(session)) {
+				if ((*found)->first.ip != IP) {
+					m_log.write("Некорректный пакет: сессия ", session, " принадлежит другому адресу: ", IP);
+					return;
+				}
+				sender = *found;
+			}
+		}
+		//Пакет без сессии или с устаревшей после перезапуска сервера: игрок ищется по IP, если он на адресе один.
+		//REGISTER ищется по IP и порту из заявки: заявка другого клиента того же адреса - новая регистрация
+		if (sender == m_players.end()) {
+			if (code != ClientCodes::REGISTER) {
+				sender = findAddress(IP);
+			} else if (pack.availableSpace() >= Password::LENGTH + sizeof(sf::Uint16)) {
+				sf::Uint16 port;
+				std::memcpy(&port, static_cast<const byte*>(pack.data()) + pack.size() + Password::LENGTH, sizeof(port));
+				sender = findEndpoint(IP, port);
+			}
+		}
+
+		if (sender != m_players.end()) {
+			sender->second.updateLastRequest();
+			if (framed)
+				sender->second.setFramed();
+
+			const SessionId session = sender->second.getSession();
+			DEMONORIUM_SIMPLE_FIND(m_server_response, find, (byte)code, response) {
+				std::mem_fn(response->second)(this, sender->first.ip, sender->second, pack);
+				//Обработчик мог удалить игрока, сценарии ищут его заново по сессии
+				m_flows.signal(session, static_cast<byte>(code));
+			} else {
+				m_log.write(sender->second.getName(), ": Неизвестный код запроса: ", static_cast<int>(code));
+				m_log.write("Содержимое: ", BinaryOutput(pack.data(), pack.size()));
+			}
+		} else {
+			if (code == ClientCodes::REGISTER)
+				registerPlayer(IP, pack, framed);
+			else {
+				m_log.write("Некорректный пакет: ", IP);
+			}
+		}
 	}
 
 	inline void Server::onUnPause() {
 		m_input_thread.run();
 	}
 
+	inline void Server::onInterrupt() {
+		m_wakeup.notify();
+	}
+
 	inline void Server::onDestruction() {
-		endGame();
+		m_flows.clear();
+		//Последний снимок сохраняется до завершения игры, чтобы перезапуск продолжил её
+		publishSnapshot(Clock::update());
+		m_state_writer.destroyThread();
+		endGame(false);
 		
 		for (auto& player : m_players) {
 			player.second.setDefaultState();
 		}
+		flushOutput();
+#if defined(__linux__)
+		m_send_ring.close();
+#endif
+		//Дописать матчи, которые ещё в очереди
+		m_history.destroyThread();
+
+		//Приём на паузе не пишет в захват: остаток кольца дописывается и файл закрывается
+		if (m_capture.containsThread()) {
+			m_input_thread.pause();
+			m_input_thread.setCapture(nullptr);
+			m_capture.destroyThread();
+		}
 	}
 	
-	inline void Server::request(UserRequest request) {
-		auto* request_memory = m_requests.write();
-		std::memcpy(request_memory, &request, sizeof(UserRequest));
-		m_requests.validWrite();
+	inline bool Server::request(UserRequest request) {
+		if (!m_requests.push(request))
+			return false;
+		m_wakeup.notify();
+		return true;
 	}
 }
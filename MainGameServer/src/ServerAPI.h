@@ -13,32 +13,55 @@ namespace demonorium
 		friend class Server;
 		static Server server;
 	public:
-		// ,   
+		//Начальная инициализация, запуск потока сервера
 		static void init();
-		// 
+		//Остановка исполнения
 		static void terminate();
-		// true    
+		//Возвращает true когда сервер окончательно запущен
 		static bool is_launched();
 		
-		//   :   
+		//Смена порта приёма сообщений: старый порт слушается ещё льготный период, пакеты не теряются
 		static void update_port(sf::Uint16 port);
-		//  
+		//Возвращает текущий порт
 		static sf::Uint16 get_port();
 		
-		// IP  127.0.0.1
+		//Смена IP для 127.0.0.1
 		static void set_ip_alias(byte ip0, byte ip1, byte ip2, byte ip3);
 		
-		//  
+		//Возвращает текущий пароль
 		static const char* get_password();
 
-		//    
-		static auto get_game_start_time();
+		//Возвращает время начала последней игры в монотонном времени Clock
+		static tick get_game_start_time();
 		
-		// std::map      ip
-		static const auto& get_player_list();
+		//Возвращает последний опубликованный снимок списка игроков, читать можно из любого потока
+		static RosterBuffer::Reader get_snapshot();
+		//Период публикации снимков списка игроков
+		static void set_snapshot_period(Chrono::delay period);
+		//Предел регистраций в секунду во время всплеска, 0 - без ограничения
+		static void set_admission_rate(uint32 rate);
+		//Период записи файла состояния, из которого сервер восстанавливается при запуске
+		static void set_state_period(Chrono::delay period);
+		//Транспорт приёма и отправки, действует при следующем init
+		static void set_transport(Transport transport);
+		//Склеивание датаграмм ядром (UDP GRO/GSO, только Linux), действует при следующем init
+		static void set_udp_offload(bool enabled);
+		//Счётчики приёма и отправки с запуска, читать можно из любого потока
+		static TransportStats get_transport_stats();
+		//Принято и потеряно пакетов полосы приёма с запуска
+		static LaneStats get_lane_stats(Lane lane);
+		//Записывать принятые датаграммы в файл захвата для CaptureReplay, пустой путь - не записывать. Действует при следующем init
+		static void set_capture(const std::string& path);
+		//Записано и потеряно датаграмм захвата с запуска
+		static CaptureStats get_capture_stats();
 		
-		//    
-		static void request(UserRequest request);
+		//Лучшие игроки за все записанные матчи, читается из файлов истории в вызывающем потоке
+		static std::vector<LeaderboardEntry> get_leaderboard(size_t limit);
+		//Все записанные матчи игрока
+		static std::vector<PlayerMatch> get_player_history(sf::IpAddress ip);
+		
+		//Запрашивает указнное действие у сервера, false если очередь запросов переполнена
+		static bool request(UserRequest request);
 	};
 
 
@@ -63,7 +86,7 @@ namespace demonorium
 		return server.m_input_thread.getPort();
 	}
 
-	inline auto ServerAPI::get_game_start_time() {
+	inline tick ServerAPI::get_game_start_time() {
 		return server.m_chrono.game_start;
 	}
 
@@ -71,15 +94,66 @@ namespace demonorium
 		server.destroyThread();
 	}
 
-	inline const auto& ServerAPI::get_player_list() {
-		return server.m_players;
+	inline RosterBuffer::Reader ServerAPI::get_snapshot() {
+		return server.m_snapshot.read();
+	}
+
+	inline void ServerAPI::set_snapshot_period(Chrono::delay period) {
+		server.m_chrono.snapshot_period.store(period.count());
+	}
+
+	inline void ServerAPI::set_admission_rate(uint32 rate) {
+		server.m_admission.rate.store(rate);
+	}
+
+	inline void ServerAPI::set_state_period(Chrono::delay period) {
+		server.m_state_writer.setPeriod(period);
+	}
+
+	inline void ServerAPI::set_transport(Transport transport) {
+		server.m_transport.store(transport);
+	}
+
+	inline void ServerAPI::set_udp_offload(bool enabled) {
+		server.m_offload.store(enabled);
+	}
+
+	inline LaneStats ServerAPI::get_lane_stats(Lane lane) {
+		return server.m_input_thread.laneStats(lane);
+	}
+
+	inline void ServerAPI::set_capture(const std::string& path) {
+		server.m_capture.setPath(path);
+	}
+
+	inline CaptureStats ServerAPI::get_capture_stats() {
+		return server.m_capture.stats();
+	}
+
+	inline TransportStats ServerAPI::get_transport_stats() {
+		TransportStats stats = server.m_input_thread.stats();
+		stats.sent	 = server.m_sent.load(std::memory_order_relaxed);
+		stats.writes = server.m_writes.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	inline std::vector<LeaderboardEntry> ServerAPI::get_leaderboard(size_t limit) {
+		HistoryReader history;
+		history.open(Server::HISTORY_DIRECTORY);
+		return history.leaderboard(limit);
+	}
+
+	inline std::vector<PlayerMatch> ServerAPI::get_player_history(sf::IpAddress ip) {
+		HistoryReader history;
+		history.open(Server::HISTORY_DIRECTORY);
+		return history.history(ip);
 	}
 
 	inline bool ServerAPI::is_launched() {
 		return server.m_launched.load();
 	}
 
-	inline void ServerAPI::request(UserRequest request) {
-		server.request(request);
+	inline bool ServerAPI::request(UserRequest request) {
+		return server.request(request);
 	}
 }
@@ -0,0 +1,148 @@
+#pragma once
+#include <deque>
+#include <vector>
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Номер сессии игрока: поколение слота в старших 8 битах, номер слота в младших 24.
+	 * Поколение меняется при каждом освобождении слота, поэтому номер ушедшего игрока не находит нового.
+	 * Ноль - нет сессии.
+	 */
+	using SessionId = uint32;
+	static constexpr SessionId NO_SESSION = 0;
+
+
+	/**
+	 * \brief Плотная таблица сессий: номер сессии - индекс в массиве с проверкой поколения.
+	 * Handle - то, по чему владелец находит игрока, например итератор std::map: он не меняется до удаления узла.
+	 * Освобождённые слоты выдаются по очереди освобождения и только когда их накопилось REUSE_AFTER, до этого таблица растёт:
+	 * между двумя выдачами одного слота проходит не меньше REUSE_AFTER освобождений, и 8 бит поколения хватает надолго.
+	 * Не потокобезопасна: таблицей владеет поток сервера.
+	 */
+	template<class Handle>
+	class SessionTable {
+		struct Slot {
+			Handle	handle;
+			byte	generation;
+			bool	used;
+		};
+
+		static constexpr uint32		SLOT_BITS	= 24;
+		static constexpr SessionId	SLOT_MASK	= (SessionId(1) << SLOT_BITS) - 1;
+		static constexpr size_t		MAX_SLOTS	= size_t(SLOT_MASK) + 1;
+		//Свободных слотов, после которого они начинают выдаваться снова
+		static constexpr size_t		REUSE_AFTER	= 4096;
+
+		std::vector<Slot>	m_slots;
+		std::deque<uint32>	m_free;
+		size_t				m_used;
+
+		static SessionId makeId(size_t slot, byte generation);
+		static size_t slotOf(SessionId session);
+		static byte generationOf(SessionId session);
+	public:
+		SessionTable();
+
+		//Выдать сессию, NO_SESSION если все 2^24 слотов заняты
+		SessionId open(const Handle& handle);
+		//Освободить сессию, неизвестный номер игнорируется
+		void close(SessionId session);
+		//Игрок сессии или nullptr, если номер устарел или не выдавался
+		Handle* find(SessionId session);
+		//Освободить все сессии, старые номера перестают находиться
+		void clear();
+
+		size_t size() const;
+	};
+
+
+	template <class Handle>
+	SessionId SessionTable<Handle>::makeId(size_t slot, byte generation) {
+		return (SessionId(generation) << SLOT_BITS) | SessionId(slot);
+	}
+
+	template <class Handle>
+	size_t SessionTable<Handle>::slotOf(SessionId session) {
+		return session & SLOT_MASK;
+	}
+
+	template <class Handle>
+	byte SessionTable<Handle>::generationOf(SessionId session) {
+		return static_cast<byte>(session >> SLOT_BITS);
+	}
+
+	template <class Handle>
+	SessionTable<Handle>::SessionTable():
+		m_used(0) {
+	}
+
+	template <class Handle>
+	SessionId SessionTable<Handle>::open(const Handle& handle) {
+		size_t slot;
+		if ((m_free.size() >= REUSE_AFTER) || (!m_free.empty() && (m_slots.size() == MAX_SLOTS))) {
+			slot = m_free.front();
+			m_free.pop_front();
+		} else if (m_slots.size() < MAX_SLOTS) {
+			slot = m_slots.size();
+			//Поколение 0 у слота 0 дало бы NO_SESSION
+			m_slots.push_back(Slot{handle, 1, false});
+		} else {
+			return NO_SESSION;
+		}
+
+		Slot& entry = m_slots[slot];
+		entry.handle = handle;
+		entry.used	 = true;
+		++m_used;
+		return makeId(slot, entry.generation);
+	}
+
+	template <class Handle>
+	void SessionTable<Handle>::close(SessionId session) {
+		const size_t slot = slotOf(session);
+		if ((slot >= m_slots.size()) || !m_slots[slot].used || (m_slots[slot].generation != generationOf(session)))
+			return;
+
+		Slot& entry = m_slots[slot];
+		entry.used = false;
+		if (++entry.generation == 0)
+			entry.generation = 1;
+		m_free.push_back(static_cast<uint32>(slot));
+		--m_used;
+	}
+
+	template <class Handle>
+	Handle* SessionTable<Handle>::find(SessionId session) {
+		const size_t slot = slotOf(session);
+		if ((slot >= m_slots.size()) || !m_slots[slot].used || (m_slots[slot].generation != generationOf(session)))
+			return nullptr;
+		return &m_slots[slot].handle;
+	}
+
+	template <class Handle>
+	void SessionTable<Handle>::clear() {
+		m_free.clear();
+		for (size_t slot = 0; slot < m_slots.size(); ++slot) {
+			Slot& entry = m_slots[slot];
+			if (entry.used) {
+				entry.used = false;
+				if (++entry.generation == 0)
+					entry.generation = 1;
+			}
+			m_free.push_back(static_cast<uint32>(slot));
+		}
+		m_used = 0;
+	}
+
+	template <class Handle>
+	size_t SessionTable<Handle>::size() const {
+		return m_used;
+	}
+}
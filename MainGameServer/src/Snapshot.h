@@ -0,0 +1,175 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <SFML/Network.hpp>
+#include <DSFML/Aliases.h>
+
+#include "Clock.h"
+#include "Name.h"
+#include "SessionTable.h"
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Двойной буфер неизменяемых снимков: один поток пишет, любое число потоков читает без блокировок.
+	 * Писатель заполняет страницу, которую сейчас никто не читает, и публикует её одной атомарной записью.
+	 * Если старую страницу ещё держит читатель, публикация пропускается до следующего раза.
+	 */
+	template<class T>
+	class SnapshotBuffer {
+		T m_pages[2];
+		mutable std::atomic<unsigned> m_readers[2];
+		std::atomic<byte> m_current;
+	public:
+		/**
+		 * \brief Доступ к опубликованному снимку, пока объект жив страница не будет перезаписана
+		 */
+		class Reader {
+			const SnapshotBuffer* m_owner;
+			byte m_page;
+		public:
+			Reader(const SnapshotBuffer* owner, byte page);
+			Reader(Reader&& other) noexcept;
+			Reader(const Reader&) = delete;
+			Reader& operator =(const Reader&) = delete;
+			Reader& operator =(Reader&&) = delete;
+			~Reader();
+
+			const T& get() const;
+			const T* operator->() const;
+			const T& operator*() const;
+		};
+
+		SnapshotBuffer();
+
+		//Захватить последний опубликованный снимок
+		Reader read() const;
+
+		/**
+		 * \brief Получить страницу для заполнения, после заполнения нужно вызвать publish
+		 * \return nullptr, если страницу ещё читают
+		 */
+		T* write();
+
+		//Сделать заполненную страницу текущей
+		void publish();
+	};
+
+
+	//Состояние игрока на момент снимка
+	struct PlayerView {
+		sf::IpAddress	ip;
+		//Сессия отличает игроков одного адреса
+		SessionId		session;
+		sf::IpAddress	killer;
+		Name			name;
+		sf::Uint16		port;
+		bool			ready;
+		bool			alive;
+		size_t			kills;
+		//Время смерти в секундах от начала игры, имеет смысл только если !alive
+		long long		die_time;
+		//Момент смерти в монотонном времени Clock
+		tick			died;
+		//Версия снимка, в которой запись последний раз менялась
+		size_t			revision;
+
+		//Совпадает ли состояние игрока, без учёта revision
+		bool sameState(const PlayerView& other) const;
+	};
+
+	//Список игроков, публикуемый потоком сервера для интерфейса
+	struct RosterSnapshot {
+		//Номер снимка, растёт с каждой публикацией
+		size_t version = 0;
+		//Версия, в которой последний раз менялся состав игроков (порядок записей)
+		size_t structure_version = 0;
+		bool game_started = false;
+		bool ready_testing = false;
+		bool game_ended = false;
+		//Момент публикации и начала игры в монотонном времени Clock
+		tick time = 0;
+		tick game_start = 0;
+		std::vector<PlayerView> players;
+		//Позиции записей, изменившихся относительно предыдущего снимка при том же составе
+		std::vector<uint32> changed;
+	};
+
+	using RosterBuffer = SnapshotBuffer<RosterSnapshot>;
+
+
+	inline bool PlayerView::sameState(const PlayerView& other) const {
+		return (killer == other.killer) && (port == other.port) &&
+			(ready == other.ready) && (alive == other.alive) &&
+			(kills == other.kills) && (die_time == other.die_time) &&
+			(name == other.name);
+	}
+
+	template <class T>
+	SnapshotBuffer<T>::Reader::Reader(const SnapshotBuffer* owner, byte page):
+		m_owner(owner), m_page(page) {
+	}
+
+	template <class T>
+	SnapshotBuffer<T>::Reader::Reader(Reader&& other) noexcept:
+		m_owner(other.m_owner), m_page(other.m_page) {
+		other.m_owner = nullptr;
+	}
+
+	template <class T>
+	SnapshotBuffer<T>::Reader::~Reader() {
+		if (m_owner)
+			m_owner->m_readers[m_page].fetch_sub(1);
+	}
+
+	template <class T>
+	const T& SnapshotBuffer<T>::Reader::get() const {
+		return m_owner->m_pages[m_page];
+	}
+
+	template <class T>
+	const T* SnapshotBuffer<T>::Reader::operator->() const {
+		return &get();
+	}
+
+	template <class T>
+	const T& SnapshotBuffer<T>::Reader::operator*() const {
+		return get();
+	}
+
+	template <class T>
+	SnapshotBuffer<T>::SnapshotBuffer():
+		m_readers{0, 0}, m_current(0) {
+	}
+
+	template <class T>
+	typename SnapshotBuffer<T>::Reader SnapshotBuffer<T>::read() const {
+		while (true) {
+			const byte page = m_current.load();
+			m_readers[page].fetch_add(1);
+			//Страница могла смениться между чтением номера и захватом, тогда писатель может её переписывать
+			if (m_current.load() == page)
+				return Reader(this, page);
+			m_readers[page].fetch_sub(1);
+		}
+	}
+
+	template <class T>
+	T* SnapshotBuffer<T>::write() {
+		const byte back = 1 - m_current.load();
+		if (m_readers[back].load() != 0)
+			return nullptr;
+		return &m_pages[back];
+	}
+
+	template <class T>
+	void SnapshotBuffer<T>::publish() {
+		m_current.store(1 - m_current.load());
+	}
+}
@@ -0,0 +1,300 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "BaseThread.h"
+#include "Clock.h"
+#include "Log.h"
+#include "MappedFile.h"
+#include "Snapshot.h"
+#include "Wakeup.h"
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/*
+	 * Файл состояния сервера: [StateHeader][StateRecord x players][имена подряд].
+	 * Числа в порядке байт машины, адреса - sf::IpAddress::toInteger.
+	 * Записи упорядочены по IP, как в списке игроков сервера, поэтому восстановление вставляет их в конец.
+	 * Времена хранятся относительно начала игры: монотонные часы нового процесса начинаются заново.
+	 */
+	struct StateHeader {
+		char	magic[8];
+		uint32	format;
+		uint32	players;
+		//Версия снимка, с которого сделан файл
+		uint64	version;
+		//Сколько миллисекунд шла игра на момент снимка
+		int64	game_time;
+		uint32	names_size;
+		byte	game_started;
+		byte	ready_testing;
+		byte	game_ended;
+		byte	reserved;
+	};
+
+	struct StateRecord {
+		enum Flags: byte {
+			READY = 1,
+			ALIVE = 2
+		};
+
+		uint32	ip;
+		uint32	killer;
+		//Момент смерти в миллисекундах от начала игры
+		int32	died;
+		uint32	kills;
+		//Смещение имени от начала блока имён
+		uint32	name_offset;
+		uint16	port;
+		uint16	name_size;
+		byte	flags;
+		byte	reserved[3];
+	};
+
+	static_assert(sizeof(StateHeader) == 40, "StateHeader layout is part of the file format");
+	static_assert(sizeof(StateRecord) == 28, "StateRecord layout is part of the file format");
+
+	constexpr char   STATE_MAGIC[8] = {'M', 'G', 'S', 'S', 'T', 'A', 'T', 'E'};
+	constexpr uint32 STATE_FORMAT	= 1;
+
+
+	/**
+	 * \brief Файл состояния, отображённый в память. Записи читаются прямо из отображения без копирования.
+	 */
+	class StateReader {
+		MappedFile			m_file;
+		const StateHeader*	m_header;
+		const StateRecord*	m_records;
+		const char*			m_names;
+	public:
+		StateReader();
+
+		//Открыть и проверить файл, false если файла нет или он повреждён
+		bool open(const std::string& path);
+		void close();
+
+		const StateHeader& header() const;
+		size_t size() const;
+		const StateRecord& operator[](size_t index) const;
+		std::string_view name(const StateRecord& record) const;
+	};
+
+
+	/**
+	 * \brief Фоновая запись файла состояния.
+	 * Поток берёт последний опубликованный снимок списка игроков - неизменяемую страницу SnapshotBuffer,
+	 * которую сервер не трогает, пока её держат, - и сериализует его, не останавливая поток сервера.
+	 * Файл заменяется целиком через переименование, поэтому падение во время записи оставляет прошлый файл.
+	 */
+	class StateWriter: public BaseThread {
+		const RosterBuffer&	m_source;
+		const std::string	m_path;
+		std::atomic<Clock::delay::rep> m_period;
+		tick				m_last_write;
+
+		//Что уже записано: старшая ревизия записей и флаги игры
+		size_t				m_written_revision;
+		byte				m_written_flags;
+		bool				m_written;
+
+		std::vector<byte>	m_buffer;
+		Log					m_log;
+		//Поток спит до следующей записи, pause, destroyThread и смена периода будят его раньше
+		Wakeup				m_wakeup;
+
+		/**
+		 * \brief Сериализовать последний снимок в m_buffer
+		 * \param revision, flags - старшая ревизия и флаги игры сериализованного снимка
+		 * \return false, если с прошлой записи ничего не изменилось
+		 */
+		bool serialize(size_t& revision, byte& flags);
+		//Записать файл, если состояние изменилось
+		void flush();
+	protected:
+		void onInit() override;
+		void onFrame() override;
+		void onDestruction() override;
+		void onInterrupt() override;
+	public:
+		StateWriter(const RosterBuffer& source, std::string path, Clock::delay period);
+		~StateWriter() override;
+
+		void setPeriod(Clock::delay period);
+	};
+
+
+	inline StateReader::StateReader():
+		m_header(nullptr), m_records(nullptr), m_names(nullptr) {
+	}
+
+	inline bool StateReader::open(const std::string& path) {
+		close();
+		if (!m_file.open(path))
+			return false;
+
+		const auto* begin = static_cast<const byte*>(m_file.data());
+		const size_t size = m_file.size();
+		const auto* header = reinterpret_cast<const StateHeader*>(begin);
+		if ((size < sizeof(StateHeader)) ||
+			(std::memcmp(header->magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) ||
+			(header->format != STATE_FORMAT) ||
+			(size != sizeof(StateHeader) + size_t(header->players) * sizeof(StateRecord) + header->names_size)) {
+			close();
+			return false;
+		}
+
+		m_header  = header;
+		m_records = reinterpret_cast<const StateRecord*>(begin + sizeof(StateHeader));
+		m_names	  = reinterpret_cast<const char*>(m_records + header->players);
+		for (size_t i = 0; i < header->players; ++i) {
+			if (size_t(m_records[i].name_offset) + m_records[i].name_size > header->names_size) {
+				close();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	inline void StateReader::close() {
+		m_file.close();
+		m_header  = nullptr;
+		m_records = nullptr;
+		m_names	  = nullptr;
+	}
+
+	inline const StateHeader& StateReader::header() const {
+		return *m_header;
+	}
+
+	inline size_t StateReader::size() const {
+		return m_header ? m_header->players : 0;
+	}
+
+	inline const StateRecord& StateReader::operator[](size_t index) const {
+		return m_records[index];
+	}
+
+	inline std::string_view StateReader::name(const StateRecord& record) const {
+		return std::string_view(m_names + record.name_offset, record.name_size);
+	}
+
+	inline bool StateWriter::serialize(size_t& revision, byte& flags) {
+		const auto snapshot = m_source.read();
+
+		revision = snapshot->structure_version;
+		size_t names_size = 0;
+		for (const auto& player : snapshot->players) {
+			revision = std::max(revision, player.revision);
+			names_size += std::min<size_t>(player.name.view().size(), UINT16_MAX);
+		}
+		flags = static_cast<byte>(snapshot->game_started | (snapshot->ready_testing << 1) | (snapshot->game_ended << 2));
+
+		//Во время игры файл обновляется каждый период: в нём хранится, сколько игра уже идёт
+		if (m_written && !snapshot->game_started && (revision == m_written_revision) && (flags == m_written_flags))
+			return false;
+
+		m_buffer.resize(sizeof(StateHeader) + snapshot->players.size() * sizeof(StateRecord) + names_size);
+		auto* header  = reinterpret_cast<StateHeader*>(m_buffer.data());
+		auto* records = reinterpret_cast<StateRecord*>(m_buffer.data() + sizeof(StateHeader));
+		char* names	  = reinterpret_cast<char*>(records + snapshot->players.size());
+
+		std::memset(header, 0, sizeof(StateHeader));
+		std::memcpy(header->magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+		header->format		  = STATE_FORMAT;
+		header->players		  = static_cast<uint32>(snapshot->players.size());
+		header->version		  = snapshot->version;
+		header->game_time	  = Clock::between(snapshot->game_start, snapshot->time).count();
+		header->names_size	  = static_cast<uint32>(names_size);
+		header->game_started  = snapshot->game_started;
+		header->ready_testing = snapshot->ready_testing;
+		header->game_ended	  = snapshot->game_ended;
+
+		uint32 offset = 0;
+		for (const auto& player : snapshot->players) {
+			const auto name = player.name.view();
+			const uint16 name_size = static_cast<uint16>(std::min<size_t>(name.size(), UINT16_MAX));
+			StateRecord record{};
+			record.ip		   = player.ip.toInteger();
+			record.killer	   = player.killer.toInteger();
+			record.died		   = Clock::between(snapshot->game_start, player.died).count();
+			record.kills	   = static_cast<uint32>(player.kills);
+			record.name_offset = offset;
+			record.port		   = player.port;
+			record.name_size   = name_size;
+			record.flags	   = (player.ready ? StateRecord::READY : 0) | (player.alive ? StateRecord::ALIVE : 0);
+			std::memcpy(records++, &record, sizeof(StateRecord));
+
+			std::memcpy(names + offset, name.data(), name_size);
+			offset += name_size;
+		}
+		return true;
+	}
+
+	inline void StateWriter::flush() {
+		//Снимок отпускается до работы с диском, чтобы сервер мог публиковать следующий
+		size_t revision;
+		byte flags;
+		if (!serialize(revision, flags))
+			return;
+
+		if (MappedFile::replace(m_path, m_buffer.data(), m_buffer.size())) {
+			m_written_revision = revision;
+			m_written_flags	   = flags;
+			m_written		   = true;
+		} else {
+			m_log.write("Не удалось записать файл состояния ", m_path);
+		}
+	}
+
+	inline void StateWriter::onInit() {
+		m_log.open("State.log");
+		m_last_write = Clock::update();
+	}
+
+	inline void StateWriter::onFrame() {
+		const tick now = Clock::update();
+		const Clock::delay left = Clock::delay(m_period.load()) - Clock::between(m_last_write, now);
+		if (left.count() > 0) {
+			m_wakeup.wait(m_wakeup.prepare(), left);
+			return;
+		}
+		m_last_write = now;
+		flush();
+	}
+
+	inline void StateWriter::onDestruction() {
+		flush();
+	}
+
+	inline void StateWriter::onInterrupt() {
+		m_wakeup.notify();
+	}
+
+	inline StateWriter::StateWriter(const RosterBuffer& source, std::string path, Clock::delay period):
+		m_source(source), m_path(std::move(path)), m_period(period.count()),
+		m_last_write(0), m_written_revision(0), m_written_flags(0), m_written(false) {
+	}
+
+	inline StateWriter::~StateWriter() {
+		if (containsThread())
+			destroyThread();
+	}
+
+	inline void StateWriter::setPeriod(Clock::delay period) {
+		m_period.store(period.count());
+		m_wakeup.notify();
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Колесо таймеров: время делится на тики, каждый тик попадает в слот по модулю числа слотов.
+	 * Постановка таймера O(1), продвижение времени просматривает только слоты пройденных тиков,
+	 * таймеры дальше одного оборота колеса остаются в слоте до своего оборота.
+	 */
+	template<class T>
+	class TimerWheel {
+		struct Entry {
+			uint64	tick;
+			T		value;
+		};
+
+		std::vector<std::vector<Entry>> m_slots;
+		std::vector<T> m_expired;
+		const size_t m_mask;
+		//Последний обработанный тик
+		uint64 m_current;
+		size_t m_size;
+
+		static size_t roundSlots(size_t slots);
+	public:
+		//Число слотов округляется вверх до степени двойки
+		explicit TimerWheel(size_t slots, uint64 start = 0);
+
+		//Запланировать value на тик tick, прошедшие тики переносятся на следующий
+		void schedule(uint64 tick, T value);
+
+		/**
+		 * \brief Продвинуть время до тика now включительно
+		 * \param callback вызывается для каждого наступившего таймера, может ставить новые таймеры
+		 */
+		template<class F>
+		void advance(uint64 now, F&& callback);
+
+		//Удалить все таймеры
+		void clear();
+
+		size_t size() const;
+		uint64 current() const;
+	};
+
+
+	template <class T>
+	size_t TimerWheel<T>::roundSlots(size_t slots) {
+		size_t result = 2;
+		while (result < slots)
+			result <<= 1;
+		return result;
+	}
+
+	template <class T>
+	TimerWheel<T>::TimerWheel(size_t slots, uint64 start):
+		m_slots(roundSlots(slots)), m_mask(roundSlots(slots) - 1),
+		m_current(start), m_size(0) {
+	}
+
+	template <class T>
+	void TimerWheel<T>::schedule(uint64 tick, T value) {
+		tick = std::max(tick, m_current + 1);
+		m_slots[tick & m_mask].push_back(Entry{tick, std::move(value)});
+		++m_size;
+	}
+
+	template <class T>
+	template <class F>
+	void TimerWheel<T>::advance(uint64 now, F&& callback) {
+		if (now <= m_current)
+			return;
+
+		//За один полный оборот просматривается каждый слот, дальше идти незачем
+		const uint64 last = std::min<uint64>(now, m_current + m_mask + 1);
+		for (uint64 tick = m_current + 1; tick <= last; ++tick) {
+			auto& slot = m_slots[tick & m_mask];
+			for (size_t i = 0; i < slot.size();) {
+				if (slot[i].tick <= now) {
+					m_expired.push_back(std::move(slot[i].value));
+					slot[i] = std::move(slot.back());
+					slot.pop_back();
+				} else {
+					++i;
+				}
+			}
+		}
+		m_current = now;
+		m_size -= m_expired.size();
+
+		//Обработчики вызываются после обхода, чтобы новые таймеры не меняли слоты под ногами
+		std::vector<T> expired;
+		expired.swap(m_expired);
+		for (auto& value : expired)
+			callback(value);
+		expired.clear();
+		if (m_expired.empty())
+			m_expired.swap(expired);
+	}
+
+	template <class T>
+	void TimerWheel<T>::clear() {
+		for (auto& slot : m_slots)
+			slot.clear();
+		m_size = 0;
+	}
+
+	template <class T>
+	size_t TimerWheel<T>::size() const {
+		return m_size;
+	}
+
+	template <class T>
+	uint64 TimerWheel<T>::current() const {
+		return m_current;
+	}
+}
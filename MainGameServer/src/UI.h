@@ -4,17 +4,30 @@
 #include "imgui.h"
 #include "imgui-SFML.h"
 #include <array>
-#include <SFML\Graphics.hpp>
+#include <cstring>
+#include <vector>
+#include <SFML/Graphics.hpp>
 #include <SFML/System/Clock.hpp>
 #include <SFML/Window/Event.hpp>
 
 #include "ServerAPI.h"
 #include "Player.h"
+#include "RosterIndex.h"
 
 namespace demonorium
 {
 	
 	class Window {
+		//Отформатированные ячейки строки списка игроков
+		struct RowCache {
+			//revision записи снимка, для которой собраны строки, 0 - не собраны
+			size_t revision = 0;
+			std::string ip;
+			std::string kills;
+			std::string die_time;
+			std::string killer;
+		};
+		
 		sf::RenderWindow m_window;
 		ImGuiWindowFlags m_flags;
 		sf::Clock m_delta_clock;
@@ -22,10 +35,21 @@ namespace demonorium
 		std::array<char, 32> m_port_input_buffer;
 		std::array<char, 8> m_ip0, m_ip1, m_ip2, m_ip3;
 
+		//Строки форматируются только для видимых записей и только при смене их revision
+		std::vector<RowCache> m_rows;
+		size_t m_rows_structure;
+
+		RosterIndex m_index;
+		std::array<char, 32> m_name_filter;
+		std::array<char, 16> m_ip_filter;
+		bool m_alive_only;
+
 		void processEvents();
 		void screen();
 		void guiRender();
 
+		static void format_row(const PlayerView& player, RowCache& row);
+		void draw_player_filter();
 		void draw_player_list();
 		void draw_port_control();
 		void draw_ip_control();
@@ -90,62 +114,104 @@ namespace demonorium
 		m_window.display();
 	}
 
-	inline void Window::draw_player_list() {
-		if (ImGui::BeginListBox("Player List", { static_cast<float>(m_window.getSize().x / 2), static_cast<float>(m_window.getSize().y * 0.9) })) {
-			if (ImGui::BeginTable("Players", 6, ImGuiTableFlags_Borders)) {
-				ImGui::TableNextRow();
-				ImGui::TableNextColumn();
-				ImGui::Text("IP");
-
-				ImGui::TableNextColumn();
-				ImGui::Text("NAME");
-
-				ImGui::TableNextColumn();
-				ImGui::Text("READY");
-
-
-				ImGui::TableNextColumn();
-				ImGui::Text("KILLS");
+	inline void Window::format_row(const PlayerView& player, RowCache& row) {
+		row.ip = player.ip.toString();
+		row.kills = std::to_string(player.kills);
+		if (!player.alive) {
+			row.die_time = std::to_string(player.die_time);
+			row.killer = player.killer.toString();
+		}
+		row.revision = player.revision;
+	}
 
-				ImGui::TableNextColumn();
-				ImGui::Text("D-TIME");
+	inline void Window::draw_player_filter() {
+		bool changed = false;
+		
+		ImGui::SetNextItemWidth(static_cast<float>(m_window.getSize().x / 6));
+		changed |= ImGui::InputText("Name##filter", m_name_filter.data(), m_name_filter.size());
+		ImGui::SameLine();
+		ImGui::SetNextItemWidth(static_cast<float>(m_window.getSize().x / 8));
+		changed |= ImGui::InputText("IP##filter", m_ip_filter.data(), m_ip_filter.size());
+		ImGui::SameLine();
+		changed |= ImGui::Checkbox("Alive", &m_alive_only);
+
+		if (changed) {
+			RosterFilter filter;
+			filter.name = m_name_filter.data();
+			filter.ip = m_ip_filter.data();
+			filter.alive_only = m_alive_only;
+			m_index.setFilter(std::move(filter));
+		}
+	}
 
-				ImGui::TableNextColumn();
-				ImGui::Text("KILLED BY");
+	inline void Window::draw_player_list() {
+		draw_player_filter();
+
+		constexpr ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Sortable;
+		const ImVec2 size(static_cast<float>(m_window.getSize().x / 2), static_cast<float>(m_window.getSize().y * 0.85));
+
+		if (ImGui::BeginTable("Players", 6, flags, size)) {
+			ImGui::TableSetupScrollFreeze(0, 1);
+			ImGui::TableSetupColumn("IP", ImGuiTableColumnFlags_DefaultSort, 0.0f, static_cast<ImGuiID>(RosterOrder::IP));
+			ImGui::TableSetupColumn("NAME", ImGuiTableColumnFlags_None, 0.0f, static_cast<ImGuiID>(RosterOrder::NAME));
+			ImGui::TableSetupColumn("READY", ImGuiTableColumnFlags_NoSort);
+			ImGui::TableSetupColumn("KILLS", ImGuiTableColumnFlags_PreferSortDescending, 0.0f, static_cast<ImGuiID>(RosterOrder::KILLS));
+			ImGui::TableSetupColumn("D-TIME", ImGuiTableColumnFlags_None, 0.0f, static_cast<ImGuiID>(RosterOrder::ALIVE));
+			ImGui::TableSetupColumn("KILLED BY", ImGuiTableColumnFlags_NoSort);
+			ImGui::TableHeadersRow();
+
+			ImGuiTableSortSpecs* specs = ImGui::TableGetSortSpecs();
+			if ((specs != nullptr) && specs->SpecsDirty) {
+				if (specs->SpecsCount > 0) {
+					m_index.setOrder(
+						static_cast<RosterOrder>(specs->Specs[0].ColumnUserID),
+						specs->Specs[0].SortDirection == ImGuiSortDirection_Descending);
+				}
+				specs->SpecsDirty = false;
+			}
 
+			const auto snapshot = ServerAPI::get_snapshot();
+			m_index.update(*snapshot);
+			if (snapshot->structure_version != m_rows_structure) {
+				m_rows.assign(snapshot->players.size(), RowCache());
+				m_rows_structure = snapshot->structure_version;
+			}
 
-				ImGui::TableNextRow();
-				std::string UI_NAME = "Port control";
-				int i = 0;
+			//Рисуются только видимые строки, стоимость кадра не зависит от размера списка
+			ImGuiListClipper clipper;
+			clipper.Begin(static_cast<int>(m_index.size()));
+			while (clipper.Step()) {
+				for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+					const uint32 position = m_index[i];
+					const auto& player = snapshot->players[position];
+					auto& row = m_rows[position];
+					if (row.revision != player.revision)
+						format_row(player, row);
 
-				for (const auto& bundle : ServerAPI::get_player_list()) {
+					ImGui::TableNextRow();
 					ImGui::TableNextColumn();
-					ImGui::Text(bundle.first.toString().c_str());
+					ImGui::TextUnformatted(row.ip.c_str());
 
 					ImGui::TableNextColumn();
-					ImGui::Text(bundle.second.getName().c_str());
+					const auto name = player.name.view();
+					ImGui::TextUnformatted(name.data(), name.data() + name.size());
 
 					ImGui::TableNextColumn();
-					ImGui::Text(bundle.second.isReady() ? C_YES : C_NO);
+					ImGui::TextUnformatted(player.ready ? C_YES : C_NO);
 
 					ImGui::TableNextColumn();
-					ImGui::Text(std::to_string(bundle.second.getKillCounter()).c_str());
+					ImGui::TextUnformatted(row.kills.c_str());
 
-					if (!bundle.second.alive()) {
+					if (!player.alive) {
 						ImGui::TableNextColumn();
-						ImGui::Text(std::to_string(std::chrono::duration_cast<chrono::seconds>(bundle.second.getDieTime() - ServerAPI::get_game_start_time()).count()).c_str());
+						ImGui::TextUnformatted(row.die_time.c_str());
 
 						ImGui::TableNextColumn();
-						ImGui::Text(bundle.second.getKillerIP().toString().c_str());
+						ImGui::TextUnformatted(row.killer.c_str());
 					}
-
-					ImGui::TableNextRow();
-					++i;
 				}
-				ImGui::EndTable();
 			}
-
-			ImGui::EndListBox();
+			ImGui::EndTable();
 		}
 	}
 
@@ -242,11 +308,15 @@ namespace demonorium
 
 	inline Window::Window(ImGuiWindowFlags flags, unsigned short defaultPort, bool start):
 		m_window(sf::VideoMode(1024, 640), "Game server UI"),
-		m_flags(flags) {
+		m_flags(flags), m_rows_structure(0), m_alive_only(false) {
 		m_window.setFramerateLimit(60);
 		
 		for (auto& ch : m_port_input_buffer)
 			ch = '\0';
+		for (auto& ch : m_name_filter)
+			ch = '\0';
+		for (auto& ch : m_ip_filter)
+			ch = '\0';
 
 		for (auto& ch : m_ip0)
 			ch = '\0';
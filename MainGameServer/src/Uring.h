@@ -0,0 +1,365 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	//Способ приёма и отправки датаграмм, выбирается до запуска сервера
+	enum class Transport: byte {
+		SOCKETS = 0,	//Сокеты SFML, на любой системе
+		URING	= 1		//io_uring, только Linux. Если ядро его не даёт - SOCKETS
+	};
+
+#if defined(__linux__)
+	/**
+	 * \brief Кольцо io_uring без liburing: очередь заявок, очередь завершений и системные вызовы к ним.
+	 * Заявки копятся через prepare и уходят ядру одним enter, завершения читаются из общей памяти без вызовов.
+	 * Пользуется кольцом один поток.
+	 */
+	class Uring {
+		int				m_fd;
+		byte*			m_sq_map;
+		size_t			m_sq_map_size;
+		byte*			m_cq_map;
+		size_t			m_cq_map_size;
+		io_uring_sqe*	m_sqes;
+		size_t			m_sqes_size;
+
+		unsigned*		m_sq_head;
+		unsigned*		m_sq_tail;
+		unsigned*		m_sq_array;
+		unsigned		m_sq_mask;
+		unsigned		m_sq_entries;
+		//Заявки, подготовленные, но ещё не переданные ядру
+		unsigned		m_prepared;
+
+		unsigned*		m_cq_head;
+		unsigned*		m_cq_tail;
+		unsigned		m_cq_mask;
+		io_uring_cqe*	m_cqes;
+	public:
+		Uring();
+		~Uring();
+		Uring(const Uring&) = delete;
+		Uring& operator =(const Uring&) = delete;
+
+		/**
+		 * \brief Создать кольцо
+		 * \param entries - мест для заявок, completions - мест для завершений
+		 * \return false, если ядро не поддерживает io_uring или ожидание с таймаутом
+		 */
+		bool open(unsigned entries, unsigned completions);
+		void close();
+		bool isOpen() const;
+		//Мест для заявок
+		unsigned capacity() const;
+
+		/**
+		 * \brief Обнулённая заявка. Если очередь заполнена подготовленными заявками, они сначала уходят ядру.
+		 * \return nullptr, если ядро не приняло заявки и места нет
+		 */
+		io_uring_sqe* prepare();
+		/**
+		 * \brief Передать подготовленные заявки и дождаться wait завершений, но не дольше timeout.
+		 * Отрицательный timeout - ждать без ограничения. Без заявок и ожидания системного вызова нет.
+		 * \return число принятых заявок или -errno
+		 */
+		int enter(unsigned wait, std::chrono::milliseconds timeout);
+
+		//Первое непрочитанное завершение, nullptr если их нет
+		io_uring_cqe* peek();
+		//Отметить первое завершение прочитанным
+		void pop();
+
+	};
+
+
+	/**
+	 * \brief Буферы для приёма, из которых ядро само берёт буфер под каждую датаграмму.
+	 * Буферы передаются ядру заявками PROVIDE_BUFFERS: они есть с 5.7, в отличие от кольца буферов,
+	 * которое работает не на всех ядрах. Номер буфера приходит в завершении, после разбора буфер
+	 * возвращается через recycle - заявкой без завершения, она уходит со следующим enter.
+	 * Закрывать после кольца Uring: до этого ядро может писать в буферы.
+	 */
+	class UringBuffers {
+		Uring*	m_ring;
+		byte*	m_memory;
+		size_t	m_memory_size;
+		unsigned m_count;
+		size_t	m_size;
+		uint16	m_group;
+
+		//Заявка на передачу ядру count буферов подряд, начиная с id
+		bool provide(uint16 id, unsigned count, bool silent);
+	public:
+		UringBuffers();
+		~UringBuffers();
+		UringBuffers(const UringBuffers&) = delete;
+		UringBuffers& operator =(const UringBuffers&) = delete;
+
+		//size - размер одного буфера, ждёт, пока ядро примет все буферы
+		bool open(Uring& ring, unsigned count, size_t size, uint16 group);
+		void close();
+
+		byte* buffer(uint16 id) const;
+		size_t bufferSize() const;
+		uint16 group() const;
+		//Вернуть буфер ядру
+		void recycle(uint16 id);
+	};
+
+
+	inline Uring::Uring():
+		m_fd(-1),
+		m_sq_map(nullptr), m_sq_map_size(0),
+		m_cq_map(nullptr), m_cq_map_size(0),
+		m_sqes(nullptr), m_sqes_size(0),
+		m_sq_head(nullptr), m_sq_tail(nullptr), m_sq_array(nullptr),
+		m_sq_mask(0), m_sq_entries(0), m_prepared(0),
+		m_cq_head(nullptr), m_cq_tail(nullptr), m_cq_mask(0), m_cqes(nullptr) {
+	}
+
+	inline Uring::~Uring() {
+		close();
+	}
+
+	inline bool Uring::open(unsigned entries, unsigned completions) {
+		close();
+
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		params.flags	  = IORING_SETUP_CQSIZE;
+		params.cq_entries = completions;
+
+		m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+		if (m_fd < 0)
+			return false;
+		//Ожидание с таймаутом нужно потоку приёма, чтобы замечать паузу и смену порта
+		if ((params.features & IORING_FEAT_EXT_ARG) == 0) {
+			close();
+			return false;
+		}
+
+		m_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single)
+			m_sq_map_size = m_cq_map_size = std::max(m_sq_map_size, m_cq_map_size);
+
+		void* sq = mmap(nullptr, m_sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+		if (sq == MAP_FAILED) {
+			close();
+			return false;
+		}
+		m_sq_map = static_cast<byte*>(sq);
+
+		if (single) {
+			m_cq_map = m_sq_map;
+		} else {
+			void* cq = mmap(nullptr, m_cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+			if (cq == MAP_FAILED) {
+				close();
+				return false;
+			}
+			m_cq_map = static_cast<byte*>(cq);
+		}
+
+		m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) {
+			close();
+			return false;
+		}
+		m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+		m_sq_head	 = reinterpret_cast<unsigned*>(m_sq_map + params.sq_off.head);
+		m_sq_tail	 = reinterpret_cast<unsigned*>(m_sq_map + params.sq_off.tail);
+		m_sq_array	 = reinterpret_cast<unsigned*>(m_sq_map + params.sq_off.array);
+		m_sq_mask	 = *reinterpret_cast<unsigned*>(m_sq_map + params.sq_off.ring_mask);
+		m_sq_entries = params.sq_entries;
+		m_prepared	 = 0;
+
+		m_cq_head = reinterpret_cast<unsigned*>(m_cq_map + params.cq_off.head);
+		m_cq_tail = reinterpret_cast<unsigned*>(m_cq_map + params.cq_off.tail);
+		m_cq_mask = *reinterpret_cast<unsigned*>(m_cq_map + params.cq_off.ring_mask);
+		m_cqes	  = reinterpret_cast<io_uring_cqe*>(m_cq_map + params.cq_off.cqes);
+		return true;
+	}
+
+	inline void Uring::close() {
+		if (m_sqes)
+			munmap(m_sqes, m_sqes_size);
+		if (m_cq_map && (m_cq_map != m_sq_map))
+			munmap(m_cq_map, m_cq_map_size);
+		if (m_sq_map)
+			munmap(m_sq_map, m_sq_map_size);
+		if (m_fd >= 0)
+			::close(m_fd);
+
+		m_fd	   = -1;
+		m_sq_map   = nullptr;
+		m_cq_map   = nullptr;
+		m_sqes	   = nullptr;
+		m_prepared = 0;
+	}
+
+	inline bool Uring::isOpen() const {
+		return m_fd >= 0;
+	}
+
+	inline unsigned Uring::capacity() const {
+		return m_sq_entries;
+	}
+
+	inline io_uring_sqe* Uring::prepare() {
+		unsigned head = std::atomic_ref<unsigned>(*m_sq_head).load(std::memory_order_acquire);
+		if (*m_sq_tail + m_prepared - head >= m_sq_entries) {
+			if ((m_prepared == 0) || (enter(0, std::chrono::milliseconds(0)) < 0))
+				return nullptr;
+			head = std::atomic_ref<unsigned>(*m_sq_head).load(std::memory_order_acquire);
+			if (*m_sq_tail - head >= m_sq_entries)
+				return nullptr;
+		}
+		const unsigned tail = *m_sq_tail + m_prepared;
+
+		const unsigned index = tail & m_sq_mask;
+		m_sq_array[index] = index;
+		++m_prepared;
+
+		io_uring_sqe* sqe = &m_sqes[index];
+		std::memset(sqe, 0, sizeof(io_uring_sqe));
+		return sqe;
+	}
+
+	inline int Uring::enter(unsigned wait, std::chrono::milliseconds timeout) {
+		const unsigned submit = m_prepared;
+		if ((submit == 0) && (wait == 0))
+			return 0;
+		if (submit != 0) {
+			std::atomic_ref<unsigned>(*m_sq_tail).store(*m_sq_tail + submit, std::memory_order_release);
+			m_prepared = 0;
+		}
+
+		unsigned flags = (wait != 0) ? IORING_ENTER_GETEVENTS : 0;
+		__kernel_timespec time;
+		io_uring_getevents_arg argument;
+		void* extra = nullptr;
+		size_t extra_size = 0;
+		if ((wait != 0) && (timeout.count() >= 0)) {
+			time.tv_sec	 = timeout.count() / 1000;
+			time.tv_nsec = timeout.count() % 1000 * 1000000;
+			std::memset(&argument, 0, sizeof(argument));
+			argument.ts = reinterpret_cast<uint64>(&time);
+			flags	  |= IORING_ENTER_EXT_ARG;
+			extra	   = &argument;
+			extra_size = sizeof(argument);
+		}
+
+		const long result = syscall(__NR_io_uring_enter, m_fd, submit, wait, flags, extra, extra_size);
+		return (result < 0) ? -errno : static_cast<int>(result);
+	}
+
+	inline io_uring_cqe* Uring::peek() {
+		const unsigned head = *m_cq_head;
+		if (head == std::atomic_ref<unsigned>(*m_cq_tail).load(std::memory_order_acquire))
+			return nullptr;
+		return &m_cqes[head & m_cq_mask];
+	}
+
+	inline void Uring::pop() {
+		std::atomic_ref<unsigned>(*m_cq_head).store(*m_cq_head + 1, std::memory_order_release);
+	}
+
+	inline UringBuffers::UringBuffers():
+		m_ring(nullptr),
+		m_memory(nullptr), m_memory_size(0),
+		m_count(0), m_size(0), m_group(0) {
+	}
+
+	inline UringBuffers::~UringBuffers() {
+		close();
+	}
+
+	inline bool UringBuffers::provide(uint16 id, unsigned count, bool silent) {
+		io_uring_sqe* sqe = m_ring->prepare();
+		if (sqe == nullptr)
+			return false;
+		sqe->opcode	   = IORING_OP_PROVIDE_BUFFERS;
+		sqe->fd		   = static_cast<int>(count);
+		sqe->addr	   = reinterpret_cast<uint64>(buffer(id));
+		sqe->len	   = static_cast<uint32>(m_size);
+		sqe->off	   = id;
+		sqe->buf_group = m_group;
+		sqe->flags	   = silent ? IOSQE_CQE_SKIP_SUCCESS : 0;
+		sqe->user_data = 0;
+		return true;
+	}
+
+	inline bool UringBuffers::open(Uring& ring, unsigned count, size_t size, uint16 group) {
+		close();
+
+		m_memory_size = count * size;
+		void* memory = mmap(nullptr, m_memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return false;
+
+		m_ring	 = &ring;
+		m_memory = static_cast<byte*>(memory);
+		m_count	 = count;
+		m_size	 = size;
+		m_group	 = group;
+
+		if (!provide(0, count, false) || (ring.enter(1, std::chrono::milliseconds(-1)) < 0)) {
+			close();
+			return false;
+		}
+		io_uring_cqe* cqe = ring.peek();
+		const bool provided = (cqe != nullptr) && (cqe->res >= 0);
+		if (cqe != nullptr)
+			ring.pop();
+		if (!provided)
+			close();
+		return provided;
+	}
+
+	inline void UringBuffers::close() {
+		if (m_memory)
+			munmap(m_memory, m_memory_size);
+		m_ring	 = nullptr;
+		m_memory = nullptr;
+		m_count	 = 0;
+	}
+
+	inline byte* UringBuffers::buffer(uint16 id) const {
+		return m_memory + id * m_size;
+	}
+
+	inline size_t UringBuffers::bufferSize() const {
+		return m_size;
+	}
+
+	inline uint16 UringBuffers::group() const {
+		return m_group;
+	}
+
+	inline void UringBuffers::recycle(uint16 id) {
+		provide(id, 1, true);
+	}
+#endif
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+
+#include "Futex.h"
+
+#include <DSFML/Aliases.h>
+
+
+DEMONORIUM_ALIASES;
+
+
+namespace demonorium
+{
+	/**
+	 * \brief Общая точка пробуждения одного спящего потока от нескольких источников событий.
+	 * Источник сначала публикует событие (пакет в буфере, запрос в очереди), затем вызывает notify.
+	 * Поток перед сном вызывает prepare, ещё раз проверяет источники и только потом wait:
+	 * событие, пришедшее между проверкой и сном, не теряется.
+	 * Пока поток не спит, notify не делает системных вызовов.
+	 */
+	class Wakeup {
+		Futex				m_sequence;
+		std::atomic<bool>	m_sleeping;
+	public:
+		Wakeup();
+
+		//Сообщить о событии, можно вызывать из любого потока
+		void notify();
+
+		//Объявить о намерении уснуть, возвращает ключ для wait
+		uint32 prepare();
+		//Уснуть, если после prepare не было notify, но не дольше timeout
+		void wait(uint32 key, std::chrono::milliseconds timeout);
+		//Отказаться от сна после prepare: источники оказались не пусты
+		void cancel();
+	};
+
+
+	inline Wakeup::Wakeup():
+		m_sequence(0), m_sleeping(false) {
+	}
+
+	inline void Wakeup::notify() {
+		//Пара барьеров с prepare: либо источник видит спящего, либо спящий видит событие
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!m_sleeping.load(std::memory_order_relaxed))
+			return;
+		m_sequence.fetchAdd(1);
+		m_sequence.wakeOne();
+	}
+
+	inline uint32 Wakeup::prepare() {
+		m_sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return m_sequence.load();
+	}
+
+	inline void Wakeup::wait(uint32 key, std::chrono::milliseconds timeout) {
+		if (timeout.count() > 0)
+			m_sequence.waitFor(key, timeout);
+		m_sleeping.store(false, std::memory_order_relaxed);
+	}
+
+	inline void Wakeup::cancel() {
+		m_sleeping.store(false, std::memory_order_relaxed);
+	}
+}
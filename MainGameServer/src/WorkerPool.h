@@ -0,0 +1,357 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Futex.h"
+
+
+namespace demonorium
+{
+	class WorkerPool;
+
+	/**
+	 * \brief Задача пула. Память задачи принадлежит тому, кто её поставил, пул хранит только указатель,
+	 * поэтому постановка задачи не выделяет память.
+	 */
+	struct Job {
+		void (*run)(Job& job, WorkerPool& pool);
+	};
+
+	/**
+	 * \brief Дек Chase-Lev: владелец кладёт и берёт с одного конца, остальные потоки воруют с другого.
+	 * Ёмкость фиксирована, при переполнении push возвращает false и задачу выполняют на месте.
+	 */
+	class WorkDeque {
+		std::unique_ptr<std::atomic<Job*>[]> m_buffer;
+		const int64 m_mask;
+		alignas(64) std::atomic<int64> m_top;
+		alignas(64) std::atomic<int64> m_bottom;
+	public:
+		//Ёмкость округляется вверх до степени двойки
+		explicit WorkDeque(size_t capacity);
+
+		//Только владелец
+		bool push(Job* job);
+		//Только владелец, последняя положенная задача
+		Job* pop();
+		//Любой поток, самая старая задача
+		Job* steal();
+	};
+
+	/**
+	 * \brief Пул рабочих потоков с воровством задач.
+	 * У каждого рабочего свой дек, задачи извне попадают в общую очередь.
+	 * Свободный рабочий берёт свою задачу, затем из общей очереди, затем ворует у других,
+	 * а если работы нет - спит на Futex до следующей постановки, не крутясь в цикле.
+	 */
+	class WorkerPool {
+		struct Worker {
+			WorkDeque	deque;
+			std::thread	thread;
+			WorkerPool*	owner;
+			size_t		index;
+
+			Worker(WorkerPool* owner, size_t index);
+		};
+
+		std::vector<std::unique_ptr<Worker>> m_workers;
+
+		std::mutex			m_injected_mutex;
+		std::deque<Job*>	m_injected;
+		std::atomic<size_t>	m_injected_size;
+
+		//Меняется при каждой постановке, на нём спят свободные рабочие
+		Futex				m_epoch;
+		std::atomic<uint32>	m_sleeping;
+		std::atomic<bool>	m_stop;
+		//Меняется при завершении каждого parallelFor, на нём спят вызывающие
+		Futex				m_completed;
+
+		static thread_local Worker* t_worker;
+
+		//Рабочий этого пула, которым является текущий поток, или nullptr
+		Worker* current() const;
+		Job* popInjected();
+		Job* steal(const Worker* self);
+		Job* findJob(Worker* self);
+		void workerLoop(Worker& self);
+	public:
+		//Рабочих потоков по умолчанию: ядра минус поток сервера, не больше 3
+		static size_t defaultSize();
+
+		//workers == 0 - пул без потоков, parallelFor выполняется на месте
+		explicit WorkerPool(size_t workers = defaultSize());
+		~WorkerPool();
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator =(const WorkerPool&) = delete;
+
+		//Число рабочих потоков
+		size_t size() const;
+
+		//Поставить задачу: из рабочего потока - в его дек, иначе в общую очередь
+		void submit(Job& job);
+		//Выполнить одну чужую задачу в текущем потоке, false если задач нет
+		bool runOne();
+
+		/**
+		 * \brief Выполнить body(begin, end) над [0, count) кусками не больше grain и дождаться окончания.
+		 * Диапазон делится пополам по мере воровства, вызывающий поток тоже выполняет куски.
+		 */
+		template<class F>
+		void parallelFor(size_t count, size_t grain, F&& body);
+	};
+
+
+	inline WorkDeque::WorkDeque(size_t capacity):
+		m_mask([capacity] {
+			size_t result = 2;
+			while (result < capacity)
+				result <<= 1;
+			return static_cast<int64>(result) - 1;
+		}()),
+		m_top(0), m_bottom(0) {
+		m_buffer.reset(new std::atomic<Job*>[m_mask + 1]);
+	}
+
+	inline bool WorkDeque::push(Job* job) {
+		const int64 bottom = m_bottom.load(std::memory_order_relaxed);
+		const int64 top = m_top.load(std::memory_order_acquire);
+		if (bottom - top > m_mask)
+			return false;
+
+		m_buffer[bottom & m_mask].store(job, std::memory_order_relaxed);
+		m_bottom.store(bottom + 1, std::memory_order_seq_cst);
+		return true;
+	}
+
+	inline Job* WorkDeque::pop() {
+		const int64 bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		m_bottom.store(bottom, std::memory_order_seq_cst);
+		int64 top = m_top.load(std::memory_order_seq_cst);
+
+		if (top > bottom) {
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		Job* job = m_buffer[bottom & m_mask].load(std::memory_order_relaxed);
+		if (top == bottom) {
+			//Последний элемент: соревнуемся с ворами
+			if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst))
+				job = nullptr;
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	inline Job* WorkDeque::steal() {
+		int64 top = m_top.load(std::memory_order_seq_cst);
+		const int64 bottom = m_bottom.load(std::memory_order_seq_cst);
+		if (top >= bottom)
+			return nullptr;
+
+		Job* job = m_buffer[top & m_mask].load(std::memory_order_relaxed);
+		if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst))
+			return nullptr;
+		return job;
+	}
+
+	inline thread_local WorkerPool::Worker* WorkerPool::t_worker = nullptr;
+
+	inline WorkerPool::Worker::Worker(WorkerPool* owner, size_t index):
+		deque(1024), owner(owner), index(index) {
+	}
+
+	inline WorkerPool::Worker* WorkerPool::current() const {
+		return (t_worker && (t_worker->owner == this)) ? t_worker : nullptr;
+	}
+
+	inline Job* WorkerPool::popInjected() {
+		if (m_injected_size.load() == 0)
+			return nullptr;
+
+		std::lock_guard<std::mutex> lock(m_injected_mutex);
+		if (m_injected.empty())
+			return nullptr;
+		Job* job = m_injected.front();
+		m_injected.pop_front();
+		m_injected_size.fetch_sub(1);
+		return job;
+	}
+
+	inline Job* WorkerPool::steal(const Worker* self) {
+		//Начинаем с разных жертв, чтобы воры не толпились у одного дека
+		const size_t count = m_workers.size();
+		const size_t start = self ? self->index : 0;
+		for (size_t i = 1; i <= count; ++i) {
+			Worker& victim = *m_workers[(start + i) % count];
+			if (&victim == self)
+				continue;
+			if (Job* job = victim.deque.steal())
+				return job;
+		}
+		return nullptr;
+	}
+
+	inline Job* WorkerPool::findJob(Worker* self) {
+		if (self) {
+			if (Job* job = self->deque.pop())
+				return job;
+		}
+		if (Job* job = popInjected())
+			return job;
+		return steal(self);
+	}
+
+	inline void WorkerPool::workerLoop(Worker& self) {
+		t_worker = &self;
+		while (!m_stop.load()) {
+			if (Job* job = findJob(&self)) {
+				job->run(*job, *this);
+				continue;
+			}
+
+			//Счётчик спящих растёт до чтения эпохи: постановка после проверки очередей либо сменит эпоху, либо разбудит
+			m_sleeping.fetch_add(1);
+			const uint32 epoch = m_epoch.load();
+			if (Job* job = findJob(&self)) {
+				m_sleeping.fetch_sub(1);
+				job->run(*job, *this);
+				continue;
+			}
+			if (!m_stop.load())
+				m_epoch.wait(epoch);
+			m_sleeping.fetch_sub(1);
+		}
+		t_worker = nullptr;
+	}
+
+	inline size_t WorkerPool::defaultSize() {
+		const size_t cores = std::thread::hardware_concurrency();
+		return std::min<size_t>(cores > 1 ? cores - 1 : 0, 3);
+	}
+
+	inline WorkerPool::WorkerPool(size_t workers):
+		m_injected_size(0), m_sleeping(0), m_stop(false) {
+		m_workers.reserve(workers);
+		for (size_t i = 0; i < workers; ++i)
+			m_workers.push_back(std::make_unique<Worker>(this, i));
+		//Потоки стартуют после заполнения списка: воры обходят его без блокировок
+		for (auto& worker : m_workers)
+			worker->thread = std::thread(&WorkerPool::workerLoop, this, std::ref(*worker));
+	}
+
+	inline WorkerPool::~WorkerPool() {
+		m_stop.store(true);
+		m_epoch.fetchAdd(1);
+		m_epoch.wakeAll();
+		for (auto& worker : m_workers)
+			worker->thread.join();
+	}
+
+	inline size_t WorkerPool::size() const {
+		return m_workers.size();
+	}
+
+	inline void WorkerPool::submit(Job& job) {
+		Worker* self = current();
+		//Дек переполнен или потоков нет: выполняем на месте
+		if (self ? !self->deque.push(&job) : m_workers.empty()) {
+			job.run(job, *this);
+			return;
+		}
+		if (!self) {
+			std::lock_guard<std::mutex> lock(m_injected_mutex);
+			m_injected.push_back(&job);
+			m_injected_size.fetch_add(1);
+		}
+
+		m_epoch.fetchAdd(1);
+		if (m_sleeping.load() != 0)
+			m_epoch.wakeOne();
+	}
+
+	inline bool WorkerPool::runOne() {
+		Job* job = findJob(current());
+		if (job == nullptr)
+			return false;
+		job->run(*job, *this);
+		return true;
+	}
+
+	template <class F>
+	void WorkerPool::parallelFor(size_t count, size_t grain, F&& body) {
+		grain = std::max<size_t>(grain, 1);
+		if (count == 0)
+			return;
+		if (m_workers.empty() || (count <= grain)) {
+			body(size_t(0), count);
+			return;
+		}
+
+		struct Group;
+		struct Range: Job {
+			Group*	group;
+			size_t	begin;
+			size_t	end;
+		};
+		struct Group {
+			F&					body;
+			size_t				grain;
+			std::vector<Range>	ranges;
+			std::atomic<size_t>	next;
+			std::atomic<size_t>	pending;
+		};
+
+		//Половины не меньше grain/2, поэтому кусков не больше 2*count/grain + 1
+		Group group{body, grain, std::vector<Range>(2 * (count / grain) + 2), 1, 1};
+
+		const auto run = [](Job& job, WorkerPool& pool) {
+			auto& range = static_cast<Range&>(job);
+			Group& owner = *range.group;
+			size_t begin = range.begin;
+			size_t end = range.end;
+
+			//Правая половина отдаётся на воровство, левая делится дальше здесь же
+			while (end - begin > owner.grain) {
+				const size_t middle = begin + (end - begin) / 2;
+				Range& right = owner.ranges[owner.next.fetch_add(1)];
+				right.run	= range.run;
+				right.group	= &owner;
+				right.begin	= middle;
+				right.end	= end;
+				owner.pending.fetch_add(1);
+				pool.submit(right);
+				end = middle;
+			}
+
+			owner.body(begin, end);
+			//После последнего уменьшения группа может исчезнуть, будим через слово пула
+			if (owner.pending.fetch_sub(1) == 1) {
+				pool.m_completed.fetchAdd(1);
+				pool.m_completed.wakeAll();
+			}
+		};
+
+		Range& root = group.ranges[0];
+		root.run	= run;
+		root.group	= &group;
+		root.begin	= 0;
+		root.end	= count;
+		submit(root);
+
+		//Вызывающий помогает, пока есть чужие задачи, затем спит до завершения последнего куска
+		while (true) {
+			const uint32 completed = m_completed.load();
+			if (group.pending.load() == 0)
+				break;
+			if (!runOne())
+				m_completed.wait(completed);
+		}
+	}
+}
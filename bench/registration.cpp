@@ -0,0 +1,257 @@
+﻿#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ServerAPI.h"
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#endif
+
+/*
+ * Нагрузочный тест регистрации: N клиентов с разных адресов 127.x.y.z одновременно шлют REGISTER,
+ * замеряется время, за которое все они попадут в список игроков. Потерянные пакеты отправляются повторно,
+ * как это делает настоящий клиент.
+ * Затем каждый зарегистрированный клиент шлёт пачку из FLOOD_BURST запросов NAME одним вызовом с UDP_SEGMENT:
+ * замеряется, сколько датаграмм сервер принимает за одно чтение и сколько ответов уходит за один вызов.
+ * Запуск: bench_registration [клиентов = 10000] [регистраций в секунду, 0 - без ограничения = 0] [sockets|uring = sockets] [offload] [framed] [capture]
+ * offload включает на сервере UDP GRO на приёме и UDP_SEGMENT на отправке.
+ * framed шлёт регистрацию и пачку NAME датаграммами с кадрами: пачка - одна датаграмма, ответы на неё сервер склеивает в одну.
+ * capture записывает принятые сервером датаграммы в registration.mgc рядом с файлами сервера, его воспроизводит bench_replay.
+ * Сервер пишет журнал в консоль, итог выводится в stderr: bench_registration > /dev/null
+ */
+
+using namespace std::chrono_literals;
+
+namespace
+{
+	constexpr unsigned short BENCH_PORT = 45100;
+	//Сокетов клиентов, открытых одновременно
+	constexpr size_t SOCKET_CHUNK = 256;
+	//Запросов NAME от клиента за один вызов: вместе с регистрацией не больше предела защиты от DDOS
+	constexpr size_t FLOOD_BURST = 5;
+	constexpr char NAME_REQUEST = 6;
+
+	sf::IpAddress clientAddress(size_t index) {
+		return sf::IpAddress(127, static_cast<sf::Uint8>(1 + index / 65000), static_cast<sf::Uint8>(index % 65000 / 250), static_cast<sf::Uint8>(1 + index % 250));
+	}
+
+	//Обернуть сообщение в датаграмму с одним кадром
+	size_t frame(char* packet, size_t size) {
+		std::memmove(packet + 1 + demonorium::FRAME_HEADER, packet, size);
+		packet[0] = static_cast<char>(demonorium::FRAMED);
+		const auto length = static_cast<demonorium::aliases::uint16>(size);
+		std::memcpy(packet + 1, &length, demonorium::FRAME_HEADER);
+		return 1 + demonorium::FRAME_HEADER + size;
+	}
+
+	void sendRegistrations(const std::vector<size_t>& clients, bool framed) {
+		std::vector<std::unique_ptr<sf::UdpSocket>> sockets;
+		for (size_t begin = 0; begin < clients.size(); begin += SOCKET_CHUNK) {
+			sockets.clear();
+			const size_t end = std::min(clients.size(), begin + SOCKET_CHUNK);
+			for (size_t i = begin; i < end; ++i) {
+				auto socket = std::make_unique<sf::UdpSocket>();
+				if (socket->bind(sf::Socket::AnyPort, clientAddress(clients[i])) != sf::Socket::Done)
+					continue;
+
+				char packet[64] = {0};
+				std::memcpy(packet + 1, demonorium::ServerAPI::get_password(), demonorium::Password::LENGTH);
+				const sf::Uint16 port = socket->getLocalPort();
+				std::memcpy(packet + 1 + demonorium::Password::LENGTH, &port, sizeof(port));
+				const int name = std::snprintf(packet + 3 + demonorium::Password::LENGTH, 32, "bench%zu", clients[i]);
+				size_t size = 3 + demonorium::Password::LENGTH + name;
+				if (framed)
+					size = frame(packet, size);
+				socket->send(packet, size, sf::IpAddress::LocalHost, BENCH_PORT);
+				sockets.push_back(std::move(socket));
+			}
+		}
+	}
+
+	//Пачка запросов NAME: на Linux одним sendmsg с UDP_SEGMENT, ядро режет её на датаграммы по байту
+	void sendBurst(demonorium::NativeUdpSocket& socket) {
+		char burst[FLOOD_BURST];
+		std::memset(burst, NAME_REQUEST, sizeof(burst));
+#if defined(__linux__)
+		sockaddr_in address;
+		std::memset(&address, 0, sizeof(address));
+		address.sin_family		= AF_INET;
+		address.sin_addr.s_addr = htonl(sf::IpAddress::LocalHost.toInteger());
+		address.sin_port		= htons(BENCH_PORT);
+		iovec vector{burst, sizeof(burst)};
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(demonorium::aliases::uint16))];
+
+		msghdr message;
+		std::memset(&message, 0, sizeof(message));
+		message.msg_name	   = &address;
+		message.msg_namelen	   = sizeof(address);
+		message.msg_iov		   = &vector;
+		message.msg_iovlen	   = 1;
+		message.msg_control	   = control;
+		message.msg_controllen = sizeof(control);
+		cmsghdr* header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_UDP;
+		header->cmsg_type  = UDP_SEGMENT;
+		header->cmsg_len   = CMSG_LEN(sizeof(demonorium::aliases::uint16));
+		const demonorium::aliases::uint16 segment = 1;
+		std::memcpy(CMSG_DATA(header), &segment, sizeof(segment));
+		if (sendmsg(socket.getHandle(), &message, 0) == static_cast<ssize_t>(sizeof(burst)))
+			return;
+#endif
+		for (char request : burst)
+			socket.send(&request, 1, sf::IpAddress::LocalHost, BENCH_PORT);
+	}
+
+	//Пачка запросов NAME одной датаграммой с кадрами
+	void sendFramedBurst(demonorium::NativeUdpSocket& socket) {
+		char burst[1 + FLOOD_BURST * (demonorium::FRAME_HEADER + 1)];
+		burst[0] = static_cast<char>(demonorium::FRAMED);
+		const demonorium::aliases::uint16 length = 1;
+		for (size_t i = 0; i < FLOOD_BURST; ++i) {
+			char* message = burst + 1 + i * (demonorium::FRAME_HEADER + 1);
+			std::memcpy(message, &length, demonorium::FRAME_HEADER);
+			message[demonorium::FRAME_HEADER] = NAME_REQUEST;
+		}
+		socket.send(burst, sizeof(burst), sf::IpAddress::LocalHost, BENCH_PORT);
+	}
+
+	void sendFlood(size_t count, bool framed) {
+		std::vector<std::unique_ptr<demonorium::NativeUdpSocket>> sockets;
+		for (size_t begin = 0; begin < count; begin += SOCKET_CHUNK) {
+			sockets.clear();
+			for (size_t i = begin; i < std::min(count, begin + SOCKET_CHUNK); ++i) {
+				auto socket = std::make_unique<demonorium::NativeUdpSocket>();
+				if (socket->bind(sf::Socket::AnyPort, clientAddress(i)) != sf::Socket::Done)
+					continue;
+				if (framed)
+					sendFramedBurst(*socket);
+				else
+					sendBurst(*socket);
+				sockets.push_back(std::move(socket));
+			}
+		}
+	}
+
+	double ratio(demonorium::aliases::uint64 count, demonorium::aliases::uint64 calls) {
+		return calls == 0 ? 0.0 : static_cast<double>(count) / static_cast<double>(calls);
+	}
+}
+
+demonorium::Server demonorium::ServerAPI::server("valid cd", BENCH_PORT);
+
+int main(int argc, char** argv) {
+	const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+	const auto rate = static_cast<demonorium::aliases::uint32>(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 0);
+	const bool uring = (argc > 3) && (std::strcmp(argv[3], "uring") == 0);
+	bool offload = false;
+	bool framed	 = false;
+	bool capture = false;
+	for (int i = 4; i < argc; ++i) {
+		offload = offload || (std::strcmp(argv[i], "offload") == 0);
+		framed	= framed || (std::strcmp(argv[i], "framed") == 0);
+		capture	= capture || (std::strcmp(argv[i], "capture") == 0);
+	}
+
+	//Файлы состояния и истории прошлых запусков не должны попасть в замер
+	const auto directory = std::filesystem::temp_directory_path() / "mgs_bench_registration";
+	std::filesystem::remove_all(directory);
+	std::filesystem::create_directories(directory);
+	std::filesystem::current_path(directory);
+
+	demonorium::ServerAPI::set_transport(uring ? demonorium::Transport::URING : demonorium::Transport::SOCKETS);
+	demonorium::ServerAPI::set_udp_offload(offload);
+	if (capture)
+		demonorium::ServerAPI::set_capture("registration.mgc");
+	demonorium::ServerAPI::init();
+	while (!demonorium::ServerAPI::is_launched())
+		std::this_thread::yield();
+	demonorium::ServerAPI::set_admission_rate(rate);
+	demonorium::ServerAPI::set_snapshot_period(10ms);
+
+	std::vector<size_t> missing(count);
+	for (size_t i = 0; i < count; ++i)
+		missing[i] = i;
+
+	size_t rounds = 0;
+	const auto start = std::chrono::steady_clock::now();
+	while (!missing.empty() && (rounds < 100)) {
+		++rounds;
+		sendRegistrations(missing, framed);
+
+		//Ждём, пока список игроков перестанет расти
+		size_t registered = 0;
+		while (true) {
+			std::this_thread::sleep_for(50ms);
+			const size_t now = demonorium::ServerAPI::get_snapshot()->players.size();
+			if ((now == registered) || (now == count))
+				break;
+			registered = now;
+		}
+
+		std::set<sf::IpAddress> known;
+		{
+			const auto snapshot = demonorium::ServerAPI::get_snapshot();
+			for (const auto& player : snapshot->players)
+				known.insert(player.ip);
+		}
+		std::vector<size_t> next;
+		for (size_t client : missing)
+			if (known.find(clientAddress(client)) == known.end())
+				next.push_back(client);
+		missing.swap(next);
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	const std::string mode = std::string(uring ? "io_uring" : "sockets") + (offload ? "+offload" : "") + (framed ? "+framed" : "") + "; ";
+	std::cerr << mode << "Клиентов: " << count << "; зарегистрировано: " << count - missing.size()
+		<< "; отправок: " << rounds << "; время: " << seconds * 1000 << " мс; "
+		<< (count - missing.size()) / seconds << " регистраций/с" << std::endl;
+
+	//Окно защиты от DDOS после регистрации должно закончиться
+	std::this_thread::sleep_for(600ms);
+	const auto before = demonorium::ServerAPI::get_transport_stats();
+	const auto flood_start = std::chrono::steady_clock::now();
+	sendFlood(count, framed);
+	auto after = demonorium::ServerAPI::get_transport_stats();
+	while (true) {
+		std::this_thread::sleep_for(50ms);
+		const auto now = demonorium::ServerAPI::get_transport_stats();
+		if ((now.received == after.received) && (now.sent == after.sent))
+			break;
+		after = now;
+	}
+	const double flood_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - flood_start).count() - 0.05;
+
+	std::cerr << mode << "Пачки NAME: принято датаграмм: " << after.received - before.received
+		<< "; датаграмм на чтение: " << ratio(after.received - before.received, after.reads - before.reads)
+		<< "; отправлено датаграмм: " << after.sent - before.sent
+		<< "; датаграмм на вызов: " << ratio(after.sent - before.sent, after.writes - before.writes)
+		<< "; время: " << flood_seconds * 1000 << " мс" << std::endl;
+
+	const char* lanes[] = {"GAME", "CONTROL", "BULK"};
+	std::cerr << mode << "Полосы приёма (принято/потеряно/отброшено):";
+	for (size_t i = 0; i < demonorium::LANE_COUNT; ++i) {
+		const auto stats = demonorium::ServerAPI::get_lane_stats(static_cast<demonorium::Lane>(i));
+		std::cerr << ' ' << lanes[i] << ' ' << stats.accepted << '/' << stats.dropped << '/' << stats.refused;
+	}
+	std::cerr << std::endl;
+
+	demonorium::ServerAPI::terminate();
+	if (capture) {
+		const auto stats = demonorium::ServerAPI::get_capture_stats();
+		std::cerr << mode << "Захват " << (directory / "registration.mgc").string() << ": записано датаграмм: " << stats.recorded
+			<< "; потеряно: " << stats.dropped << std::endl;
+	}
+	return missing.empty() ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+﻿#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "Replay.h"
+
+/*
+ * Воспроизведение захвата входящего трафика: датаграммы из файла разбирает сервер в виртуальном времени записи,
+ * без сети. Замеряется настоящее время разбора, поэтому один захват сравнивает разные сборки сервера.
+ * Захват пишет сервер с ServerAPI::set_capture, например MainGameServer capture.mgc или bench_registration ... capture.
+ * Запуск: bench_replay <захват> [скорость: 1 - темп записи, 0 - без ожидания = 0]
+ * Сервер пишет журнал в консоль, итог выводится в stderr: bench_replay capture.mgc > /dev/null
+ */
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cerr << "bench_replay <захват> [скорость]" << std::endl;
+		return 1;
+	}
+	const std::string path = std::filesystem::absolute(argv[1]).string();
+	const double speed = argc > 2 ? std::strtod(argv[2], nullptr) : 0.0;
+
+	//Файлы состояния и истории прошлых запусков не должны попасть в прогон
+	const auto directory = std::filesystem::temp_directory_path() / "mgs_bench_replay";
+	std::filesystem::remove_all(directory);
+	std::filesystem::create_directories(directory);
+	std::filesystem::current_path(directory);
+
+	demonorium::Server server("valid cd");
+	demonorium::CaptureReplay replay(server);
+	if (!replay.open(path)) {
+		std::cerr << "Не удалось открыть захват " << path << std::endl;
+		return 1;
+	}
+	const auto stats = replay.run(speed);
+
+	const double seconds = std::chrono::duration<double>(stats.elapsed).count();
+	std::cerr << "Датаграмм: " << stats.datagrams << "; кадров: " << stats.frames << "; ответов: " << stats.responses
+		<< "; длительность захвата: " << stats.duration.count() << " мс; время: " << seconds * 1000 << " мс; "
+		<< (seconds > 0.0 ? static_cast<double>(stats.datagrams) / seconds : 0.0) << " датаграмм/с" << std::endl;
+}
@@ -8,7 +8,7 @@
 DEMONORIUM_LOCAL_USE(demonorium::utils::templates)
 
 #define DEMONORIUM_LITDELC(name, type, parameter) constexpr type operator"" name(unsigned long long int parameter)
-#define DEMONORIUM_SIMPLE_FIND(container, method, data, it_name) auto (it_name) = (container) . method (data); if ((it_name) != (container).end())
+#define DEMONORIUM_SIMPLE_FIND(container, method, data, it_name) auto it_name = (container) . method (data); if ((it_name) != (container).end())
 
 
 #ifndef DEMONORIUM_DECLARE_PLATFORM_TYPES
@@ -21,7 +21,7 @@ namespace demonorium
 		namespace type_finder
 		{
 			template<size_t SIZE, class T, class ... ARGS>
-			using typeBySize = selectByCondition<typename conditions::haveSizeFactory<SIZE>::type, undeclared_type, T, ARGS...>;
+			using typeBySize = selectByCondition<conditions::haveSizeFactory<SIZE>::template type, undeclared_type, T, ARGS...>;
 
 			template<size_t size>
 			using signedBySize = typeBySize<size,
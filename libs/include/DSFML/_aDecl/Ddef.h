@@ -18,7 +18,7 @@ namespace demonorium
 	{
 		using size_t = std::size_t;
 
-		// ,    ,   
+		//Тип ошибки, процедуры поиска возвращают его, если не нашли
 		struct undeclared_type {};
 
 		template<class T>
@@ -3,7 +3,7 @@
 
 #include <assert.h>
 
-#include "..\Aliases.h"
+#include "../Aliases.h"
 
 DEMONORIUM_ALIASES;
 DEMONORIUM_LOCAL_USE(demonorium::utils::templates);
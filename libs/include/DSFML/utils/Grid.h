@@ -3,7 +3,7 @@
 #include <assert.h>
 
 #include <functional>
-#include "..\Aliases.h"
+#include "../Aliases.h"
 
 DEMONORIUM_ALIASES;
 DEMONORIUM_LOCAL_USE(demonorium::memory);
@@ -222,7 +222,7 @@ namespace demonorium
 					p->linkLeft(rotateLeft(p->unlinkLeft()));
 				return rotateRight(p);
 			}
-			return p; //   
+			return p; // балансировка не нужна
 		}
 
 		template <class T, class Alloc>
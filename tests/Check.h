@@ -0,0 +1,31 @@
+﻿#pragma once
+#include <iostream>
+
+/*
+ * Проверки тестов без сторонних библиотек: тест - отдельная программа, ctest считает её код возврата.
+ * MGS_CHECK печатает условие и место ошибки и продолжает тест, main возвращает mgs::test::result().
+ */
+namespace mgs::test
+{
+	inline int& failures() {
+		static int count = 0;
+		return count;
+	}
+
+	inline bool report(bool passed, const char* condition, const char* file, int line) {
+		if (!passed) {
+			++failures();
+			std::cerr << file << ':' << line << ": не выполнено " << condition << std::endl;
+		}
+		return passed;
+	}
+
+	//Код возврата теста
+	inline int result() {
+		if (failures() != 0)
+			std::cerr << "Ошибок: " << failures() << std::endl;
+		return failures() == 0 ? 0 : 1;
+	}
+}
+
+#define MGS_CHECK(condition) ::mgs::test::report(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
@@ -0,0 +1,97 @@
+﻿#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "AdminThread.h"
+#include "Check.h"
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#endif
+
+/*
+ * Канал управления: клиент, который шлёт команды и не читает ответы, не должен останавливать поток канала.
+ * Его очередь ответов растёт до предела, после чего клиент отключается; остальные клиенты обслуживаются,
+ * а destroyThread не ждёт его.
+ */
+
+using namespace std::chrono_literals;
+using demonorium::aliases::byte;
+
+namespace
+{
+	constexpr unsigned short ADMIN_PORT = 45210;
+	//Маленький предел очереди: клиент без чтения упирается в него за доли секунды
+	constexpr size_t OUTPUT_LIMIT = 64 * 1024;
+
+	//Доступ к дескриптору, чтобы уменьшить буфер приёма клиента
+	struct ClientSocket: sf::TcpSocket {
+		using sf::TcpSocket::getHandle;
+	};
+
+	bool connect(sf::TcpSocket& socket) {
+		for (int attempt = 0; attempt < 100; ++attempt) {
+			if (socket.connect(sf::IpAddress::LocalHost, ADMIN_PORT) == sf::Socket::Done)
+				return true;
+			std::this_thread::sleep_for(10ms);
+		}
+		return false;
+	}
+
+	//Команды GET_STATE без чтения ответов, пока сервер не разорвёт соединение. false - не разорвал за отведённое время
+	bool flood(ClientSocket& socket) {
+#if defined(__linux__)
+		const int size = 4096;
+		setsockopt(socket.getHandle(), SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+#endif
+		socket.setBlocking(false);
+		const std::vector<char> commands(4096, static_cast<char>(demonorium::AdminCodes::GET_STATE));
+		const auto deadline = std::chrono::steady_clock::now() + 20s;
+		while (std::chrono::steady_clock::now() < deadline) {
+			size_t sent = 0;
+			const auto status = socket.send(commands.data(), commands.size(), sent);
+			if ((status == sf::Socket::Disconnected) || (status == sf::Socket::Error))
+				return true;
+			if (status != sf::Socket::Done)
+				std::this_thread::sleep_for(1ms);
+		}
+		return false;
+	}
+}
+
+demonorium::Server demonorium::ServerAPI::server("valid cd", 45211);
+
+int main() {
+	demonorium::AdminThread admin(ADMIN_PORT, OUTPUT_LIMIT);
+	admin.start();
+
+	ClientSocket stalled;
+	if (!MGS_CHECK(connect(stalled)))
+		return mgs::test::result();
+
+	//Второй клиент подключается до затора и должен получить ответ, пока первый не читает
+	sf::TcpSocket regular;
+	MGS_CHECK(connect(regular));
+
+	MGS_CHECK(flood(stalled));
+
+	const char command = static_cast<char>(demonorium::AdminCodes::GET_STATE);
+	MGS_CHECK(regular.send(&command, 1) == sf::Socket::Done);
+	byte reply[64];
+	size_t total = 0;
+	while (total < 2) {
+		size_t received = 0;
+		if (regular.receive(reply + total, sizeof(reply) - total, received) != sf::Socket::Done)
+			break;
+		total += received;
+	}
+	MGS_CHECK(total >= 2);
+	MGS_CHECK(reply[0] == static_cast<byte>(demonorium::AdminCodes::GET_STATE));
+	MGS_CHECK(reply[1] == static_cast<byte>(demonorium::AdminStatus::OK));
+
+	const auto stop = std::chrono::steady_clock::now();
+	admin.destroyThread();
+	MGS_CHECK(std::chrono::steady_clock::now() - stop < 1s);
+	return mgs::test::result();
+}
@@ -0,0 +1,55 @@
+﻿#include <string>
+#include <vector>
+
+#include "Capture.h"
+#include "Check.h"
+
+/*
+ * Захват входящего трафика: запись и чтение сохраняют время, адрес, порт отправителя и данные датаграмм.
+ */
+
+namespace
+{
+	constexpr const char* CAPTURE_PATH = "capture_test.mgc";
+
+	struct Sent {
+		sf::IpAddress	address;
+		sf::Uint16		port;
+		std::string		data;
+	};
+
+	void roundTrip() {
+		const std::vector<Sent> sent = {
+			{sf::IpAddress(10, 0, 0, 1), 40000, "first"},
+			{sf::IpAddress(10, 0, 0, 1), 40001, "same address, other port"},
+			{sf::IpAddress(192, 168, 1, 7), 65535, ""}
+		};
+
+		demonorium::CaptureWriter writer(64 * 1024, 512);
+		writer.setPath(CAPTURE_PATH);
+		writer.start();
+		const demonorium::tick start = demonorium::Clock::update();
+		for (size_t i = 0; i < sent.size(); ++i)
+			MGS_CHECK(writer.record(demonorium::Clock::after(start, demonorium::Clock::delay(10 * i)), sent[i].address, sent[i].port, sent[i].data.data(), sent[i].data.size()));
+		writer.destroyThread();
+		MGS_CHECK(writer.stats().recorded == sent.size());
+
+		demonorium::CaptureReader reader;
+		MGS_CHECK(reader.open(CAPTURE_PATH));
+		demonorium::CapturedDatagram datagram;
+		for (size_t i = 0; i < sent.size(); ++i) {
+			if (!MGS_CHECK(reader.next(datagram)))
+				return;
+			MGS_CHECK(datagram.time == 10 * i);
+			MGS_CHECK(datagram.address == sent[i].address);
+			MGS_CHECK(datagram.port == sent[i].port);
+			MGS_CHECK(std::string(reinterpret_cast<const char*>(datagram.data), datagram.size) == sent[i].data);
+		}
+		MGS_CHECK(!reader.next(datagram));
+	}
+}
+
+int main() {
+	roundTrip();
+	return mgs::test::result();
+}
@@ -0,0 +1,107 @@
+﻿#include <chrono>
+#include <ctime>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "InputThread.h"
+
+/*
+ * Заполненная полоса GAME: поток приёма перестаёт читать сокеты и спит, пока читатель не освободит место,
+ * а не крутится в цикле. Датаграммы, ждущие в сокете, после разбора полосы доходят все.
+ * Каждая датаграмма попадает ровно в один счётчик полосы: принята, потеряна (в том числе больше самого большого пакета)
+ * или отброшена защитой от DDOS.
+ */
+
+using namespace std::chrono_literals;
+using demonorium::aliases::uint32;
+using namespace demonorium::memory::memory_declarations;
+
+namespace
+{
+	constexpr sf::Uint16 PORT = 45230;
+	constexpr size_t MAX_PACKET = 64;
+	//Полоса на десяток датаграмм: остальные ждут в буфере сокета
+	constexpr size_t LANE_CAPACITY = 1024;
+	constexpr uint32 DATAGRAMS = 150;
+	constexpr auto STALL = 300ms;
+
+	constexpr size_t DEFENCE_LIMIT = 4;
+	constexpr uint32 BURST = 10;
+
+	void stall() {
+		demonorium::InputThread input(PORT, MAX_PACKET, LANE_CAPACITY, std::numeric_limits<size_t>::max());
+		input.start();
+		std::this_thread::sleep_for(50ms);
+
+		sf::UdpSocket sender;
+		for (uint32 number = 0; number < DATAGRAMS; ++number)
+			sender.send(&number, sizeof(number), sf::IpAddress::LocalHost, PORT);
+
+		//Читатель стоит: поток приёма упирается в полосу GAME и не должен тратить процессор
+		std::this_thread::sleep_for(50ms);
+		const std::clock_t before = std::clock();
+		std::this_thread::sleep_for(STALL);
+		const double spent = static_cast<double>(std::clock() - before) / CLOCKS_PER_SEC;
+		MGS_CHECK(spent < 0.1);
+
+		std::vector<bool> seen(DATAGRAMS, false);
+		uint32 received = 0;
+		const auto deadline = std::chrono::steady_clock::now() + 5s;
+		while ((received < DATAGRAMS) && (std::chrono::steady_clock::now() < deadline)) {
+			size_t batch = 0;
+			while (void* memory = input.get()) {
+				uint32 number;
+				std::memcpy(&number, shift(memory, sizeof(demonorium::PacketPrefix)), sizeof(number));
+				if ((number < DATAGRAMS) && !seen[number]) {
+					seen[number] = true;
+					++received;
+				}
+				++batch;
+			}
+			if (batch != 0)
+				input.drained();
+			std::this_thread::sleep_for(1ms);
+	}
+	MGS_CHECK(received == DATAGRAMS);
+	MGS_CHECK(input.laneStats(demonorium::Lane::GAME).dropped == 0);
+
+	const auto stop = std::chrono::steady_clock::now();
+	input.destroyThread();
+	MGS_CHECK(std::chrono::steady_clock::now() - stop < 1s);
+	}
+
+	void accounting(demonorium::Transport transport, sf::Uint16 port) {
+		demonorium::InputThread input(port, MAX_PACKET, LANE_CAPACITY, DEFENCE_LIMIT, 5s);
+		input.setTransport(transport);
+		input.start();
+		std::this_thread::sleep_for(50ms);
+
+		sf::UdpSocket sender;
+		for (uint32 number = 0; number < BURST; ++number)
+			sender.send(&number, sizeof(number), sf::IpAddress::LocalHost, port);
+		const std::vector<char> oversized(MAX_PACKET + 1, 0);
+		sender.send(oversized.data(), oversized.size(), sf::IpAddress::LocalHost, port);
+
+		demonorium::LaneStats stats;
+		const auto deadline = std::chrono::steady_clock::now() + 5s;
+		do {
+			std::this_thread::sleep_for(1ms);
+			stats = input.laneStats(demonorium::Lane::GAME);
+		} while ((stats.accepted + stats.refused + stats.dropped < BURST + 1) && (std::chrono::steady_clock::now() < deadline));
+		MGS_CHECK(stats.accepted == DEFENCE_LIMIT);
+		MGS_CHECK(stats.refused == BURST - DEFENCE_LIMIT);
+		MGS_CHECK(stats.dropped == 1);
+
+		input.destroyThread();
+	}
+}
+
+int main() {
+	stall();
+	accounting(demonorium::Transport::SOCKETS, 45231);
+	accounting(demonorium::Transport::URING, 45232);
+	return mgs::test::result();
+}
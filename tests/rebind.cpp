@@ -0,0 +1,202 @@
+﻿#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "InputThread.h"
+
+/*
+ * Смена порта под нагрузкой: отправитель непрерывно шлёт пронумерованные датаграммы, посреди потока
+ * поток приёма переходит на другой порт. Пока идёт льготный период, отправитель шлёт на оба порта,
+ * как клиенты, узнающие о новом порте в разное время, затем только на новый. Каждая датаграмма должна
+ * дойти ровно один раз - в том числе те, что лежали в очереди старого сокета при его закрытии:
+ * на время льготного периода поток приёма ставится на паузу, и старый сокет закрывается с непрочитанной очередью.
+ * Отдельно: к концу льготного периода полоса GAME заполнена, а в очереди старого сокета ещё лежат датаграммы.
+ * Сокет должен оставаться открытым, пока читатель не освободит место и очередь не будет дочитана.
+ */
+
+using namespace std::chrono_literals;
+using demonorium::aliases::uint32;
+using namespace demonorium::memory::memory_declarations;
+
+namespace
+{
+	constexpr size_t MAX_PACKET = 64;
+	constexpr size_t LANE_CAPACITY = 64 * 1024;
+	constexpr auto REBIND_GRACE = 300ms;
+	//Отправитель шлёт на оба порта часть льготного периода, затем только на новый до его конца и после
+	constexpr auto MIXED_TIME = 100ms;
+	constexpr auto AFTER_SWITCH = 600ms;
+	constexpr uint32 BEFORE_SWITCH = 20000;
+	//Датаграмм в пути: столько умещается в буфере приёма ядра по умолчанию, потери здесь были бы потерями ядра
+	constexpr uint32 WINDOW = 64;
+	//Датаграмм в очереди старого сокета в момент его закрытия
+	constexpr uint32 QUEUED = 32;
+	//Полоса на несколько десятков датаграмм и очередь старого сокета в несколько раз больше неё
+	constexpr size_t SMALL_LANE = 1024;
+	constexpr uint32 BACKLOG = 256;
+
+	struct Sender {
+		std::atomic<uint32> received{0};
+		std::atomic<uint32> sent{0};
+		std::atomic<bool>	done{false};
+		sf::Uint16			from;
+		sf::Uint16			to;
+		demonorium::InputThread* input;
+
+		void run() {
+			sf::UdpSocket socket;
+			auto send = [&](uint32 number, sf::Uint16 port) {
+				while (number - received.load() >= WINDOW)
+					std::this_thread::yield();
+				socket.send(&number, sizeof(number), sf::IpAddress::LocalHost, port);
+				sent.store(number + 1);
+			};
+
+			uint32 number = 0;
+			for (; number < BEFORE_SWITCH; ++number)
+				send(number, from);
+
+			input->setPort(to);
+			//Запрос смены порта ещё не выполнен: датаграммы идут на старый порт
+			while (input->getPort() != to)
+				send(number++, from);
+
+			const auto switched = std::chrono::steady_clock::now();
+			while (std::chrono::steady_clock::now() - switched < MIXED_TIME) {
+				send(number, (number & 1) ? to : from);
+				++number;
+			}
+			//Старый сокет закрывается с непрочитанной очередью: поток приёма стоит, пока не истечёт льготный период
+			while (received.load() != sent.load())
+				std::this_thread::yield();
+			input->pause();
+			for (uint32 i = 0; i < QUEUED; ++i)
+				send(number++, from);
+			std::this_thread::sleep_until(switched + REBIND_GRACE + 50ms);
+			input->run();
+
+			while (std::chrono::steady_clock::now() - switched < AFTER_SWITCH)
+				send(number++, to);
+			done.store(true);
+		}
+	};
+
+	void rebind(demonorium::Transport transport, sf::Uint16 from, sf::Uint16 to) {
+		//Все датаграммы идут с одного адреса: защита от DDOS не должна их отбрасывать
+		demonorium::InputThread input(from, MAX_PACKET, LANE_CAPACITY, std::numeric_limits<size_t>::max(), 500ms, REBIND_GRACE);
+		input.setTransport(transport);
+		input.start();
+		//Сокет открывается в onInit
+		std::this_thread::sleep_for(50ms);
+
+		Sender sender;
+		sender.from  = from;
+		sender.to	 = to;
+		sender.input = &input;
+		std::thread thread(&Sender::run, &sender);
+
+		std::vector<bool> seen;
+		uint32 duplicates = 0;
+		auto last = std::chrono::steady_clock::now();
+		//После конца отправки ждём хвост, но не дольше секунды тишины
+		while (!sender.done.load() || (sender.received.load() != sender.sent.load())) {
+			void* memory = input.get();
+			if (memory == nullptr) {
+				if (std::chrono::steady_clock::now() - last > 1s)
+					break;
+				std::this_thread::yield();
+				continue;
+			}
+			last = std::chrono::steady_clock::now();
+
+			const auto& prefix = as_reference<demonorium::PacketPrefix>(memory);
+			uint32 number;
+			std::memcpy(&number, shift(memory, sizeof(demonorium::PacketPrefix)), sizeof(number));
+			if ((prefix.size == sizeof(number)) && (number < (1u << 24))) {
+				if (number >= seen.size())
+					seen.resize(number + 1, false);
+				if (seen[number])
+					++duplicates;
+				seen[number] = true;
+			}
+			sender.received.store(sender.received.load() + 1);
+		}
+		thread.join();
+
+		const uint32 sent = sender.sent.load();
+		uint32 lost = 0;
+		for (uint32 i = 0; i < sent; ++i)
+			if ((i >= seen.size()) || !seen[i])
+				++lost;
+		if (lost != 0)
+			std::cerr << "transport " << static_cast<int>(transport) << ": lost " << lost << " of " << sent << std::endl;
+
+		MGS_CHECK(sent > BEFORE_SWITCH);
+		MGS_CHECK(lost == 0);
+		MGS_CHECK(duplicates == 0);
+		MGS_CHECK(input.getPort() == to);
+		MGS_CHECK(input.laneStats(demonorium::Lane::GAME).dropped == 0);
+		input.destroyThread();
+	}
+
+	void fullLane(demonorium::Transport transport, sf::Uint16 from, sf::Uint16 to) {
+		demonorium::InputThread input(from, MAX_PACKET, SMALL_LANE, std::numeric_limits<size_t>::max(), 500ms, REBIND_GRACE);
+		input.setTransport(transport);
+		input.start();
+		std::this_thread::sleep_for(50ms);
+
+		//Читатель стоит: полоса заполняется, остальное ждёт в очереди старого сокета
+		sf::UdpSocket socket;
+		for (uint32 number = 0; number < BACKLOG; ++number)
+			socket.send(&number, sizeof(number), sf::IpAddress::LocalHost, from);
+		input.setPort(to);
+		const auto start = std::chrono::steady_clock::now();
+		while ((input.getPort() != to) && (std::chrono::steady_clock::now() - start < 1s))
+			std::this_thread::yield();
+		//Льготный период истекает при заполненной полосе
+		std::this_thread::sleep_for(REBIND_GRACE + 200ms);
+
+		std::vector<bool> seen(BACKLOG, false);
+		uint32 received = 0;
+		uint32 duplicates = 0;
+		auto last = std::chrono::steady_clock::now();
+		while ((received < BACKLOG) && (std::chrono::steady_clock::now() - last < 1s)) {
+			void* memory = input.get();
+			if (memory == nullptr) {
+				input.drained();
+				std::this_thread::yield();
+				continue;
+			}
+			last = std::chrono::steady_clock::now();
+			uint32 number;
+			std::memcpy(&number, shift(memory, sizeof(demonorium::PacketPrefix)), sizeof(number));
+			if (number < BACKLOG) {
+				if (seen[number])
+					++duplicates;
+				seen[number] = true;
+				++received;
+			}
+		}
+		if (received != BACKLOG)
+			std::cerr << "transport " << static_cast<int>(transport) << ": full lane, received " << received << " of " << BACKLOG << std::endl;
+
+		MGS_CHECK(input.getPort() == to);
+		MGS_CHECK(received == BACKLOG);
+		MGS_CHECK(duplicates == 0);
+		MGS_CHECK(input.laneStats(demonorium::Lane::GAME).dropped == 0);
+		input.destroyThread();
+	}
+}
+
+int main() {
+	rebind(demonorium::Transport::SOCKETS, 45220, 45221);
+	//Без io_uring в ядре поток приёма сам переходит на сокеты
+	rebind(demonorium::Transport::URING, 45222, 45223);
+	fullLane(demonorium::Transport::SOCKETS, 45224, 45225);
+	fullLane(demonorium::Transport::URING, 45226, 45227);
+	return mgs::test::result();
+}
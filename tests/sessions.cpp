@@ -0,0 +1,97 @@
+﻿#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "Check.h"
+#include "Replay.h"
+
+/*
+ * Клиенты за общим NAT: регистрации с одного адреса и разных портов дают разных игроков со своими сессиями.
+ * Повтор заявки того же клиента только подтверждается ещё раз, пакет без сессии с такого адреса не достаётся
+ * ни одному из игроков, а пакет с сессией - только своему. Трафик подаётся воспроизведением захвата,
+ * итоговый список игроков читается из файла состояния, который сервер пишет при остановке.
+ */
+
+using demonorium::aliases::byte;
+using demonorium::aliases::uint16;
+using demonorium::aliases::uint32;
+
+namespace
+{
+	constexpr const char* CAPTURE_PATH = "sessions_test.mgc";
+	constexpr const char* STATE_PATH = "Server.state";
+	const sf::IpAddress SHARED(10, 0, 0, 1);
+	constexpr sf::Uint16 FIRST_PORT	 = 40000;
+	constexpr sf::Uint16 SECOND_PORT = 40001;
+	//Сессия второго клиента в новой таблице: поколение 1, слот 1
+	constexpr demonorium::SessionId SECOND_SESSION = (1u << 24) | 1;
+
+	void record(std::ofstream& file, uint32 time, sf::IpAddress address, sf::Uint16 port, const std::string& data) {
+		const uint32 ip	  = address.toInteger();
+		const uint16 size = static_cast<uint16>(data.size());
+		file.write(reinterpret_cast<const char*>(&time), sizeof(time));
+		file.write(reinterpret_cast<const char*>(&ip), sizeof(ip));
+		file.write(reinterpret_cast<const char*>(&port), sizeof(port));
+		file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		file.write(data.data(), size);
+	}
+
+	std::string registration(sf::Uint16 port, const std::string& name) {
+		std::string packet(1, static_cast<char>(demonorium::ClientCodes::REGISTER));
+		packet += "valid cd";
+		packet.append(reinterpret_cast<const char*>(&port), sizeof(port));
+		return packet + name;
+	}
+
+	std::string removal(const demonorium::SessionId* session) {
+		std::string packet(1, static_cast<char>(demonorium::ClientCodes::DELETE));
+		if (session != nullptr) {
+			packet[0] = static_cast<char>(packet[0] | demonorium::SESSION_FLAG);
+			packet.append(reinterpret_cast<const char*>(session), sizeof(*session));
+		}
+		return packet;
+	}
+
+	void writeCapture() {
+		std::ofstream file(CAPTURE_PATH, std::ios_base::binary | std::ios_base::trunc);
+		demonorium::CaptureHeader header{};
+		std::memcpy(header.magic, demonorium::CAPTURE_MAGIC, sizeof(header.magic));
+		header.format = demonorium::CAPTURE_FORMAT;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		record(file, 0,	  SHARED, 50000, registration(FIRST_PORT, "first"));
+		record(file, 0,	  SHARED, 50001, registration(SECOND_PORT, "second"));
+		//Повтор заявки первого клиента
+		record(file, 50,  SHARED, 50000, registration(FIRST_PORT, "first"));
+		//Без сессии: с адреса два игрока, пакет не должен удалить ни одного
+		record(file, 100, SHARED, 50000, removal(nullptr));
+		record(file, 200, SHARED, 50001, removal(&SECOND_SESSION));
+		//Кадры после последнего изменения публикуют снимок
+		record(file, 1000, sf::IpAddress(10, 9, 9, 9), 50002, removal(nullptr));
+	}
+}
+
+int main() {
+	writeCapture();
+	std::remove(STATE_PATH);
+	{
+		demonorium::Server server("valid cd");
+		demonorium::CaptureReplay replay(server);
+		if (!MGS_CHECK(replay.open(CAPTURE_PATH)))
+			return mgs::test::result();
+		const auto stats = replay.run();
+		MGS_CHECK(stats.datagrams == 6);
+		//Два подтверждения регистрации и одно повторное
+		MGS_CHECK(stats.responses == 3);
+	}
+
+	demonorium::StateReader state;
+	if (!MGS_CHECK(state.open(STATE_PATH)) || !MGS_CHECK(state.size() == 1))
+		return mgs::test::result();
+	const auto& player = state[0];
+	MGS_CHECK(sf::IpAddress(player.ip) == SHARED);
+	MGS_CHECK(player.port == FIRST_PORT);
+	MGS_CHECK(state.name(player) == "first");
+	return mgs::test::result();
+}
@@ -0,0 +1,231 @@
+﻿#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "Flow.h"
+#include "Framing.h"
+#include "Name.h"
+#include "PacketRing.h"
+#include "SessionTable.h"
+#include "TimerWheel.h"
+
+/*
+ * Структуры данных ядра сервера без сети и потоков сервера: кольцо пакетов, колесо таймеров,
+ * планировщик сценариев Flow, таблица имён, таблица сессий и разбор датаграмм с кадрами.
+ */
+
+using namespace demonorium;
+
+namespace
+{
+	//Записи разного размера идут по кругу через конец памяти и читаются в том же порядке
+	void packetRingOrder() {
+		PacketRing ring(4096, 300);
+		uint32 written = 0;
+		uint32 read = 0;
+		for (int round = 0; round < 1000; ++round) {
+			while (true) {
+				const size_t size = 1 + written % 300;
+				void* memory = ring.write(size);
+				if (memory == nullptr)
+					break;
+				auto* data = static_cast<byte*>(memory) + sizeof(PacketPrefix);
+				std::memset(data, static_cast<int>(written & 0xFF), size);
+				new (memory) PacketPrefix(size, sf::IpAddress(written));
+				ring.validWrite();
+				++written;
+			}
+			MGS_CHECK(ring.full());
+			for (int i = 0; i < 3; ++i) {
+				void* memory = ring.read();
+				if (!MGS_CHECK(memory != nullptr))
+					return;
+				const auto& prefix = *static_cast<PacketPrefix*>(memory);
+				const auto* data = static_cast<byte*>(memory) + sizeof(PacketPrefix);
+				MGS_CHECK(prefix.size == 1 + read % 300);
+				MGS_CHECK(prefix.ip == sf::IpAddress(read));
+				MGS_CHECK(data[0] == (read & 0xFF) && data[prefix.size - 1] == (read & 0xFF));
+				++read;
+			}
+		}
+		MGS_CHECK(ring.write(301) == nullptr);
+	}
+
+	//Один писатель и один читатель в разных потоках: ничего не теряется и не переставляется
+	void packetRingThreads() {
+		constexpr uint32 COUNT = 200000;
+		PacketRing ring(8192, 64);
+		std::thread writer([&ring]() {
+			for (uint32 i = 0; i < COUNT;) {
+				void* memory = ring.write(sizeof(i));
+				if (memory == nullptr) {
+					std::this_thread::yield();
+					continue;
+				}
+				std::memcpy(static_cast<byte*>(memory) + sizeof(PacketPrefix), &i, sizeof(i));
+				new (memory) PacketPrefix(sizeof(i), sf::IpAddress::LocalHost);
+				ring.validWrite();
+				++i;
+			}
+		});
+		uint32 expected = 0;
+		bool ordered = true;
+		while (expected < COUNT) {
+			void* memory = ring.read();
+			if (memory == nullptr) {
+				std::this_thread::yield();
+				continue;
+			}
+			uint32 value;
+			std::memcpy(&value, static_cast<byte*>(memory) + sizeof(PacketPrefix), sizeof(value));
+			ordered = ordered && (value == expected);
+			++expected;
+		}
+		writer.join();
+		MGS_CHECK(ordered);
+		MGS_CHECK(ring.read() == nullptr);
+	}
+
+	//Таймеры дальше оборота колеса ждут своего оборота, прошедшие тики срабатывают на следующем
+	void timerWheel() {
+		TimerWheel<int> wheel(8);
+		wheel.schedule(3, 3);
+		wheel.schedule(20, 20);
+		wheel.schedule(11, 11);
+		std::vector<int> fired;
+		const auto collect = [&fired](int value) { fired.push_back(value); };
+		wheel.advance(10, collect);
+		MGS_CHECK((fired == std::vector<int>{3}));
+		wheel.schedule(5, 5);
+		wheel.advance(11, collect);
+		MGS_CHECK((fired == std::vector<int>{3, 11, 5}) || (fired == std::vector<int>{3, 5, 11}));
+		wheel.advance(30, collect);
+		MGS_CHECK(fired.size() == 4 && fired.back() == 20);
+		MGS_CHECK(wheel.size() == 0);
+	}
+
+	//Номер ушедшего игрока не находит нового игрока в том же слоте
+	Flow sleeper(FlowScheduler& scheduler, Clock::delay duration, bool& woken) {
+		co_await scheduler.sleep(duration);
+		woken = true;
+	}
+
+	//Сон, начатый после простоя сервера, отсчитывается от момента засыпания, а не от последнего advance
+	void flowSleepAfterIdle() {
+		Clock::manual(true);
+		const tick origin = Clock::update();
+		FlowScheduler scheduler(origin);
+		scheduler.advance(origin);
+
+		const tick idle = Clock::after(origin, Clock::delay(1000));
+		Clock::set(idle);
+		bool woken = false;
+		sleeper(scheduler, Clock::delay(50), woken);
+		scheduler.advance(Clock::after(idle, Clock::delay(20)));
+		MGS_CHECK(!woken);
+		scheduler.advance(Clock::after(idle, Clock::delay(60)));
+		MGS_CHECK(woken);
+		Clock::manual(false);
+	}
+
+	//Слот имени освобождается с последней копией и занимается снова, живые имена при этом не меняются
+	void nameTable() {
+		NameTable& table = NameTable::global();
+		Name kept;
+		MGS_CHECK(table.intern("kept", kept));
+
+		Name first;
+		MGS_CHECK(table.intern("alpha", first));
+		Name copy = first;
+		Name again;
+		MGS_CHECK(table.intern("alpha", again) && (again == first));
+		const uint32 slot = first.id();
+		const size_t size = table.size();
+
+		first = Name();
+		copy  = Name();
+		//Имя найдено снова, пока слот ждал: слот остаётся за ним
+		again = Name();
+		Name revived;
+		MGS_CHECK(table.intern("alpha", revived) && (revived.id() == slot));
+		Name other;
+		MGS_CHECK(table.intern("beta", other) && (other.id() != slot));
+
+		revived = Name();
+		Name reused;
+		MGS_CHECK(table.intern("gamma", reused) && (reused.id() == slot));
+		MGS_CHECK(reused.view() == "gamma");
+
+		//Поток разных имён без копий не растит таблицу, а индекс после удалений находит живые имена
+		bool found = true;
+		for (int i = 0; i < 20000; ++i) {
+			Name transient;
+			table.intern("name " + std::to_string(i), transient);
+			Name lookup;
+			found = found && table.intern("kept", lookup) && (lookup == kept) && table.intern("beta", lookup) && (lookup == other);
+		}
+		MGS_CHECK(found);
+		MGS_CHECK(table.size() <= size + 2);
+		MGS_CHECK(kept.view() == "kept" && other.view() == "beta" && reused.view() == "gamma");
+	}
+
+	void sessionTable() {
+		SessionTable<int> table;
+		const SessionId first = table.open(1);
+		MGS_CHECK(first != NO_SESSION);
+		MGS_CHECK(table.find(first) != nullptr && *table.find(first) == 1);
+		table.close(first);
+		const SessionId second = table.open(2);
+		MGS_CHECK(second != first);
+		MGS_CHECK(table.find(first) == nullptr);
+		MGS_CHECK(table.find(second) != nullptr && *table.find(second) == 2);
+		table.clear();
+		MGS_CHECK(table.find(second) == nullptr);
+		MGS_CHECK(table.size() == 0);
+
+		//Слотов больше 65536, и номера ушедших игроков не находят новых владельцев тех же слотов
+		std::vector<SessionId> sessions;
+		bool opened = true;
+		for (int i = 0; i < 70000; ++i) {
+			sessions.push_back(table.open(i));
+			opened = opened && (sessions.back() != NO_SESSION);
+		}
+		MGS_CHECK(opened);
+		MGS_CHECK(table.find(sessions.back()) != nullptr && *table.find(sessions.back()) == 69999);
+		for (SessionId session : sessions)
+			table.close(session);
+		bool stale = false;
+		for (int i = 0; i < 70000; ++i)
+			table.open(-i);
+		for (SessionId session : sessions)
+			stale = stale || (table.find(session) != nullptr);
+		MGS_CHECK(!stale);
+		MGS_CHECK(table.size() == 70000);
+	}
+
+	//Длина кадра за концом датаграммы останавливает разбор
+	void frameReader() {
+		const byte datagram[] = {FRAMED, 1, 0, 6, 2, 0, 3, 4, 9, 0, 1};
+		MGS_CHECK(isFramed(datagram, sizeof(datagram)));
+		FrameReader reader(datagram, sizeof(datagram));
+		const byte* message;
+		size_t size;
+		MGS_CHECK(reader.next(message, size) && size == 1 && message[0] == 6);
+		MGS_CHECK(reader.next(message, size) && size == 2 && message[0] == 3 && message[1] == 4);
+		MGS_CHECK(!reader.next(message, size));
+		MGS_CHECK(!reader.next(message, size));
+	}
+}
+
+int main() {
+	packetRingOrder();
+	packetRingThreads();
+	timerWheel();
+	flowSleepAfterIdle();
+	nameTable();
+	sessionTable();
+	frameReader();
+	return mgs::test::result();
+}
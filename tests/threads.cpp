@@ -0,0 +1,141 @@
+﻿#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "BaseThread.h"
+#include "Check.h"
+
+/*
+ * Пауза и продолжение BaseThread тысячи раз подряд: каждый переход должен завершаться, не теряя пробуждений.
+ * Поток спит внутри onFrame на своём Futex, как потоки сервера, и просыпается только по onInterrupt.
+ * Та же программа собирается с DEMONORIUM_PORTABLE_FUTEX и проверяет запасной путь на mutex и condition_variable.
+ */
+
+using namespace std::chrono_literals;
+using demonorium::aliases::uint32;
+using demonorium::aliases::uint64;
+
+namespace
+{
+	constexpr uint32 CYCLES = 5000;
+	constexpr uint32 RACING_CYCLES = 2000;
+	//Потерянное пробуждение стоит потоку целого FRAME_SLEEP: сумма таких задержек выходит за предел времени
+	constexpr auto FRAME_SLEEP = 1s;
+	constexpr auto TIME_LIMIT = 30s;
+
+	class Counter: public demonorium::BaseThread {
+		demonorium::Futex m_signal;
+	protected:
+		void onInit() override {
+		}
+
+		void onFrame() override {
+			frames.fetch_add(1);
+			//Если пауза уже запрошена, onInterrupt прибавит к слову после этого чтения
+			const uint32 key = m_signal.load();
+			if (isRunning())
+				m_signal.waitFor(key, FRAME_SLEEP);
+		}
+
+		void onPause() override {
+			pauses.fetch_add(1);
+		}
+
+		void onUnPause() override {
+			resumes.fetch_add(1);
+		}
+
+		void onInterrupt() override {
+			m_signal.fetchAdd(1);
+			m_signal.wakeAll();
+		}
+	public:
+		std::atomic<uint64> frames{0};
+		std::atomic<uint64> pauses{0};
+		std::atomic<uint64> resumes{0};
+	};
+
+	//Один управляющий поток: после pause поток стоит, после run снова выполняет кадры
+	void sequential() {
+		Counter counter;
+		counter.start();
+
+		bool states = true;
+		bool frozen = true;
+		for (uint32 cycle = 0; cycle < CYCLES; ++cycle) {
+			counter.pause();
+			states = states && (counter.getState() == demonorium::BaseThread::PAUSED);
+			if (cycle % 500 == 0) {
+				const uint64 frames = counter.frames.load();
+				std::this_thread::sleep_for(2ms);
+				frozen = frozen && (counter.frames.load() == frames);
+			}
+			counter.run();
+			states = states && (counter.getState() == demonorium::BaseThread::RUNNING);
+		}
+		MGS_CHECK(states);
+		MGS_CHECK(frozen);
+		MGS_CHECK(counter.pauses.load() == CYCLES);
+		MGS_CHECK(counter.resumes.load() == CYCLES);
+
+		counter.destroyThread();
+		MGS_CHECK(counter.getState() == demonorium::BaseThread::STOPPED);
+		MGS_CHECK(!counter.containsThread());
+	}
+
+	//Два управляющих потока одновременно: переходы не должны зависать, пары onPause/onUnPause не рвутся
+	void racing() {
+		Counter counter;
+		counter.start();
+
+		auto control = [&counter] {
+			for (uint32 cycle = 0; cycle < RACING_CYCLES; ++cycle) {
+				counter.pause();
+				counter.run();
+			}
+		};
+		std::thread first(control);
+		std::thread second(control);
+		first.join();
+		second.join();
+
+		//Последний run мог выполниться до чужого pause
+		counter.pause();
+		const uint64 frames = counter.frames.load();
+		counter.run();
+		MGS_CHECK(counter.getState() == demonorium::BaseThread::RUNNING);
+		MGS_CHECK(counter.pauses.load() == counter.resumes.load());
+		MGS_CHECK(counter.pauses.load() >= RACING_CYCLES);
+
+		//После продолжения поток снова выполняет кадры
+		const auto deadline = std::chrono::steady_clock::now() + 1s;
+		while ((counter.frames.load() == frames) && (std::chrono::steady_clock::now() < deadline))
+			std::this_thread::yield();
+		MGS_CHECK(counter.frames.load() > frames);
+		counter.destroyThread();
+		MGS_CHECK(!counter.containsThread());
+	}
+
+	//Остановка на паузе и сразу после запуска
+	void destruction() {
+		bool stopped = true;
+		for (uint32 cycle = 0; cycle < CYCLES / 10; ++cycle) {
+			Counter counter;
+			counter.start();
+			if (cycle & 1)
+				counter.pause();
+			counter.destroyThread();
+			stopped = stopped && (counter.getState() == demonorium::BaseThread::STOPPED);
+		}
+		MGS_CHECK(stopped);
+	}
+}
+
+int main() {
+	const auto start = std::chrono::steady_clock::now();
+	sequential();
+	racing();
+	destruction();
+	MGS_CHECK(std::chrono::steady_clock::now() - start < TIME_LIMIT);
+	return mgs::test::result();
+}